@@ -1,134 +1,104 @@
-/*
-  Base32.cpp - Library for encoding to/decoding from Base32.
-  Compatible with RFC 4648 ( http://tools.ietf.org/html/rfc4648 )
-  Created by Vladimir Tarasow, December 18, 2012.
-  Released into the public domain.
-*/
-#include "Arduino.h"
-#include "Base32.h"
-#include "stdint.h"
-
-Base32::Base32() 
-{
-}
+// (c) 2024 Takhir Latypov <cregennandev@gmail.com>
+// MIT License
 
-int Base32::toBase32(byte* in, long length, byte*& out)
-{
-  return toBase32(in, length, out, false);
-}
-
-int Base32::toBase32(byte* in, long length, byte*& out, boolean usePadding)
-{
-  char base32StandardAlphabet[] = {"ABCDEFGHIJKLMNOPQRSTUVWXYZ234567"};
-  char standardPaddingChar = '='; 
-
-  int result = 0;
-  int count = 0;
-  int bufSize = 8;
-  int index = 0;
-  int size = 0; // size of temporary array
-  byte* temp = NULL;
+#include "Base32.h"
+#include <array>
 
-  if (length < 0 || length > 268435456LL) 
-  { 
-    return 0;
-  }
+namespace {
+    constexpr char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+    constexpr char PADDING = '=';
 
-  size = 8 * ceil(length / 4.0); // Calculating size of temporary array. Not very precise.
-  temp = (byte*)malloc(size); // Allocating temporary array.
+    // Значения таблицы декодирования помимо 0-31
+    constexpr uint8_t SKIP = 0x40;
+    constexpr uint8_t INVALID = 0x80;
 
-  if (length > 0)
-  {
-    int buffer = in[0];
-    int next = 1;
-    int bitsLeft = 8;
-    
-    while (count < bufSize && (bitsLeft > 0 || next < length))
+    constexpr std::array<uint8_t, 256> makeDecodeTable()
     {
-      if (bitsLeft < 5)
-      {
-        if (next < length)
-        {
-          buffer <<= 8;
-          buffer |= in[next] & 0xFF;
-          next++;
-          bitsLeft += 8;
+        std::array<uint8_t, 256> table{};
+        for (auto & value : table){
+            value = INVALID;
         }
-        else
-        {
-          int pad = 5 - bitsLeft;
-          buffer <<= pad;
-          bitsLeft += pad;
+        for (uint8_t i = 0; i < 32; i++){
+            table[(uint8_t)ALPHABET[i]] = i;
+            if (ALPHABET[i] >= 'A' && ALPHABET[i] <= 'Z'){
+                table[(uint8_t)(ALPHABET[i] | 0x20)] = i;
+            }
         }
-      }
-      index = 0x1F & (buffer >> (bitsLeft -5));
-
-      bitsLeft -= 5;
-      temp[result] = (byte)base32StandardAlphabet[index];
-      result++;
-    }
-  }
-  
-  if (usePadding)
-  {
-    int pads = (result % 8);
-    if (pads > 0)
-    {
-      pads = (8 - pads);
-      for (int i = 0; i < pads; i++) 
-      {
-        temp[result] = standardPaddingChar;
-        result++;
-      }
+        // Опечатки при ручном вводе
+        table['0'] = table['O'];
+        table['1'] = table['L'];
+        table['8'] = table['B'];
+        // Разделители и выравнивание, 0xA0 - неразрывный пробел
+        for (uint8_t ch : {' ', '\t', '\r', '\n', '=', '\xA0'}){
+            table[ch] = SKIP;
+        }
+        return table;
     }
-  }
 
-  out = (byte*)malloc(result);
-  memcpy(out, temp, result);
-  free(temp);
-  
-  return result;
+    constexpr auto DECODE_TABLE = makeDecodeTable();
 }
 
-int Base32::fromBase32(byte* in, long length, byte*& out)
-{
-  int result = 0; // Length of the array of decoded values.
-  int buffer = 0;
-  int bitsLeft = 0;
-  byte* temp = NULL;
+std::size_t base32Encode(const uint8_t * in, std::size_t length, char * out, std::size_t capacity, bool padding) {
+    const auto required = base32EncodedLength(length, padding);
+    if (capacity < required){
+        return 0;
+    }
 
-  temp = (byte*)malloc(length); // Allocating temporary array.
+    // Полные группы: 5 байт в 8 символов через 40-битное слово
+    std::size_t written = 0;
+    std::size_t i = 0;
+    for (; i + 5 <= length; i += 5){
+        uint64_t group = (uint64_t)in[i] << 32 | (uint64_t)in[i + 1] << 24 | (uint64_t)in[i + 2] << 16
+                       | (uint64_t)in[i + 3] << 8 | in[i + 4];
+        for (int shift = 35; shift >= 0; shift -= 5){
+            out[written++] = ALPHABET[(group >> shift) & 0x1F];
+        }
+    }
 
-  for (int i = 0; i < length; i++)
-  {
-    byte ch = in[i];
+    // Хвост: оставшиеся биты дополняются нулями до символа
+    uint32_t buffer = 0;
+    int bits = 0;
+    for (; i < length; i++){
+        buffer = buffer << 8 | in[i];
+        bits += 8;
+        while (bits >= 5){
+            bits -= 5;
+            out[written++] = ALPHABET[(buffer >> bits) & 0x1F];
+        }
+    }
+    if (bits > 0){
+        out[written++] = ALPHABET[(buffer << (5 - bits)) & 0x1F];
+    }
 
-    // ignoring some characters: ' ', '\t', '\r', '\n', '='
-    if (ch == 0xA0 || ch == 0x09 || ch == 0x0A || ch == 0x0D || ch == 0x3D) continue;
+    while (written < required){
+        out[written++] = PADDING;
+    }
+    return written;
+}
 
-    // recovering mistyped: '0' -> 'O', '1' -> 'L', '8' -> 'B'
-    if (ch == 0x30) { ch = 0x4F; } else if (ch == 0x31) { ch = 0x4C; } else if (ch == 0x38) { ch = 0x42; }
-    
+bool base32Decode(std::string_view in, uint8_t * out, std::size_t capacity, std::size_t & length) {
+    length = 0;
+    uint32_t buffer = 0;
+    int bits = 0;
 
-    // look up one base32 symbols: from 'A' to 'Z' or from 'a' to 'z' or from '2' to '7'
-    if ((ch >= 0x41 && ch <= 0x5A) || (ch >= 0x61 && ch <= 0x7A)) { ch = ((ch & 0x1F) - 1); }
-    else if (ch >= 0x32 && ch <= 0x37) { ch -= (0x32 - 26); }
-    else { free(temp); return 0; }
+    for (auto ch : in){
+        auto value = DECODE_TABLE[(uint8_t)ch];
+        if (value == SKIP){
+            continue;
+        }
+        if (value == INVALID){
+            return false;
+        }
 
-    buffer <<= 5;    
-    buffer |= ch;
-    bitsLeft += 5;
-    if (bitsLeft >= 8)
-    {
-      temp[result] = (unsigned char)((unsigned int)(buffer >> (bitsLeft - 8)) & 0xFF);
-      result++;
-      bitsLeft -= 8;
+        buffer = buffer << 5 | value;
+        bits += 5;
+        if (bits >= 8){
+            bits -= 8;
+            if (length == capacity){
+                return false;
+            }
+            out[length++] = (uint8_t)(buffer >> bits);
+        }
     }
-  }
-
-  out = (byte*)malloc(result);
-  memcpy(out, temp, result);
-  free(temp);
-
-  return result;
+    return true;
 }
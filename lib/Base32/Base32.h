@@ -1,23 +1,42 @@
-/*
-  Base32.h - Library for encoding to/decoding from Base32.
-  Compatible with RFC 4648 ( http://tools.ietf.org/html/rfc4648 )
-  Created by Vladimir Tarasow, December 18, 2012.
-  Released into the public domain.
-*/
+// (c) 2024 Takhir Latypov <cregennandev@gmail.com>
+// MIT License
+
+#ifndef KEECHAIN_BASE32_H_GUARD
+#define KEECHAIN_BASE32_H_GUARD
+#pragma once
 
-#ifndef Base32_h
-#define Base32_h
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
 
-#include "Arduino.h"
-#include "stdint.h"
+/*
+ * Base32 по RFC 4648 без выделения памяти: результат пишется в буфер вызывающего
+ * Заменяет библиотеку Base32 (Vladimir Tarasow), которая выделяла память на каждый вызов
+ */
+
+// Точная длина Base32 для length байт: без выравнивания ceil(8 * length / 5), с ним - кратно 8
+constexpr std::size_t base32EncodedLength(std::size_t length, bool padding = false)
+{
+    return padding ? (length + 4) / 5 * 8 : (length * 8 + 4) / 5;
+}
 
-class Base32
+// Наибольшая длина результата для symbols символов Base32, неполные последние биты отбрасываются
+constexpr std::size_t base32DecodedLength(std::size_t symbols)
 {
-  public:
-    Base32();
-    int toBase32(byte*, long, byte*&);
-    int toBase32(byte*, long, byte*&, boolean);
-    int fromBase32(byte*, long, byte*&);
-};
-
-#endif
+    return symbols * 5 / 8;
+}
+
+/*
+ * Кодирование length байт в out (алфавит A-Z2-7), возвращает количество символов
+ * 0, если в out меньше base32EncodedLength(length, padding) символов. Завершающий ноль не пишется
+ */
+std::size_t base32Encode(const uint8_t * in, std::size_t length, char * out, std::size_t capacity, bool padding = false);
+
+/*
+ * Декодирование в out емкостью capacity, количество байт в length
+ * Регистр не важен, пробелы, переводы строк и '=' пропускаются, опечатки 0, 1, 8 читаются как O, L, B
+ * false на любом другом символе или если результат не помещается в out
+ */
+bool base32Decode(std::string_view in, uint8_t * out, std::size_t capacity, std::size_t & length);
+
+#endif // Guard
@@ -0,0 +1,410 @@
+// (c) 2024 Takhir Latypov <cregennandev@gmail.com>
+// MIT License
+
+#include "Cipher.h"
+#include <Otp.h>
+
+static inline uint32_t rotateLeft(uint32_t value, unsigned bits)
+{
+    return (value << bits) | (value >> (32 - bits));
+}
+
+// Байты в слово little-endian без требований к выравниванию, компилятор сводит это к одной загрузке
+static inline uint32_t loadLe32(const uint8_t * bytes)
+{
+    return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+static inline void storeLe32(uint8_t * bytes, uint32_t value)
+{
+    bytes[0] = (uint8_t)value;
+    bytes[1] = (uint8_t)(value >> 8);
+    bytes[2] = (uint8_t)(value >> 16);
+    bytes[3] = (uint8_t)(value >> 24);
+}
+
+static inline void storeLe64(uint8_t * bytes, uint64_t value)
+{
+    storeLe32(bytes, (uint32_t)value);
+    storeLe32(bytes + 4, (uint32_t)(value >> 32));
+}
+
+#define CHACHA20_QUARTER_ROUND(a, b, c, d) \
+    a += b; d = rotateLeft(d ^ a, 16);     \
+    c += d; b = rotateLeft(b ^ c, 12);     \
+    a += b; d = rotateLeft(d ^ a, 8);      \
+    c += d; b = rotateLeft(b ^ c, 7);
+
+// Ключевой поток одного блока словами: 20 раундов и сложение с исходным состоянием
+static void chacha20Words(const uint32_t state[16], uint32_t out[16])
+{
+    uint32_t x[16];
+    for (std::size_t i = 0; i < 16; i++)
+    {
+        x[i] = state[i];
+    }
+    for (std::size_t round = 0; round < 10; round++)
+    {
+        CHACHA20_QUARTER_ROUND(x[0], x[4], x[8], x[12])
+        CHACHA20_QUARTER_ROUND(x[1], x[5], x[9], x[13])
+        CHACHA20_QUARTER_ROUND(x[2], x[6], x[10], x[14])
+        CHACHA20_QUARTER_ROUND(x[3], x[7], x[11], x[15])
+        CHACHA20_QUARTER_ROUND(x[0], x[5], x[10], x[15])
+        CHACHA20_QUARTER_ROUND(x[1], x[6], x[11], x[12])
+        CHACHA20_QUARTER_ROUND(x[2], x[7], x[8], x[13])
+        CHACHA20_QUARTER_ROUND(x[3], x[4], x[9], x[14])
+    }
+    for (std::size_t i = 0; i < 16; i++)
+    {
+        out[i] = x[i] + state[i];
+    }
+    secureZero(x, sizeof(x));
+}
+
+#undef CHACHA20_QUARTER_ROUND
+
+static void chacha20State(const uint8_t key[CHACHA20_KEY_LENGTH], uint32_t counter,
+                          const uint8_t nonce[CHACHA20_NONCE_LENGTH], uint32_t state[16])
+{
+    // "expand 32-byte k"
+    state[0] = 0x61707865;
+    state[1] = 0x3320646E;
+    state[2] = 0x79622D32;
+    state[3] = 0x6B206574;
+    for (std::size_t i = 0; i < 8; i++)
+    {
+        state[4 + i] = loadLe32(key + 4 * i);
+    }
+    state[12] = counter;
+    for (std::size_t i = 0; i < 3; i++)
+    {
+        state[13 + i] = loadLe32(nonce + 4 * i);
+    }
+}
+
+void chacha20Block(const uint8_t key[CHACHA20_KEY_LENGTH], uint32_t counter,
+                   const uint8_t nonce[CHACHA20_NONCE_LENGTH], uint8_t out[CHACHA20_BLOCK_LENGTH])
+{
+    uint32_t state[16];
+    uint32_t stream[16];
+    chacha20State(key, counter, nonce, state);
+    chacha20Words(state, stream);
+    for (std::size_t i = 0; i < 16; i++)
+    {
+        storeLe32(out + 4 * i, stream[i]);
+    }
+    secureZero(state, sizeof(state));
+    secureZero(stream, sizeof(stream));
+}
+
+void chacha20Xor(const uint8_t key[CHACHA20_KEY_LENGTH], uint32_t counter, const uint8_t nonce[CHACHA20_NONCE_LENGTH],
+                 const uint8_t * in, uint8_t * out, std::size_t length)
+{
+    uint32_t state[16];
+    uint32_t stream[16];
+    chacha20State(key, counter, nonce, state);
+    while (length > 0)
+    {
+        chacha20Words(state, stream);
+        state[12]++;
+
+        const auto chunk = length < CHACHA20_BLOCK_LENGTH ? length : CHACHA20_BLOCK_LENGTH;
+        std::size_t word = 0;
+        for (; 4 * word + 4 <= chunk; word++)
+        {
+            storeLe32(out + 4 * word, loadLe32(in + 4 * word) ^ stream[word]);
+        }
+        for (auto i = 4 * word; i < chunk; i++)
+        {
+            out[i] = in[i] ^ (uint8_t)(stream[word] >> (8 * (i % 4)));
+        }
+        in += chunk;
+        out += chunk;
+        length -= chunk;
+    }
+    secureZero(state, sizeof(state));
+    secureZero(stream, sizeof(stream));
+}
+
+void Poly1305Context::init(const uint8_t key[POLY1305_KEY_LENGTH])
+{
+    // Зажатие r по RFC 8439, сразу с разбиением на 26-битные части
+    r[0] = loadLe32(key) & 0x3FFFFFF;
+    r[1] = (loadLe32(key + 3) >> 2) & 0x3FFFF03;
+    r[2] = (loadLe32(key + 6) >> 4) & 0x3FFC0FF;
+    r[3] = (loadLe32(key + 9) >> 6) & 0x3F03FFF;
+    r[4] = (loadLe32(key + 12) >> 8) & 0x00FFFFF;
+    for (std::size_t i = 0; i < 4; i++)
+    {
+        s[i] = loadLe32(key + 16 + 4 * i);
+    }
+    for (auto & limb : h)
+    {
+        limb = 0;
+    }
+    buffered = 0;
+}
+
+void Poly1305Context::blocks(const uint8_t * data, std::size_t length, uint32_t hibit)
+{
+    const uint32_t r0 = r[0], r1 = r[1], r2 = r[2], r3 = r[3], r4 = r[4];
+    const uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+    uint32_t h0 = h[0], h1 = h[1], h2 = h[2], h3 = h[3], h4 = h[4];
+
+    while (length >= 16)
+    {
+        h0 += loadLe32(data) & 0x3FFFFFF;
+        h1 += (loadLe32(data + 3) >> 2) & 0x3FFFFFF;
+        h2 += (loadLe32(data + 6) >> 4) & 0x3FFFFFF;
+        h3 += (loadLe32(data + 9) >> 6) & 0x3FFFFFF;
+        h4 += (loadLe32(data + 12) >> 8) | hibit;
+
+        const uint64_t d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3 + (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+        uint64_t d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4 + (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+        uint64_t d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0 + (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+        uint64_t d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1 + (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+        uint64_t d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2 + (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+        uint32_t carry = (uint32_t)(d0 >> 26);
+        h0 = (uint32_t)d0 & 0x3FFFFFF;
+        d1 += carry;
+        carry = (uint32_t)(d1 >> 26);
+        h1 = (uint32_t)d1 & 0x3FFFFFF;
+        d2 += carry;
+        carry = (uint32_t)(d2 >> 26);
+        h2 = (uint32_t)d2 & 0x3FFFFFF;
+        d3 += carry;
+        carry = (uint32_t)(d3 >> 26);
+        h3 = (uint32_t)d3 & 0x3FFFFFF;
+        d4 += carry;
+        carry = (uint32_t)(d4 >> 26);
+        h4 = (uint32_t)d4 & 0x3FFFFFF;
+        h0 += carry * 5;
+        carry = h0 >> 26;
+        h0 &= 0x3FFFFFF;
+        h1 += carry;
+
+        data += 16;
+        length -= 16;
+    }
+
+    h[0] = h0;
+    h[1] = h1;
+    h[2] = h2;
+    h[3] = h3;
+    h[4] = h4;
+}
+
+void Poly1305Context::update(const uint8_t * data, std::size_t length)
+{
+    if (buffered > 0)
+    {
+        while (length > 0 && buffered < sizeof(buffer))
+        {
+            buffer[buffered++] = *data++;
+            length--;
+        }
+        if (buffered < sizeof(buffer))
+        {
+            return;
+        }
+        blocks(buffer, sizeof(buffer), 1u << 24);
+        buffered = 0;
+    }
+
+    const auto whole = length & ~(std::size_t)15;
+    blocks(data, whole, 1u << 24);
+    data += whole;
+    length -= whole;
+
+    while (length-- > 0)
+    {
+        buffer[buffered++] = *data++;
+    }
+}
+
+void Poly1305Context::pad()
+{
+    static const uint8_t zeros[16] = {};
+    if (buffered > 0)
+    {
+        update(zeros, sizeof(buffer) - buffered);
+    }
+}
+
+void Poly1305Context::finish(uint8_t out[POLY1305_TAG_LENGTH])
+{
+    // Неполный последний блок дополняется единицей, а не старшим битом
+    if (buffered > 0)
+    {
+        buffer[buffered++] = 1;
+        while (buffered < sizeof(buffer))
+        {
+            buffer[buffered++] = 0;
+        }
+        blocks(buffer, sizeof(buffer), 0);
+    }
+
+    uint32_t h0 = h[0], h1 = h[1], h2 = h[2], h3 = h[3], h4 = h[4];
+    uint32_t carry = h1 >> 26;
+    h1 &= 0x3FFFFFF;
+    h2 += carry;
+    carry = h2 >> 26;
+    h2 &= 0x3FFFFFF;
+    h3 += carry;
+    carry = h3 >> 26;
+    h3 &= 0x3FFFFFF;
+    h4 += carry;
+    carry = h4 >> 26;
+    h4 &= 0x3FFFFFF;
+    h0 += carry * 5;
+    carry = h0 >> 26;
+    h0 &= 0x3FFFFFF;
+    h1 += carry;
+
+    // g = h + 5 - 2^130: если не отрицательно, h было не меньше модуля. Выбор маской, без ветвлений
+    uint32_t g0 = h0 + 5;
+    carry = g0 >> 26;
+    g0 &= 0x3FFFFFF;
+    uint32_t g1 = h1 + carry;
+    carry = g1 >> 26;
+    g1 &= 0x3FFFFFF;
+    uint32_t g2 = h2 + carry;
+    carry = g2 >> 26;
+    g2 &= 0x3FFFFFF;
+    uint32_t g3 = h3 + carry;
+    carry = g3 >> 26;
+    g3 &= 0x3FFFFFF;
+    const uint32_t g4 = h4 + carry - (1u << 26);
+
+    const uint32_t keep = (g4 >> 31) - 1;
+    h0 = (h0 & ~keep) | (g0 & keep);
+    h1 = (h1 & ~keep) | (g1 & keep);
+    h2 = (h2 & ~keep) | (g2 & keep);
+    h3 = (h3 & ~keep) | (g3 & keep);
+    h4 = (h4 & ~keep) | (g4 & keep);
+
+    // Обратно в 128 бит и сложение с s
+    uint64_t sum = (uint64_t)(h0 | (h1 << 26)) + s[0];
+    storeLe32(out, (uint32_t)sum);
+    sum = (uint64_t)((h1 >> 6) | (h2 << 20)) + s[1] + (sum >> 32);
+    storeLe32(out + 4, (uint32_t)sum);
+    sum = (uint64_t)((h2 >> 12) | (h3 << 14)) + s[2] + (sum >> 32);
+    storeLe32(out + 8, (uint32_t)sum);
+    sum = (uint64_t)((h3 >> 18) | (h4 << 8)) + s[3] + (sum >> 32);
+    storeLe32(out + 12, (uint32_t)sum);
+
+    secureZero(r, sizeof(r));
+    secureZero(h, sizeof(h));
+    secureZero(s, sizeof(s));
+    secureZero(buffer, sizeof(buffer));
+    buffered = 0;
+}
+
+// Тег AEAD: ключ Poly1305 - начало блока 0, данные - aad и шифртекст с выравниванием и длинами
+static void chacha20Poly1305Tag(const uint8_t key[CHACHA20_KEY_LENGTH], const uint8_t nonce[CHACHA20_NONCE_LENGTH],
+                                const uint8_t * aad, std::size_t aadLength,
+                                const uint8_t * cipher, std::size_t length, uint8_t tag[POLY1305_TAG_LENGTH])
+{
+    uint8_t block[CHACHA20_BLOCK_LENGTH];
+    chacha20Block(key, 0, nonce, block);
+
+    Poly1305Context poly;
+    poly.init(block);
+    secureZero(block, sizeof(block));
+    poly.update(aad, aadLength);
+    poly.pad();
+    poly.update(cipher, length);
+    poly.pad();
+
+    uint8_t lengths[16];
+    storeLe64(lengths, aadLength);
+    storeLe64(lengths + 8, length);
+    poly.update(lengths, sizeof(lengths));
+    poly.finish(tag);
+}
+
+void chacha20Poly1305Seal(const uint8_t key[CHACHA20_KEY_LENGTH], const uint8_t nonce[CHACHA20_NONCE_LENGTH],
+                          const uint8_t * aad, std::size_t aadLength,
+                          const uint8_t * plain, std::size_t length,
+                          uint8_t * out, uint8_t tag[POLY1305_TAG_LENGTH])
+{
+    chacha20Xor(key, 1, nonce, plain, out, length);
+    chacha20Poly1305Tag(key, nonce, aad, aadLength, out, length, tag);
+}
+
+bool chacha20Poly1305Open(const uint8_t key[CHACHA20_KEY_LENGTH], const uint8_t nonce[CHACHA20_NONCE_LENGTH],
+                          const uint8_t * aad, std::size_t aadLength,
+                          const uint8_t * cipher, std::size_t length,
+                          const uint8_t tag[POLY1305_TAG_LENGTH], uint8_t * out)
+{
+    uint8_t expected[POLY1305_TAG_LENGTH];
+    chacha20Poly1305Tag(key, nonce, aad, aadLength, cipher, length, expected);
+    const auto valid = constantTimeEqual(expected, tag, POLY1305_TAG_LENGTH);
+    secureZero(expected, sizeof(expected));
+    if (!valid)
+    {
+        secureZero(out, length);
+        return false;
+    }
+    chacha20Xor(key, 1, nonce, cipher, out, length);
+    return true;
+}
+
+std::size_t sealSecret(const uint8_t key[CHACHA20_KEY_LENGTH], const uint8_t nonce[CHACHA20_NONCE_LENGTH],
+                       std::string_view aad, const uint8_t * plain, std::size_t length, uint8_t * out)
+{
+    for (std::size_t i = 0; i < CHACHA20_NONCE_LENGTH; i++)
+    {
+        out[i] = nonce[i];
+    }
+    chacha20Poly1305Seal(key, nonce, reinterpret_cast<const uint8_t *>(aad.data()), aad.size(),
+                         plain, length, out + CHACHA20_NONCE_LENGTH, out + CHACHA20_NONCE_LENGTH + length);
+    return length + SEALED_SECRET_OVERHEAD;
+}
+
+bool openSecret(const uint8_t key[CHACHA20_KEY_LENGTH], std::string_view sealed, std::string_view aad,
+                uint8_t * out, std::size_t & length)
+{
+    if (sealed.size() < SEALED_SECRET_OVERHEAD)
+    {
+        return false;
+    }
+    const auto bytes = reinterpret_cast<const uint8_t *>(sealed.data());
+    length = sealed.size() - SEALED_SECRET_OVERHEAD;
+    return chacha20Poly1305Open(key, bytes, reinterpret_cast<const uint8_t *>(aad.data()), aad.size(),
+                                bytes + CHACHA20_NONCE_LENGTH, length, bytes + CHACHA20_NONCE_LENGTH + length, out);
+}
+
+bool openLegacySecret(std::string_view encrypted, const uint8_t * key, std::size_t keyLength,
+                      uint8_t * out, std::size_t & length)
+{
+    const auto size = encrypted.size();
+    if (size <= 4 || keyLength == 0)
+    {
+        return false;
+    }
+    auto plain = [&encrypted, key, keyLength](std::size_t i){
+        return (uint8_t)((uint8_t)encrypted[i] ^ key[i % keyLength]);
+    };
+    if (plain(0) != 0xFF || plain(1) != 0xFA || plain(size - 2) != 0xFA || plain(size - 1) != 0xFF)
+    {
+        return false;
+    }
+    length = size - 4;
+    for (std::size_t i = 0; i < length; i++)
+    {
+        out[i] = plain(i + 2);
+    }
+    return true;
+}
+
+bool constantTimeEqual(const uint8_t * a, const uint8_t * b, std::size_t length)
+{
+    uint8_t difference = 0;
+    for (std::size_t i = 0; i < length; i++)
+    {
+        difference |= a[i] ^ b[i];
+    }
+    return difference == 0;
+}
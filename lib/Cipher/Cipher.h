@@ -0,0 +1,102 @@
+// (c) 2024 Takhir Latypov <cregennandev@gmail.com>
+// MIT License
+
+#ifndef KEECHAIN_CIPHER_H_GUARD
+#define KEECHAIN_CIPHER_H_GUARD
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+static constexpr std::size_t CHACHA20_KEY_LENGTH = 32;
+static constexpr std::size_t CHACHA20_NONCE_LENGTH = 12;
+static constexpr std::size_t CHACHA20_BLOCK_LENGTH = 64;
+static constexpr std::size_t POLY1305_KEY_LENGTH = 32;
+static constexpr std::size_t POLY1305_TAG_LENGTH = 16;
+
+// Запечатанный секрет: нонс, шифртекст той же длины, что и секрет, тег
+static constexpr std::size_t SEALED_SECRET_OVERHEAD = CHACHA20_NONCE_LENGTH + POLY1305_TAG_LENGTH;
+
+/*
+ * Блок ChaCha20 по RFC 8439
+ * Состояние и раунды считаются 32-битными словами, байты нужны только на входе и выходе
+ */
+void chacha20Block(const uint8_t key[CHACHA20_KEY_LENGTH], uint32_t counter,
+                   const uint8_t nonce[CHACHA20_NONCE_LENGTH], uint8_t out[CHACHA20_BLOCK_LENGTH]);
+
+/*
+ * Шифрование и расшифровка ChaCha20, начиная с блока counter. in и out могут совпадать
+ * Гамма накладывается словами, побайтно обрабатывается только хвост короче слова
+ */
+void chacha20Xor(const uint8_t key[CHACHA20_KEY_LENGTH], uint32_t counter, const uint8_t nonce[CHACHA20_NONCE_LENGTH],
+                 const uint8_t * in, uint8_t * out, std::size_t length);
+
+/*
+ * Poly1305 по RFC 8439, 32-битная реализация на пяти 26-битных частях
+ * Ключ одноразовый: для каждого сообщения свой
+ */
+class Poly1305Context
+{
+    public:
+        void init(const uint8_t key[POLY1305_KEY_LENGTH]);
+        void update(const uint8_t * data, std::size_t length);
+
+        // Дополнить нулями до границы 16 байт, как данные AEAD
+        void pad();
+
+        // Тег в out, состояние затирается
+        void finish(uint8_t out[POLY1305_TAG_LENGTH]);
+    private:
+        void blocks(const uint8_t * data, std::size_t length, uint32_t hibit);
+
+        uint32_t r[5]{};
+        uint32_t h[5]{};
+        uint32_t s[4]{};
+        uint8_t buffer[16]{};
+        std::size_t buffered = 0;
+};
+
+/*
+ * AEAD ChaCha20-Poly1305 по RFC 8439: шифртекст в out той же длины, что и plain, тег в tag
+ * Нонс не должен повторяться с тем же ключом
+ */
+void chacha20Poly1305Seal(const uint8_t key[CHACHA20_KEY_LENGTH], const uint8_t nonce[CHACHA20_NONCE_LENGTH],
+                          const uint8_t * aad, std::size_t aadLength,
+                          const uint8_t * plain, std::size_t length,
+                          uint8_t * out, uint8_t tag[POLY1305_TAG_LENGTH]);
+
+/*
+ * Проверка тега и расшифровка. Тег сравнивается за постоянное время,
+ * при несовпадении out затирается и возвращается false
+ */
+bool chacha20Poly1305Open(const uint8_t key[CHACHA20_KEY_LENGTH], const uint8_t nonce[CHACHA20_NONCE_LENGTH],
+                          const uint8_t * aad, std::size_t aadLength,
+                          const uint8_t * cipher, std::size_t length,
+                          const uint8_t tag[POLY1305_TAG_LENGTH], uint8_t * out);
+
+/*
+ * Запечатать секрет записи: нонс, шифртекст и тег подряд в out, возвращает длину (length + SEALED_SECRET_OVERHEAD)
+ * aad - данные, которые не шифруются, но привязываются к тегу, например имя записи
+ */
+std::size_t sealSecret(const uint8_t key[CHACHA20_KEY_LENGTH], const uint8_t nonce[CHACHA20_NONCE_LENGTH],
+                       std::string_view aad, const uint8_t * plain, std::size_t length, uint8_t * out);
+
+/*
+ * Открыть секрет, запечатанный sealSecret(). Секрет длиной sealed.size() - SEALED_SECRET_OVERHEAD в out
+ * false, если данные короче заголовка или тег не сошелся: неверный ключ, чужое имя или порча данных
+ */
+bool openSecret(const uint8_t key[CHACHA20_KEY_LENGTH], std::string_view sealed, std::string_view aad,
+                uint8_t * out, std::size_t & length);
+
+/*
+ * Секрет первой версии: маркеры 0xFF 0xFA, секрет, 0xFA 0xFF, все XOR с повторяемым ключом (хешем пароля)
+ * Только для чтения старых записей: секрет без маркеров в out. false, если маркеры не сошлись
+ */
+bool openLegacySecret(std::string_view encrypted, const uint8_t * key, std::size_t keyLength,
+                      uint8_t * out, std::size_t & length);
+
+// Сравнение за время, не зависящее от положения первого различия
+bool constantTimeEqual(const uint8_t * a, const uint8_t * b, std::size_t length);
+
+#endif // Guard
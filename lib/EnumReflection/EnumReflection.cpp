@@ -100,7 +100,7 @@ int EnumReflector::Count() const
     return (int)_data->values.size();
 }
 
-EnumReflector::Enumerator EnumReflector::Find(const std::string& name) const
+EnumReflector::Enumerator EnumReflector::Find(std::string_view name) const
 {
     for (int i = 0; i < (int)_data->values.size(); ++i)
     {
@@ -6,7 +6,11 @@
 #define GUARD_EnumReflection_H_INCLUDED
 #pragma once
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
 
 //-------------------------------- Public Interface --------------------------------
 
@@ -18,6 +22,18 @@
 #define Z_ENUM_NS( enumName, ... )\
                               Z_ENUM_DETAIL_MAKE( namespace, enumName, __VA_ARGS__ )
 
+// Returns enumerator count of an enum declared with Z_ENUM or Z_ENUM_NS, usable at compile time
+template<typename EnumType>
+constexpr std::size_t EnumCount();
+
+// Returns enumerator name as a view into a constexpr table, empty view for an unknown value
+template<typename EnumType>
+constexpr std::string_view NameOf(EnumType value);
+
+// Looks up an enumerator by name with a compile-time perfect hash, false if not found
+template<typename EnumType>
+constexpr bool EnumFromName(std::string_view name, EnumType& out);
+
 // Provides access to information about an enum declared with Z_ENUM or Z_ENUM_NS
 class EnumReflector
 {
@@ -67,7 +83,7 @@ public:
     int Count() const;
 
     // Returns an Enumerator with specified name or invalid Enumerator if not found
-    Enumerator Find(const std::string& name) const;
+    Enumerator Find(std::string_view name) const;
 
     // Returns an Enumerator with specified value or invalid Enumerator if not found
     Enumerator Find(int value) const;
@@ -104,12 +120,20 @@ private:
     extern "C"{/* Protection from being used inside a class body */} \
     inline
 #define Z_ENUM_DETAIL_SPEC_class
+#define Z_ENUM_DETAIL_CONSTEXPR_SPEC_namespace \
+    extern "C"{/* Protection from being used inside a class body */} \
+    constexpr
+#define Z_ENUM_DETAIL_CONSTEXPR_SPEC_class friend constexpr
 #define Z_ENUM_DETAIL_STR(x) #x
 #define Z_ENUM_DETAIL_MAKE(spec, enumName, ...) \
     enum class enumName : uint8_t                                                                           \
     {                                                                                           \
         __VA_ARGS__                                                                             \
     };                                                                                          \
+    Z_ENUM_DETAIL_CONSTEXPR_SPEC_##spec std::string_view _detail_body_(enumName)                \
+    {                                                                                           \
+        return Z_ENUM_DETAIL_STR((__VA_ARGS__));                                                \
+    }                                                                                           \
     Z_ENUM_DETAIL_SPEC_##spec const ::EnumReflector& _detail_reflector_(enumName)               \
     {                                                                                           \
         static const ::EnumReflector _reflector( []{                                            \
@@ -133,6 +157,158 @@ private:
         return _reflector;                                                                      \
     }
 
+namespace EnumReflectionDetail
+{
+    constexpr bool IsIdentChar(char c)
+    {
+        return (c >= 'A' && c <= 'Z') ||
+               (c >= 'a' && c <= 'z') ||
+               (c >= '0' && c <= '9') ||
+               (c == '_');
+    }
+
+    // Counts top-level comma separated enumerators in the stringified "(A, B = 1, C)" body
+    constexpr std::size_t CountEnumerators(std::string_view body)
+    {
+        std::size_t count = 1;
+        int level = 0;
+        for (std::size_t i = 1; i + 1 < body.size(); ++i)
+        {
+            if (body[i] == '(')
+                ++level;
+            else if (body[i] == ')')
+                --level;
+            else if (body[i] == ',' && level == 0)
+                ++count;
+        }
+        return count;
+    }
+
+    // Checks that no enumerator has an explicit value, so that values are 0..Count-1
+    constexpr bool IsDense(std::string_view body)
+    {
+        return body.find('=') == std::string_view::npos;
+    }
+
+    // Same parsing as the runtime EnumReflector constructor, but at compile time
+    template<std::size_t Count>
+    constexpr std::array<std::string_view, Count> ParseNames(std::string_view body)
+    {
+        std::array<std::string_view, Count> names{};
+        std::size_t index = 0;
+        std::size_t i = 1;
+        while (index < Count)
+        {
+            while (!IsIdentChar(body[i]))
+                ++i;
+            const auto start = i;
+            while (IsIdentChar(body[i]))
+                ++i;
+            names[index++] = body.substr(start, i - start);
+            int level = 0;
+            while (index < Count && (level != 0 || body[i] != ','))
+            {
+                if (body[i] == '(')
+                    ++level;
+                else if (body[i] == ')')
+                    --level;
+                ++i;
+            }
+        }
+        return names;
+    }
+
+    // Seeded FNV-1a
+    constexpr std::uint32_t Hash(std::string_view name, std::uint32_t seed)
+    {
+        std::uint32_t hash = 2166136261u ^ seed;
+        for (auto c : name)
+        {
+            hash ^= static_cast<std::uint8_t>(c);
+            hash *= 16777619u;
+        }
+        return hash ^ (hash >> 15);
+    }
+
+    // Power of two not less than twice the enumerator count
+    constexpr std::size_t HashTableSize(std::size_t count)
+    {
+        std::size_t size = 1;
+        while (size < count * 2)
+            size <<= 1;
+        return size;
+    }
+
+    // Collision-free hash table: slot holds enumerator index + 1, 0 is an empty slot
+    template<std::size_t Count>
+    struct PerfectHash
+    {
+        std::uint32_t seed = 0;
+        std::array<std::uint8_t, HashTableSize(Count)> slots{};
+    };
+
+    // Tries seeds until every name lands in its own slot
+    template<std::size_t Count>
+    constexpr PerfectHash<Count> BuildPerfectHash(const std::array<std::string_view, Count>& names)
+    {
+        static_assert(Count < 255, "Enum is too large for the perfect hash table");
+        PerfectHash<Count> table{};
+        constexpr auto mask = HashTableSize(Count) - 1;
+        for (std::uint32_t seed = 0;; ++seed)
+        {
+            table.seed = seed;
+            table.slots = {};
+            bool collision = false;
+            for (std::size_t i = 0; i < Count && !collision; ++i)
+            {
+                auto& slot = table.slots[Hash(names[i], seed) & mask];
+                collision = slot != 0;
+                slot = static_cast<std::uint8_t>(i + 1);
+            }
+            if (!collision)
+                return table;
+        }
+    }
+
+    // Compile-time tables of an enum, placed in read-only memory
+    template<typename EnumType>
+    struct Tables
+    {
+        static constexpr std::string_view body = _detail_body_(EnumType());
+        static_assert(IsDense(body), "Constexpr reflection requires enumerators without explicit values");
+
+        static constexpr std::size_t count = CountEnumerators(body);
+        static constexpr std::array<std::string_view, count> names = ParseNames<count>(body);
+        static constexpr PerfectHash<count> hash = BuildPerfectHash<count>(names);
+    };
+}
+
+template<typename EnumType>
+constexpr std::size_t EnumCount()
+{
+    return EnumReflectionDetail::CountEnumerators(_detail_body_(EnumType()));
+}
+
+template<typename EnumType>
+constexpr std::string_view NameOf(EnumType value)
+{
+    using Tables = EnumReflectionDetail::Tables<EnumType>;
+    const auto index = static_cast<std::size_t>(value);
+    return index < Tables::count ? Tables::names[index] : std::string_view();
+}
+
+template<typename EnumType>
+constexpr bool EnumFromName(std::string_view name, EnumType& out)
+{
+    using Tables = EnumReflectionDetail::Tables<EnumType>;
+    constexpr auto mask = EnumReflectionDetail::HashTableSize(Tables::count) - 1;
+    const auto slot = Tables::hash.slots[EnumReflectionDetail::Hash(name, Tables::hash.seed) & mask];
+    if (slot == 0 || Tables::names[slot - 1] != name)
+        return false;
+    out = static_cast<EnumType>(slot - 1);
+    return true;
+}
+
 // EnumReflector
 
 inline EnumReflector::EnumReflector(EnumReflector&& rhs)
@@ -211,10 +387,4 @@ inline const EnumReflector::Enumerator& EnumReflector::Enumerator::operator*() c
     return *this;
 }
 
-template<typename EnumType>
-inline std::string NameOf(EnumType value){
-    auto& reflector = EnumReflector::For<EnumType>();
-    return reflector[static_cast<uint8_t>(value)].Name();
-}
-
 #endif//GUARD
\ No newline at end of file
@@ -0,0 +1,389 @@
+// (c) 2024 Takhir Latypov <cregennandev@gmail.com>
+// MIT License
+
+#include "Otp.h"
+#include <cstring>
+
+static inline uint32_t rotateLeft(uint32_t value, unsigned bits)
+{
+    return (value << bits) | (value >> (32 - bits));
+}
+
+void Sha1Context::init()
+{
+    state[0] = 0x67452301;
+    state[1] = 0xEFCDAB89;
+    state[2] = 0x98BADCFE;
+    state[3] = 0x10325476;
+    state[4] = 0xC3D2E1F0;
+    blockLength = 0;
+    totalLength = 0;
+}
+
+void Sha1Context::update(const uint8_t * data, std::size_t length)
+{
+    totalLength += length;
+
+    if (blockLength > 0)
+    {
+        auto chunk = SHA1_BLOCK_LENGTH - blockLength;
+        if (chunk > length)
+        {
+            chunk = length;
+        }
+        memcpy(block + blockLength, data, chunk);
+        blockLength += chunk;
+        data += chunk;
+        length -= chunk;
+        if (blockLength < SHA1_BLOCK_LENGTH)
+        {
+            return;
+        }
+        compress(block);
+        blockLength = 0;
+    }
+
+    while (length >= SHA1_BLOCK_LENGTH)
+    {
+        compress(data);
+        data += SHA1_BLOCK_LENGTH;
+        length -= SHA1_BLOCK_LENGTH;
+    }
+
+    memcpy(block, data, length);
+    blockLength = length;
+}
+
+void Sha1Context::finish(uint8_t out[SHA1_HASH_LENGTH])
+{
+    const auto bitLength = totalLength * 8;
+
+    block[blockLength++] = 0x80;
+    if (blockLength > SHA1_BLOCK_LENGTH - 8)
+    {
+        memset(block + blockLength, 0, SHA1_BLOCK_LENGTH - blockLength);
+        compress(block);
+        blockLength = 0;
+    }
+    memset(block + blockLength, 0, SHA1_BLOCK_LENGTH - 8 - blockLength);
+    for (auto i = 0; i < 8; i++)
+    {
+        block[SHA1_BLOCK_LENGTH - 1 - i] = (uint8_t)(bitLength >> (8 * i));
+    }
+    compress(block);
+
+    for (auto i = 0; i < 5; i++)
+    {
+        out[i * 4] = (uint8_t)(state[i] >> 24);
+        out[i * 4 + 1] = (uint8_t)(state[i] >> 16);
+        out[i * 4 + 2] = (uint8_t)(state[i] >> 8);
+        out[i * 4 + 3] = (uint8_t)state[i];
+    }
+}
+
+void Sha1Context::midstate(uint32_t out[5]) const
+{
+    memcpy(out, state, sizeof(state));
+}
+
+void Sha1Context::resume(const uint32_t midstate[5], uint64_t absorbed)
+{
+    memcpy(state, midstate, sizeof(state));
+    blockLength = 0;
+    totalLength = absorbed;
+}
+
+void Sha1Context::compress(const uint8_t * data)
+{
+    // Расписание сообщения в скользящем окне из 16 слов: 64 байта стека вместо 320
+    uint32_t w[16];
+    for (auto i = 0; i < 16; i++)
+    {
+        w[i] = (uint32_t)data[i * 4] << 24 | (uint32_t)data[i * 4 + 1] << 16
+             | (uint32_t)data[i * 4 + 2] << 8 | (uint32_t)data[i * 4 + 3];
+    }
+
+    auto a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+    for (auto i = 0; i < 80; i++)
+    {
+        if (i >= 16)
+        {
+            w[i & 15] = rotateLeft(w[(i + 13) & 15] ^ w[(i + 8) & 15] ^ w[(i + 2) & 15] ^ w[i & 15], 1);
+        }
+
+        uint32_t f, k;
+        if (i < 20)
+        {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        }
+        else if (i < 40)
+        {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        }
+        else if (i < 60)
+        {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        }
+        else
+        {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+
+        const auto temp = rotateLeft(a, 5) + f + e + k + w[i & 15];
+        e = d;
+        d = c;
+        c = rotateLeft(b, 30);
+        b = a;
+        a = temp;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+void hmacSha1Prepare(const uint8_t * key, std::size_t keyLength, HmacSha1Key & out)
+{
+    uint8_t pad[SHA1_BLOCK_LENGTH] = {};
+    Sha1Context sha;
+
+    if (keyLength > SHA1_BLOCK_LENGTH)
+    {
+        sha.init();
+        sha.update(key, keyLength);
+        sha.finish(pad);
+    }
+    else
+    {
+        memcpy(pad, key, keyLength);
+    }
+
+    for (auto & byte : pad)
+    {
+        byte ^= 0x36;
+    }
+    sha.init();
+    sha.update(pad, SHA1_BLOCK_LENGTH);
+    sha.midstate(out.inner);
+
+    for (auto & byte : pad)
+    {
+        byte ^= 0x36 ^ 0x5C;
+    }
+    sha.init();
+    sha.update(pad, SHA1_BLOCK_LENGTH);
+    sha.midstate(out.outer);
+
+    // Пэды и контекст получены из ключа, а локальные буферы перед выходом компилятор вправе не затирать
+    secureZero(pad, sizeof(pad));
+    secureZero(&sha, sizeof(sha));
+}
+
+void hmacSha1(const uint8_t * key, std::size_t keyLength,
+              const uint8_t * message, std::size_t messageLength,
+              uint8_t out[SHA1_HASH_LENGTH])
+{
+    HmacSha1Key prepared;
+    hmacSha1Prepare(key, keyLength, prepared);
+    hmacSha1(prepared, message, messageLength, out);
+    secureZero(&prepared, sizeof(prepared));
+}
+
+void hmacSha1(const HmacSha1Key & key, const uint8_t * message, std::size_t messageLength, uint8_t out[SHA1_HASH_LENGTH])
+{
+    Sha1Context sha;
+    uint8_t innerHash[SHA1_HASH_LENGTH];
+
+    sha.resume(key.inner, SHA1_BLOCK_LENGTH);
+    sha.update(message, messageLength);
+    sha.finish(innerHash);
+
+    sha.resume(key.outer, SHA1_BLOCK_LENGTH);
+    sha.update(innerHash, SHA1_HASH_LENGTH);
+    sha.finish(out);
+
+    secureZero(innerHash, sizeof(innerHash));
+    secureZero(&sha, sizeof(sha));
+}
+
+void Pbkdf2Sha1::begin(const uint8_t * password, std::size_t passwordLength,
+                       const uint8_t * salt, std::size_t saltLength, uint32_t iterations)
+{
+    hmacSha1Prepare(password, passwordLength, key);
+
+    // U1 = HMAC(P, S || INT(1)), соль подается потоком, без копии
+    static const uint8_t blockIndex[4] = {0, 0, 0, 1};
+    Sha1Context sha;
+    uint8_t innerHash[SHA1_HASH_LENGTH];
+    sha.resume(key.inner, SHA1_BLOCK_LENGTH);
+    sha.update(salt, saltLength);
+    sha.update(blockIndex, sizeof(blockIndex));
+    sha.finish(innerHash);
+    sha.resume(key.outer, SHA1_BLOCK_LENGTH);
+    sha.update(innerHash, SHA1_HASH_LENGTH);
+    sha.finish(u);
+    memcpy(t, u, SHA1_HASH_LENGTH);
+    secureZero(innerHash, sizeof(innerHash));
+    secureZero(&sha, sizeof(sha));
+
+    done = iterations > 0 ? 1 : 0;
+    total = iterations > 0 ? iterations : 0;
+}
+
+bool Pbkdf2Sha1::step(uint32_t count)
+{
+    while (count-- > 0 && done < total)
+    {
+        hmacSha1(key, u, SHA1_HASH_LENGTH, u);
+        for (std::size_t i = 0; i < SHA1_HASH_LENGTH; i++)
+        {
+            t[i] ^= u[i];
+        }
+        done++;
+    }
+    return finished();
+}
+
+void Pbkdf2Sha1::finish(uint8_t out[SHA1_HASH_LENGTH])
+{
+    memcpy(out, t, SHA1_HASH_LENGTH);
+    reset();
+}
+
+void Pbkdf2Sha1::reset()
+{
+    secureZero(&key, sizeof(key));
+    secureZero(u, sizeof(u));
+    secureZero(t, sizeof(t));
+    done = total = 0;
+}
+
+uint32_t totpStep(long utc)
+{
+    return (uint32_t)(utc / TOTP_TIME_STEP);
+}
+
+void totpCounter(long utc, uint8_t out[OTP_COUNTER_LENGTH])
+{
+    totpStepCounter(totpStep(utc), out);
+}
+
+void totpStepCounter(uint32_t steps, uint8_t out[OTP_COUNTER_LENGTH])
+{
+    out[0] = out[1] = out[2] = out[3] = 0;
+    out[4] = (uint8_t)(steps >> 24);
+    out[5] = (uint8_t)(steps >> 16);
+    out[6] = (uint8_t)(steps >> 8);
+    out[7] = (uint8_t)steps;
+}
+
+void hotpTruncate(const uint8_t hash[SHA1_HASH_LENGTH], char out[OTP_CODE_MAX_LENGTH + 1], std::size_t digits)
+{
+    static constexpr uint32_t POWERS_OF_TEN[OTP_CODE_MAX_LENGTH + 1] = {
+        1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000
+    };
+    const auto offset = hash[SHA1_HASH_LENGTH - 1] & 0x0F;
+    auto truncated = ((uint32_t)(hash[offset] & 0x7F) << 24)
+                   | ((uint32_t)hash[offset + 1] << 16)
+                   | ((uint32_t)hash[offset + 2] << 8)
+                   | (uint32_t)hash[offset + 3];
+    truncated %= POWERS_OF_TEN[digits];
+
+    for (auto i = (int)digits - 1; i >= 0; i--)
+    {
+        out[i] = (char)('0' + truncated % 10);
+        truncated /= 10;
+    }
+    out[digits] = '\0';
+}
+
+void hotpCode(const uint8_t * key, std::size_t keyLength,
+              const uint8_t counter[OTP_COUNTER_LENGTH], char out[OTP_CODE_MAX_LENGTH + 1], std::size_t digits)
+{
+    uint8_t hash[SHA1_HASH_LENGTH];
+    hmacSha1(key, keyLength, counter, OTP_COUNTER_LENGTH, hash);
+    hotpTruncate(hash, out, digits);
+}
+
+void hotpCode(const HmacSha1Key & key, const uint8_t counter[OTP_COUNTER_LENGTH], char out[OTP_CODE_MAX_LENGTH + 1],
+              std::size_t digits)
+{
+    uint8_t hash[SHA1_HASH_LENGTH];
+    hmacSha1(key, counter, OTP_COUNTER_LENGTH, hash);
+    hotpTruncate(hash, out, digits);
+}
+
+void totpCode(const uint8_t * key, std::size_t keyLength, long utc, char out[OTP_CODE_MAX_LENGTH + 1], std::size_t digits)
+{
+    uint8_t counter[OTP_COUNTER_LENGTH];
+    totpCounter(utc, counter);
+    hotpCode(key, keyLength, counter, out, digits);
+}
+
+void secureZero(void * data, std::size_t length)
+{
+    auto bytes = static_cast<volatile uint8_t *>(data);
+    while (length-- > 0)
+    {
+        *bytes++ = 0;
+    }
+}
+
+std::size_t OtpCache::slotIndex(std::size_t entry, uint32_t step)
+{
+    return ((entry << 1) | (step & 1)) & (OTP_CACHE_SLOTS - 1);
+}
+
+bool OtpCache::find(std::size_t entry, uint32_t step, char out[OTP_CODE_MAX_LENGTH + 1])
+{
+    const auto & slot = slots[slotIndex(entry, step)];
+    if (!slot.valid || slot.entry != entry || slot.step != step)
+    {
+        missCount++;
+        return false;
+    }
+    hitCount++;
+    memcpy(out, slot.code, strlen(slot.code) + 1);
+    return true;
+}
+
+bool OtpCache::contains(std::size_t entry, uint32_t step) const
+{
+    const auto & slot = slots[slotIndex(entry, step)];
+    return slot.valid && slot.entry == entry && slot.step == step;
+}
+
+void OtpCache::store(std::size_t entry, uint32_t step, const char code[OTP_CODE_MAX_LENGTH + 1])
+{
+    auto & slot = slots[slotIndex(entry, step)];
+    secureZero(slot.code, sizeof(slot.code));
+    slot.entry = (uint32_t)entry;
+    slot.step = step;
+    slot.valid = true;
+    for (std::size_t i = 0; i < OTP_CODE_MAX_LENGTH && code[i] != '\0'; i++)
+    {
+        slot.code[i] = code[i];
+    }
+}
+
+void OtpCache::clear()
+{
+    secureZero(slots.data(), sizeof(slots));
+}
+
+unsigned long OtpCache::hits() const
+{
+    return hitCount;
+}
+
+unsigned long OtpCache::misses() const
+{
+    return missCount;
+}
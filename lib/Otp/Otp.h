@@ -0,0 +1,175 @@
+// (c) 2024 Takhir Latypov <cregennandev@gmail.com>
+// MIT License
+
+#ifndef KEECHAIN_OTP_H_GUARD
+#define KEECHAIN_OTP_H_GUARD
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+static constexpr std::size_t SHA1_HASH_LENGTH = 20;
+static constexpr std::size_t SHA1_BLOCK_LENGTH = 64;
+
+// Шаг TOTP в секундах, как в библиотеке TOTP
+static constexpr long TOTP_TIME_STEP = 30;
+
+// Длина счетчика HOTP в байтах
+static constexpr std::size_t OTP_COUNTER_LENGTH = 8;
+
+// Количество цифр кода по умолчанию, библиотека TOTP всегда выдает 6
+static constexpr std::size_t OTP_CODE_LENGTH = 6;
+
+// Наибольшее количество цифр кода, RFC 4226 допускает от 6 до 8
+static constexpr std::size_t OTP_CODE_MAX_LENGTH = 8;
+
+// Количество ячеек кеша кодов, степень двойки
+static constexpr std::size_t OTP_CACHE_SLOTS = 16;
+
+/*
+ * SHA-1 без зависимостей от Arduino
+ * Отдельный класс, а не Sha1 из библиотеки TOTP: тот хранит состояние в одном глобальном объекте
+ */
+class Sha1Context
+{
+    public:
+        void init();
+        void update(const uint8_t * data, std::size_t length);
+        void finish(uint8_t out[SHA1_HASH_LENGTH]);
+
+        // Состояние после целого числа блоков, для сохранения промежуточного хеша
+        void midstate(uint32_t out[5]) const;
+
+        // Продолжить хеширование с сохраненного состояния после absorbed байт (кратно блоку)
+        void resume(const uint32_t midstate[5], uint64_t absorbed);
+    private:
+        void compress(const uint8_t * block);
+
+        uint32_t state[5]{};
+        uint8_t block[SHA1_BLOCK_LENGTH]{};
+        std::size_t blockLength = 0;
+        uint64_t totalLength = 0;
+};
+
+/*
+ * Ключ HMAC-SHA1, подготовленный заранее: состояния SHA-1 после блоков K^ipad и K^opad
+ * Код по подготовленному ключу стоит два сжатия SHA-1 вместо четырех, а сам секрет хранить не нужно
+ */
+struct HmacSha1Key
+{
+    uint32_t inner[5];
+    uint32_t outer[5];
+};
+
+void hmacSha1Prepare(const uint8_t * key, std::size_t keyLength, HmacSha1Key & out);
+
+// HMAC-SHA1 по RFC 2104
+void hmacSha1(const uint8_t * key, std::size_t keyLength,
+              const uint8_t * message, std::size_t messageLength,
+              uint8_t out[SHA1_HASH_LENGTH]);
+
+void hmacSha1(const HmacSha1Key & key, const uint8_t * message, std::size_t messageLength, uint8_t out[SHA1_HASH_LENGTH]);
+
+/*
+ * PBKDF2-HMAC-SHA1 (RFC 8018) с продолжением: первый блок ключа (20 байт) считается по кускам,
+ * между кусками можно обрабатывать другие запросы. Итерация стоит два сжатия SHA-1
+ */
+class Pbkdf2Sha1
+{
+    public:
+        // Начать вывод. Пароль превращается в подготовленный ключ HMAC и дальше не нужен
+        void begin(const uint8_t * password, std::size_t passwordLength,
+                   const uint8_t * salt, std::size_t saltLength, uint32_t iterations);
+
+        // Выполнить не больше count итераций. true, если вывод закончен
+        bool step(uint32_t count);
+
+        bool finished() const { return done == total; }
+        uint32_t completed() const { return done; }
+        uint32_t iterations() const { return total; }
+
+        // Ключ в out после завершения, состояние затирается
+        void finish(uint8_t out[SHA1_HASH_LENGTH]);
+
+        // Прервать вывод и затереть состояние
+        void reset();
+    private:
+        HmacSha1Key key{};
+        uint8_t u[SHA1_HASH_LENGTH]{};
+        uint8_t t[SHA1_HASH_LENGTH]{};
+        uint32_t done = 0;
+        uint32_t total = 0;
+};
+
+// Номер шага TOTP для момента utc, код меняется только вместе с ним
+uint32_t totpStep(long utc);
+
+/*
+ * Счетчик TOTP для момента utc в формате библиотеки TOTP:
+ * 8 байт big-endian, старшие 4 байта нулевые
+ */
+void totpCounter(long utc, uint8_t out[OTP_COUNTER_LENGTH]);
+
+// Счетчик для уже известного шага, например следующего
+void totpStepCounter(uint32_t step, uint8_t out[OTP_COUNTER_LENGTH]);
+
+// Динамическое усечение HOTP до digits цифр (от 1 до OTP_CODE_MAX_LENGTH), out завершается нулем
+void hotpTruncate(const uint8_t hash[SHA1_HASH_LENGTH], char out[OTP_CODE_MAX_LENGTH + 1], std::size_t digits = OTP_CODE_LENGTH);
+
+// Код для уже подготовленного счетчика, чтобы не собирать счетчик заново для каждого секрета
+void hotpCode(const uint8_t * key, std::size_t keyLength,
+              const uint8_t counter[OTP_COUNTER_LENGTH], char out[OTP_CODE_MAX_LENGTH + 1], std::size_t digits = OTP_CODE_LENGTH);
+
+void hotpCode(const HmacSha1Key & key, const uint8_t counter[OTP_COUNTER_LENGTH], char out[OTP_CODE_MAX_LENGTH + 1],
+              std::size_t digits = OTP_CODE_LENGTH);
+
+// Код TOTP, с 6 цифрами совпадает с TOTP(key, keyLength).getCode(utc)
+void totpCode(const uint8_t * key, std::size_t keyLength, long utc, char out[OTP_CODE_MAX_LENGTH + 1],
+              std::size_t digits = OTP_CODE_LENGTH);
+
+// Затирание секретных данных, которое компилятор не уберет как мертвую запись
+void secureZero(void * data, std::size_t length);
+
+/*
+ * Кеш готовых кодов по ключу (запись, шаг TOTP)
+ * Прямое отображение: ячейка определяется записью и четностью шага, поиск и вставка O(1).
+ * Коды текущего и следующего шага одной записи лежат в разных ячейках и не вытесняют друг друга.
+ * Вытесненный или сброшенный код затирается
+ */
+class OtpCache
+{
+    static_assert((OTP_CACHE_SLOTS & (OTP_CACHE_SLOTS - 1)) == 0, "OTP_CACHE_SLOTS must be a power of two");
+
+    public:
+        // true и код в out, если код записи entry для шага step уже есть
+        bool find(std::size_t entry, uint32_t step, char out[OTP_CODE_MAX_LENGTH + 1]);
+
+        // Есть ли код, без учета в счетчиках попаданий. Для фонового заполнения
+        bool contains(std::size_t entry, uint32_t step) const;
+
+        // code - строка с завершающим нулем, не длиннее OTP_CODE_MAX_LENGTH цифр
+        void store(std::size_t entry, uint32_t step, const char code[OTP_CODE_MAX_LENGTH + 1]);
+
+        // Сбросить все коды, счетчики попаданий сохраняются
+        void clear();
+
+        unsigned long hits() const;
+        unsigned long misses() const;
+    private:
+        static std::size_t slotIndex(std::size_t entry, uint32_t step);
+
+        struct Slot
+        {
+            uint32_t step;
+            uint32_t entry;
+            bool valid;
+            char code[OTP_CODE_MAX_LENGTH + 1];
+        };
+
+        std::array<Slot, OTP_CACHE_SLOTS> slots{};
+        unsigned long hitCount = 0;
+        unsigned long missCount = 0;
+};
+
+#endif // Guard
@@ -0,0 +1,626 @@
+// (c) 2024 Takhir Latypov <cregennandev@gmail.com>
+// MIT License
+
+#include "Packet.h"
+#include <climits>
+#include <cstring>
+
+void Packet::popFront()
+{
+    if (!empty())
+    {
+        first++;
+    }
+}
+
+bool Packet::push(std::string_view part)
+{
+    if (count >= PACKET_MAX_PARTS)
+    {
+        return false;
+    }
+    numeric[count] = false;
+    parts[count++] = part;
+    return true;
+}
+
+bool Packet::pushInteger(long value)
+{
+    if (count >= PACKET_MAX_PARTS)
+    {
+        return false;
+    }
+    numeric[count] = true;
+    values[count] = value;
+    parts[count++] = std::string_view();
+    return true;
+}
+
+bool Packet::integer(std::size_t index, long & out) const
+{
+    if (index >= size())
+    {
+        return false;
+    }
+    if (numeric[first + index])
+    {
+        out = values[first + index];
+        return true;
+    }
+    return parseInteger((*this)[index], out);
+}
+
+void Packet::clear()
+{
+    first = 0;
+    count = 0;
+}
+
+PacketAssembler::PacketAssembler(std::string_view magic) : magic(magic)
+{
+}
+
+PACKET_FEED_RESULT PacketAssembler::feed(uint8_t value)
+{
+    if (state == State::TEXT)
+    {
+        if (value == '\n')
+        {
+            state = State::HUNT;
+            return PACKET_FEED_RESULT::FRAME;
+        }
+        if (length == PACKET_MAX_LENGTH)
+        {
+            // Остаток строки принадлежит тому же кадру: ошибка одна на кадр, а не еще и GARBAGE на его хвост
+            state = State::DISCARD;
+            length = 0;
+            return PACKET_FEED_RESULT::TOO_LONG;
+        }
+        buffer[length++] = (char)value;
+        return PACKET_FEED_RESULT::PENDING;
+    }
+
+    if (state == State::DISCARD)
+    {
+        if (value == '\n')
+        {
+            state = State::HUNT;
+        }
+        return PACKET_FEED_RESULT::PENDING;
+    }
+
+    if (state != State::HUNT)
+    {
+        return feedBinary(value);
+    }
+
+    if (value == (uint8_t)magic[matched])
+    {
+        if (++matched == magic.size())
+        {
+            magic.copy(buffer, magic.size());
+            length = magic.size();
+            matched = 0;
+            garbage = 0;
+            state = State::TEXT;
+        }
+        return PACKET_FEED_RESULT::PENDING;
+    }
+
+    garbage += matched;
+    matched = 0;
+
+    if (binaryEnabled && (value == PACKET_BINARY_START || value == PACKET_BINARY_TAGGED_START))
+    {
+        garbage = 0;
+        crc = 0xFFFF;
+        binaryRequestId = {value == PACKET_BINARY_TAGGED_START, 0};
+        lengthShift = 0;
+        state = binaryRequestId.present ? State::BINARY_ID : State::BINARY_OPCODE;
+        return PACKET_FEED_RESULT::PENDING;
+    }
+
+    if (value == '\n')
+    {
+        if (garbage == 0)
+        {
+            return PACKET_FEED_RESULT::PENDING;
+        }
+        garbage = 0;
+        return PACKET_FEED_RESULT::GARBAGE;
+    }
+
+    if (value == (uint8_t)magic[0])
+    {
+        matched = 1;
+    }
+    else
+    {
+        garbage++;
+    }
+    return PACKET_FEED_RESULT::PENDING;
+}
+
+PACKET_FEED_RESULT PacketAssembler::feedBinary(uint8_t value)
+{
+    if (state != State::BINARY_CRC_HIGH && state != State::BINARY_CRC_LOW)
+    {
+        crc = packetCrc16(&value, 1, crc);
+    }
+
+    switch (state)
+    {
+        case State::BINARY_ID:
+            // Идентификатор длиннее 32 бит не может прийти от корректного хоста
+            if (lengthShift == 28 && (value & 0xF0))
+            {
+                state = State::HUNT;
+                return PACKET_FEED_RESULT::CORRUPT;
+            }
+            binaryRequestId.value |= (uint32_t)(value & 0x7F) << lengthShift;
+            lengthShift += 7;
+            if (!(value & 0x80))
+            {
+                state = State::BINARY_OPCODE;
+            }
+            break;
+        case State::BINARY_OPCODE:
+            binaryOpcode = value;
+            expected = 0;
+            lengthShift = 0;
+            state = State::BINARY_LENGTH;
+            break;
+        case State::BINARY_LENGTH:
+            expected |= (std::size_t)(value & 0x7F) << lengthShift;
+            lengthShift += 7;
+            if (expected > PACKET_MAX_LENGTH || (value & 0x80 && lengthShift >= 21))
+            {
+                state = State::HUNT;
+                return PACKET_FEED_RESULT::TOO_LONG;
+            }
+            if (!(value & 0x80))
+            {
+                length = 0;
+                state = expected == 0 ? State::BINARY_CRC_HIGH : State::BINARY_PAYLOAD;
+            }
+            break;
+        case State::BINARY_PAYLOAD:
+            buffer[length++] = (char)value;
+            if (length == expected)
+            {
+                state = State::BINARY_CRC_HIGH;
+            }
+            break;
+        case State::BINARY_CRC_HIGH:
+            receivedCrc = (uint16_t)(value << 8);
+            state = State::BINARY_CRC_LOW;
+            break;
+        case State::BINARY_CRC_LOW:
+            receivedCrc |= value;
+            state = State::HUNT;
+            if (receivedCrc != crc)
+            {
+                length = 0;
+                return PACKET_FEED_RESULT::CORRUPT;
+            }
+            return PACKET_FEED_RESULT::BINARY_FRAME;
+        default:
+            break;
+    }
+    return PACKET_FEED_RESULT::PENDING;
+}
+
+std::string_view PacketAssembler::frame() const
+{
+    return {buffer, length};
+}
+
+uint8_t PacketAssembler::opcode() const
+{
+    return binaryOpcode;
+}
+
+const PacketRequestId & PacketAssembler::requestId() const
+{
+    return binaryRequestId;
+}
+
+bool PacketAssembler::inFrame() const
+{
+    return (state != State::HUNT && state != State::DISCARD) || matched > 0;
+}
+
+void PacketAssembler::setBinaryEnabled(bool enabled)
+{
+    binaryEnabled = enabled;
+}
+
+void PacketAssembler::reset()
+{
+    length = 0;
+    matched = 0;
+    garbage = 0;
+    state = State::HUNT;
+}
+
+PacketWriter::PacketWriter(std::string_view magic, std::string_view delimiter, PacketSink sink)
+    : magic(magic), delimiter(delimiter), sink(sink)
+{
+}
+
+PacketWriter & PacketWriter::begin(const PacketRequestId & requestId)
+{
+    length = 0;
+    binary = false;
+    overflow = false;
+    put(magic);
+    if (requestId.present)
+    {
+        char digits[21];
+        digits[0] = PACKET_REQUEST_ID_SEPARATOR;
+        const auto size = formatDecimal(requestId.value, digits + sizeof(digits));
+        memmove(digits + 1, digits + sizeof(digits) - size, size);
+        put(std::string_view(digits, size + 1));
+    }
+    return *this;
+}
+
+PacketWriter & PacketWriter::beginBinary(uint8_t opcode, const PacketRequestId & requestId)
+{
+    // Длина аргументов станет известна только в finish(), заголовок дописывается перед ними
+    length = PACKET_BINARY_HEADER_MAX;
+    binary = true;
+    overflow = false;
+    binaryOpcode = opcode;
+    binaryRequestId = requestId;
+    binaryArguments = 0;
+    return *this;
+}
+
+PacketWriter & PacketWriter::append(std::string_view part)
+{
+    if (binary)
+    {
+        uint8_t header[10];
+        reserveArgument(encodeVarint((uint64_t)part.size() << 1, header) + part.size());
+        putVarint((uint64_t)part.size() << 1);
+    }
+    else
+    {
+        put(delimiter);
+    }
+    put(part);
+    return *this;
+}
+
+PacketWriter & PacketWriter::appendInteger(bool negative, unsigned long long value)
+{
+    if (binary)
+    {
+        const uint64_t zigzag = negative ? ((value - 1) << 1) | 1 : value << 1;
+        uint8_t bytes[10];
+        const auto size = encodeVarint((zigzag << 1) | 1, bytes);
+        reserveArgument(size);
+        put(std::string_view(reinterpret_cast<const char *>(bytes), size));
+        return *this;
+    }
+
+    char digits[21];
+    auto position = sizeof(digits) - formatDecimal(value, digits + sizeof(digits));
+
+    if (negative)
+    {
+        digits[--position] = '-';
+    }
+
+    return append(std::string_view(digits + position, sizeof(digits) - position));
+}
+
+std::size_t PacketWriter::formatDecimal(unsigned long long value, char * end)
+{
+    auto position = end;
+    while (value > UINT32_MAX)
+    {
+        *--position = (char)('0' + value % 10);
+        value /= 10;
+    }
+
+    // Деление 32-битного числа на Cortex-M0+ заметно дешевле 64-битного
+    auto small = (uint32_t)value;
+    do
+    {
+        *--position = (char)('0' + small % 10);
+        small /= 10;
+    } while (small != 0);
+
+    return (std::size_t)(end - position);
+}
+
+bool PacketWriter::finish()
+{
+    if (!binary)
+    {
+        put("\n");
+        flush();
+        return true;
+    }
+
+    if (overflow)
+    {
+        length = 0;
+        return false;
+    }
+
+    sendBinary(binaryOpcode);
+    return true;
+}
+
+void PacketWriter::reserveArgument(std::size_t size)
+{
+    // Пустой кадр не уходит: аргумент больше буфера - переполнение, его отметит put()
+    const auto fits = size <= PACKET_TX_BUFFER_SIZE - 2 - length && binaryArguments < PACKET_MAX_PARTS;
+    if (!overflow && !fits && binaryArguments > 0)
+    {
+        sendBinary(binaryOpcode | PACKET_BINARY_CONTINUED);
+        length = PACKET_BINARY_HEADER_MAX;
+        binaryArguments = 0;
+    }
+    binaryArguments++;
+}
+
+void PacketWriter::sendBinary(uint8_t opcode)
+{
+    uint8_t header[PACKET_BINARY_HEADER_MAX];
+    std::size_t headerLength = 0;
+    header[headerLength++] = binaryRequestId.present ? PACKET_BINARY_TAGGED_START : PACKET_BINARY_START;
+    if (binaryRequestId.present)
+    {
+        headerLength += encodeVarint(binaryRequestId.value, header + headerLength);
+    }
+    header[headerLength++] = opcode;
+    headerLength += encodeVarint(length - PACKET_BINARY_HEADER_MAX, header + headerLength);
+    const auto start = PACKET_BINARY_HEADER_MAX - headerLength;
+    memcpy(buffer + start, header, headerLength);
+
+    const auto crc = packetCrc16(reinterpret_cast<const uint8_t *>(buffer + start + 1), length - start - 1);
+    buffer[length++] = (char)(crc >> 8);
+    buffer[length++] = (char)(crc & 0xFF);
+
+    sink(buffer + start, length - start);
+    sinkWrites++;
+    length = 0;
+}
+
+std::size_t PacketWriter::writes() const
+{
+    return sinkWrites;
+}
+
+void PacketWriter::put(std::string_view bytes)
+{
+    if (binary)
+    {
+        // Кадр нельзя отправить по частям: длина идет в заголовке. Оставляем место под CRC, продолжения режет reserveArgument()
+        if (overflow || bytes.size() > PACKET_TX_BUFFER_SIZE - 2 - length)
+        {
+            overflow = true;
+            return;
+        }
+        memcpy(buffer + length, bytes.data(), bytes.size());
+        length += bytes.size();
+        return;
+    }
+
+    while (!bytes.empty())
+    {
+        if (length == PACKET_TX_BUFFER_SIZE)
+        {
+            flush();
+        }
+        const auto room = PACKET_TX_BUFFER_SIZE - length;
+        const auto chunk = bytes.size() < room ? bytes.size() : room;
+        memcpy(buffer + length, bytes.data(), chunk);
+        length += chunk;
+        bytes.remove_prefix(chunk);
+    }
+}
+
+void PacketWriter::putVarint(uint64_t value)
+{
+    uint8_t bytes[10];
+    const auto size = encodeVarint(value, bytes);
+    put(std::string_view(reinterpret_cast<const char *>(bytes), size));
+}
+
+void PacketWriter::flush()
+{
+    if (length == 0)
+    {
+        return;
+    }
+    sink(buffer, length);
+    sinkWrites++;
+    length = 0;
+}
+
+bool splitPacket(std::string_view line, std::string_view delimiter, Packet & out)
+{
+    out.clear();
+
+    std::string_view::size_type prev_pos = 0, pos = 0;
+
+    while((pos = line.find(delimiter, pos)) != std::string_view::npos)
+    {
+        if (!out.push(line.substr(prev_pos, pos - prev_pos)))
+        {
+            return false;
+        }
+
+        pos += delimiter.size();
+
+        prev_pos = pos;
+    }
+
+    return out.push(line.substr(prev_pos));
+}
+
+bool parsePacketHead(std::string_view head, std::string_view magic, PacketRequestId & requestId)
+{
+    requestId = {};
+    if (head.substr(0, magic.size()) != magic)
+    {
+        return false;
+    }
+    head.remove_prefix(magic.size());
+    if (head.empty())
+    {
+        return true;
+    }
+    if (head.front() != PACKET_REQUEST_ID_SEPARATOR)
+    {
+        return false;
+    }
+    head.remove_prefix(1);
+
+    if (head.empty() || head.size() > 10)
+    {
+        return false;
+    }
+
+    uint64_t value = 0;
+    for (auto c : head)
+    {
+        if (c < '0' || c > '9')
+        {
+            return false;
+        }
+        value = value * 10 + (uint64_t)(c - '0');
+    }
+    if (value > UINT32_MAX)
+    {
+        return false;
+    }
+    requestId = {true, (uint32_t)value};
+    return true;
+}
+
+bool decodeBinaryPacket(std::string_view payload, Packet & out)
+{
+    out.clear();
+
+    while (!payload.empty())
+    {
+        uint64_t header;
+        if (!decodeVarint(payload, header))
+        {
+            return false;
+        }
+
+        if (header & 1)
+        {
+            const auto zigzag = header >> 1;
+            const auto magnitude = zigzag >> 1;
+            if (magnitude > (uint64_t)LONG_MAX)
+            {
+                return false;
+            }
+            const auto value = (zigzag & 1) ? -(long)magnitude - 1 : (long)magnitude;
+            if (!out.pushInteger(value))
+            {
+                return false;
+            }
+            continue;
+        }
+
+        const auto size = header >> 1;
+        if (size > payload.size() || !out.push(payload.substr(0, size)))
+        {
+            return false;
+        }
+        payload.remove_prefix(size);
+    }
+
+    return true;
+}
+
+uint16_t packetCrc16(const uint8_t * data, std::size_t length, uint16_t crc)
+{
+    // Табличный расчет по полубайтам: 32 байта таблицы вместо 512
+    static const uint16_t table[16] = {
+        0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+        0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+    };
+
+    for (std::size_t i = 0; i < length; i++)
+    {
+        crc = (uint16_t)((crc << 4) ^ table[(crc >> 12) ^ (data[i] >> 4)]);
+        crc = (uint16_t)((crc << 4) ^ table[(crc >> 12) ^ (data[i] & 0x0F)]);
+    }
+    return crc;
+}
+
+std::size_t encodeVarint(uint64_t value, uint8_t * out)
+{
+    std::size_t size = 0;
+    while (value >= 0x80)
+    {
+        out[size++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[size++] = (uint8_t)value;
+    return size;
+}
+
+bool decodeVarint(std::string_view & input, uint64_t & out)
+{
+    out = 0;
+    for (std::size_t i = 0; i < input.size() && i < 10; i++)
+    {
+        const auto byte = (uint8_t)input[i];
+        out |= (uint64_t)(byte & 0x7F) << (7 * i);
+        if (!(byte & 0x80))
+        {
+            input.remove_prefix(i + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parseInteger(std::string_view text, long & out)
+{
+    if (text.empty())
+    {
+        return false;
+    }
+
+    auto negative = text.front() == '-';
+    if (negative || text.front() == '+')
+    {
+        text.remove_prefix(1);
+        if (text.empty())
+        {
+            return false;
+        }
+    }
+
+    unsigned long value = 0;
+    const unsigned long limit = negative ? (unsigned long)LONG_MAX + 1 : (unsigned long)LONG_MAX;
+
+    for (auto c : text)
+    {
+        if (c < '0' || c > '9')
+        {
+            return false;
+        }
+        auto digit = (unsigned long)(c - '0');
+        if (value > (limit - digit) / 10)
+        {
+            return false;
+        }
+        value = value * 10 + digit;
+    }
+
+    out = negative ? (long)(0 - value) : (long)value;
+    return true;
+}
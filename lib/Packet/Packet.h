@@ -0,0 +1,350 @@
+// (c) 2024 Takhir Latypov <cregennandev@gmail.com>
+// MIT License
+
+#ifndef KEECHAIN_PACKET_H_GUARD
+#define KEECHAIN_PACKET_H_GUARD
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+#include <EnumReflection.h>
+
+// Размер приемного кольцевого буфера, должен быть степенью двойки
+static constexpr std::size_t PACKET_RX_BUFFER_SIZE = 512;
+
+// Максимальная длина одной строки протокола без завершающего '\n'. STORE_ENTRIES - до 6 записей наибольшей длины
+static constexpr std::size_t PACKET_MAX_LENGTH = 640;
+
+// Максимальное количество частей <PART> в одном пакете, включая магию и тип запроса. STORE_ENTRIES - до 6 записей
+static constexpr std::size_t PACKET_MAX_PARTS = 20;
+
+// Размер буфера ответа. Ответ, который в него помещается, уходит одной записью
+static constexpr std::size_t PACKET_TX_BUFFER_SIZE = 256;
+
+/*
+ * Двоичный кадр, включается хостом после DISCOVER<PART>BINARY:
+ * - 0xA5 начало кадра, в текстовом протоколе не встречается
+ * - 1 байт код запроса или ответа (значение PROTOCOL_REQUEST_TYPE / PROTOCOL_RESPONSE_TYPE)
+ * - varint длина аргументов в байтах
+ * - аргументы, каждый начинается с varint заголовка h:
+ *   h нечетный - целое число, значение zigzag(h >> 1)
+ *   h четный - строка длиной h >> 1, байты строки следуют за заголовком
+ * - CRC16-CCITT (0x1021, начальное 0xFFFF) от кода до конца аргументов, старший байт первым
+ */
+static constexpr uint8_t PACKET_BINARY_START = 0xA5;
+
+/*
+ * Бит кода ответа: за кадром следует продолжение того же ответа. Ответ, который не помещается в буфер
+ * ответа, уходит цепочкой кадров с этим битом, последний кадр - с исходным кодом. Аргумент не разрывается
+ * между кадрами, и в кадре не больше PACKET_MAX_PARTS аргументов: каждый кадр разбирается отдельно
+ */
+static constexpr uint8_t PACKET_BINARY_CONTINUED = 0x80;
+
+// Двоичный кадр с идентификатором запроса: после начала идет varint идентификатор, дальше как у PACKET_BINARY_START. CRC считается начиная с идентификатора
+static constexpr uint8_t PACKET_BINARY_TAGGED_START = 0xA6;
+
+// Максимальная длина заголовка двоичного кадра: начало, идентификатор, код и длина
+static constexpr std::size_t PACKET_BINARY_HEADER_MAX = 10;
+
+// Текстовый кадр с идентификатором запроса начинается с магии, за которой сразу идет '#' и десятичный идентификатор: WARLIN#42<PART>...
+static constexpr char PACKET_REQUEST_ID_SEPARATOR = '#';
+
+// Необязательный идентификатор запроса, возвращается в каждом ответе на этот запрос
+struct PacketRequestId
+{
+    bool present = false;
+    uint32_t value = 0;
+};
+
+/*
+ * Кольцевой буфер фиксированного размера
+ * Не использует кучу, размер задается на этапе компиляции
+ */
+template<std::size_t Capacity>
+class RingBuffer
+{
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "RingBuffer capacity must be a power of two");
+
+    public:
+        bool push(uint8_t value)
+        {
+            if (full())
+            {
+                return false;
+            }
+            data[head++ & (Capacity - 1)] = value;
+            return true;
+        }
+
+        bool pop(uint8_t & value)
+        {
+            if (empty())
+            {
+                return false;
+            }
+            value = data[tail++ & (Capacity - 1)];
+            return true;
+        }
+
+        // Байт со смещением offset от начала очереди, без извлечения
+        uint8_t peek(std::size_t offset) const
+        {
+            return data[(tail + offset) & (Capacity - 1)];
+        }
+
+        // Отбросить count байт с начала очереди
+        void skip(std::size_t count)
+        {
+            tail += count < size() ? count : size();
+        }
+
+        std::size_t size() const { return head - tail; }
+        std::size_t free() const { return Capacity - size(); }
+        bool empty() const { return head == tail; }
+        bool full() const { return size() == Capacity; }
+        void clear() { head = tail = 0; }
+
+    private:
+        std::array<uint8_t, Capacity> data{};
+        std::size_t head = 0;
+        std::size_t tail = 0;
+};
+
+/*
+ * Разобранный пакет протокола
+ * Части хранятся как std::string_view поверх буфера строки, поэтому
+ * пакет действителен, только пока жив буфер, из которого он разобран
+ */
+class Packet
+{
+    public:
+        std::size_t size() const { return count - first; }
+        bool empty() const { return size() == 0; }
+        std::string_view operator[](std::size_t index) const { return parts[first + index]; }
+        std::string_view front() const { return parts[first]; }
+
+        // Убрать первую часть пакета (магию, тип запроса)
+        void popFront();
+
+        // Добавить часть, false если пакет переполнен
+        bool push(std::string_view part);
+
+        // Добавить уже разобранное число из двоичного кадра
+        bool pushInteger(long value);
+
+        // Часть с индексом index как целое: из двоичного кадра как есть, из текста разбором десятичной записи
+        bool integer(std::size_t index, long & out) const;
+
+        void clear();
+    private:
+        std::array<std::string_view, PACKET_MAX_PARTS> parts{};
+        std::array<long, PACKET_MAX_PARTS> values{};
+        std::bitset<PACKET_MAX_PARTS> numeric{};
+        std::size_t first = 0;
+        std::size_t count = 0;
+};
+
+Z_ENUM_NS(
+    PACKET_FEED_RESULT,
+    PENDING,
+    FRAME,
+    BINARY_FRAME,
+    GARBAGE,
+    TOO_LONG,
+    CORRUPT
+)
+
+/*
+ * Побайтовая сборка кадров протокола
+ * Кадр начинается с магии и заканчивается '\n'. Все, что приходит до магии,
+ * отбрасывается, слишком длинный кадр тоже отбрасывается до конца строки, и поиск
+ * снова начинается со следующей магии. Магия не должна иметь совпадающих
+ * префикса и суффикса (как у "WARLIN"), иначе поиск может пропустить вхождение.
+ * Если разрешены двоичные кадры, PACKET_BINARY_START вне кадра начинает двоичный кадр,
+ * при несовпадении CRC кадр отбрасывается целиком
+ */
+class PacketAssembler
+{
+    public:
+        explicit PacketAssembler(std::string_view magic);
+
+        /*
+         * Подать очередной байт
+         * FRAME - собран текстовый кадр, BINARY_FRAME - двоичный, он доступен через opcode() и frame()
+         */
+        PACKET_FEED_RESULT feed(uint8_t value);
+
+        // Последний собранный кадр: текст без '\n' или аргументы двоичного кадра. Действителен до следующего feed()
+        std::string_view frame() const;
+
+        // Код последнего двоичного кадра
+        uint8_t opcode() const;
+
+        // Идентификатор запроса последнего двоичного кадра
+        const PacketRequestId & requestId() const;
+
+        // Идет ли сейчас сборка кадра
+        bool inFrame() const;
+
+        void setBinaryEnabled(bool enabled);
+
+        void reset();
+    private:
+        enum class State : uint8_t
+        {
+            HUNT,
+            TEXT,
+            DISCARD,
+            BINARY_ID,
+            BINARY_OPCODE,
+            BINARY_LENGTH,
+            BINARY_PAYLOAD,
+            BINARY_CRC_HIGH,
+            BINARY_CRC_LOW
+        };
+
+        PACKET_FEED_RESULT feedBinary(uint8_t value);
+
+        std::string_view magic;
+        char buffer[PACKET_MAX_LENGTH]{};
+        std::size_t length = 0;
+        std::size_t matched = 0;
+        std::size_t garbage = 0;
+        State state = State::HUNT;
+        bool binaryEnabled = false;
+        uint8_t binaryOpcode = 0;
+        PacketRequestId binaryRequestId{};
+        std::size_t expected = 0;
+        uint8_t lengthShift = 0;
+        uint16_t crc = 0;
+        uint16_t receivedCrc = 0;
+};
+
+// Приемник готовых байт ответа, например Serial.write
+typedef void (*PacketSink)(const char * data, std::size_t length);
+
+/*
+ * Сборка ответа в фиксированном буфере
+ * Кадр: магия, затем каждая часть через разделитель, затем '\n'.
+ * Весь кадр отдается в приемник одной записью в finish(). Если кадр
+ * не помещается в буфер, заполненный буфер сбрасывается в приемник
+ * по частям, так что длинные ответы тоже не теряются
+ */
+class PacketWriter
+{
+    public:
+        PacketWriter(std::string_view magic, std::string_view delimiter, PacketSink sink);
+
+        // Начать новый текстовый кадр, записывает магию и идентификатор запроса, если он есть
+        PacketWriter & begin(const PacketRequestId & requestId = {});
+
+        /*
+         * Начать новый двоичный ответ с кодом opcode, меньше PACKET_BINARY_CONTINUED
+         * Аргументы, которые не помещаются в буфер, уходят следующими кадрами с PACKET_BINARY_CONTINUED
+         */
+        PacketWriter & beginBinary(uint8_t opcode, const PacketRequestId & requestId = {});
+
+        PacketWriter & append(std::string_view part);
+
+        template<typename T>
+        std::enable_if_t<std::is_enum<T>::value, PacketWriter &> append(T value)
+        {
+            return append(NameOf(value));
+        }
+
+        template<typename T>
+        std::enable_if_t<std::is_integral<T>::value && std::is_signed<T>::value, PacketWriter &> append(T value)
+        {
+            return appendInteger(value < 0, value < 0 ? 0ull - (unsigned long long)value : (unsigned long long)value);
+        }
+
+        template<typename T>
+        std::enable_if_t<std::is_integral<T>::value && !std::is_signed<T>::value, PacketWriter &> append(T value)
+        {
+            return appendInteger(false, value);
+        }
+
+        // Добавить каждый элемент последовательности отдельной частью
+        template<typename Iterable>
+        PacketWriter & appendEach(const Iterable & items)
+        {
+            for (const auto & item : items)
+            {
+                append(item);
+            }
+            return *this;
+        }
+
+        /*
+         * Завершить кадр и отдать его в приемник
+         * false, если один аргумент двоичного ответа больше буфера: последний кадр не отправлен
+         */
+        bool finish();
+
+        // Количество записей в приемник с момента создания
+        std::size_t writes() const;
+    private:
+        PacketWriter & appendInteger(bool negative, unsigned long long value);
+        static std::size_t formatDecimal(unsigned long long value, char * end);
+        void put(std::string_view bytes);
+        void putVarint(uint64_t value);
+        void flush();
+        // Место под аргумент двоичного ответа размером size: при нехватке текущий кадр уходит продолжением
+        void reserveArgument(std::size_t size);
+        // Отправить накопленные аргументы двоичным кадром с кодом opcode
+        void sendBinary(uint8_t opcode);
+
+        std::string_view magic;
+        std::string_view delimiter;
+        PacketSink sink;
+        char buffer[PACKET_TX_BUFFER_SIZE]{};
+        std::size_t length = 0;
+        std::size_t sinkWrites = 0;
+        bool binary = false;
+        bool overflow = false;
+        uint8_t binaryOpcode = 0;
+        PacketRequestId binaryRequestId{};
+        std::size_t binaryArguments = 0;
+};
+
+/*
+ * Разбивает строку по разделителю без выделения памяти
+ * Возвращает false, если частей больше, чем PACKET_MAX_PARTS
+ */
+bool splitPacket(std::string_view line, std::string_view delimiter, Packet & out);
+
+/*
+ * Проверяет первую часть текстового кадра: магия или магия#идентификатор
+ * false, если это не магия или идентификатор не число в пределах uint32_t
+ */
+bool parsePacketHead(std::string_view head, std::string_view magic, PacketRequestId & requestId);
+
+/*
+ * Разбирает аргументы двоичного кадра в пакет
+ * Строки остаются ссылками на payload. false для некорректных аргументов и переполнения пакета
+ */
+bool decodeBinaryPacket(std::string_view payload, Packet & out);
+
+// CRC16-CCITT, для продолжения расчета передать предыдущее значение в crc
+uint16_t packetCrc16(const uint8_t * data, std::size_t length, uint16_t crc = 0xFFFF);
+
+// Запись беззнакового LEB128, возвращает количество байт (не больше 10)
+std::size_t encodeVarint(uint64_t value, uint8_t * out);
+
+/*
+ * Чтение беззнакового LEB128 из начала input, прочитанные байты отбрасываются
+ * false, если число обрывается или не помещается в 64 бита
+ */
+bool decodeVarint(std::string_view & input, uint64_t & out);
+
+/*
+ * Разбор десятичного числа со знаком без std::stol и исключений
+ * Возвращает false для пустой строки, посторонних символов и переполнения
+ */
+bool parseInteger(std::string_view text, long & out);
+
+#endif // Guard
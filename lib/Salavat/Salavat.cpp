@@ -1,54 +1,190 @@
 // (c) 2024. Takhir Latypov <cregennandev@gmail.com>
 #include <Salavat.h>
+#include <Cipher.h>
+#include <algorithm>
 #include <sha1.h>
-#include <TOTP.h>
 #include "FlashStorage_SAMD.h"
 #include "Warlin.h"
-#include "Base32.h"
 
 const auto EEPROM_MARKER_0 = 0xBA;
 const auto EEPROM_MARKER_1 = 0xBE;
-const auto SECRET_LEFT_MARKER_0 = 0xFF;
-const auto SECRET_LEFT_MARKER_1 = 0xFA;
-const auto SECRET_RIGHT_MARKER_0 = 0xFA;
-const auto SECRET_RIGHT_MARKER_1 = 0xFF;
+// Контекст вывода ключа шифрования секретов из хеша пароля
+static constexpr char SEAL_KEY_INFO[] = "KeeChain vault seal key";
+
+// Наибольшая длина расшифрованного секрета: записи ADD и SEALED хранят длину секрета в байте
+static constexpr std::size_t SECRET_PLAIN_MAX = UINT8_MAX;
+
+/*
+ * Ключ ChaCha20: HKDF-Expand (RFC 5869) на HMAC-SHA1. PRK - результат PBKDF2, в хранилище без записи KDF - хеш пароля
+ * T1 = HMAC(PRK, info | 1), T2 = HMAC(PRK, T1 | info | 2), ключ - первые 32 байта T1 | T2
+ */
+static void deriveSealKey(const uint8_t * prk, std::size_t prkLength, uint8_t out[CHACHA20_KEY_LENGTH]);
+
+// Соль для нового хранилища: серийный номер микроконтроллера и время от запуска через SHA-1
+static void makeKdfSalt(uint8_t out[VAULT_KDF_SALT_LENGTH]);
+
+/*
+ * Открыть секрет записи: SEALED ключом sealKey, ADD первой версии - XOR с хешем пароля
+ * false, если ключ не подходит или данные испорчены
+ */
+static bool openEntrySecret(const VaultRecordEntry & entry, const std::vector<uint8_t> & passwordHash,
+                            const uint8_t sealKey[CHACHA20_KEY_LENGTH], uint8_t * out, std::size_t & length);
+
+/*
+ * Журнал занимает 384 строки флеш-памяти по 256 байт: пул из трех банков по 32 КБ.
+ * Самая длинная запись SEALED (имя 20 байт, секрет 31 байт с нонсом и тегом - 59) занимает 88 байт,
+ * так что снимок TOTP_KEYS_COUNT_LIMIT записей - около 26 КБ, остальное место банка - под дописывание
+ */
+static constexpr std::size_t VAULT_FLASH_ROW_SIZE = 256;
+static constexpr std::size_t VAULT_FLASH_PAGE_SIZE = 64;
+static constexpr std::size_t VAULT_FLASH_ROWS = 384;
+
+// Область журнала в памяти программы, выровнена по строке, как хранилище FlashStorage_SAMD
+__attribute__((__aligned__(VAULT_FLASH_ROW_SIZE))) static const uint8_t VaultFlashArea[VAULT_FLASH_ROWS * VAULT_FLASH_ROW_SIZE] = {};
+
+/*
+ * Флеш-память SAMD через FlashClass из FlashStorage_SAMD
+ * FlashClass заполняет буфер страницы словами подряд, поэтому запись режется по границам страниц
+ */
+class SamdVaultFlash : public FlashDevice
+{
+    public:
+        const uint8_t * image() const override {
+            // Компилятор не должен подставлять нули из инициализатора вместо чтения флеш-памяти
+            auto area = VaultFlashArea;
+            asm volatile("" : "+r"(area));
+            return area;
+        }
 
-std::vector<uint8_t> decryptSecretWithMarkers(const std::vector<uint8_t> & encryptedSecret, const std::vector<uint8_t> & secretKey);
+        std::size_t size() const override {
+            return sizeof(VaultFlashArea);
+        }
 
-bool verifySecretKey(const std::vector<uint8_t> & encryptedSecret, const std::vector<uint8_t> & secretKey);
+        std::size_t rowSize() const override {
+            return VAULT_FLASH_ROW_SIZE;
+        }
 
-std::vector<uint8_t> encryptSecret(const std::string & rawSecretString, const std::vector<uint8_t> & secretKey);
+        bool erase(std::size_t offset, std::size_t length) override {
+            if (offset % VAULT_FLASH_ROW_SIZE != 0 || offset + length > size()){
+                return false;
+            }
+            flash.erase(image() + offset, length);
+            return true;
+        }
 
-std::vector<uint8_t> decryptWithMasterKey(const std::vector<uint8_t> & encryptedSecret, const std::vector<uint8_t> & masterPassword);
+        bool program(std::size_t offset, const void * data, std::size_t length) override {
+            if (offset % FLASH_WORD_SIZE != 0 || length % FLASH_WORD_SIZE != 0 || offset + length > size()){
+                return false;
+            }
+            auto bytes = static_cast<const uint8_t *>(data);
+            while (length > 0){
+                auto chunk = VAULT_FLASH_PAGE_SIZE - offset % VAULT_FLASH_PAGE_SIZE;
+                if (chunk > length){
+                    chunk = length;
+                }
+                flash.write(image() + offset, bytes, chunk);
+                offset += chunk;
+                bytes += chunk;
+                length -= chunk;
+            }
+            return true;
+        }
+    private:
+        FlashClass flash;
+};
+
+FlashDevice & vaultFlash() {
+    static SamdVaultFlash device;
+    return device;
+}
 
 VAULT_INIT_RESULT Salavat_::Initialize() {
     if (this->VaultInitialized){
         return VAULT_INIT_RESULT::ALREADY_INITIALIZED;
     }
 
-    auto entriesCount = EEPROM.read(2);
-
-    if (EEPROM_MARKER_0 != EEPROM.read(0)
-        || EEPROM_MARKER_1 != EEPROM.read(1)
-        || entriesCount > TOTP_KEYS_COUNT_LIMIT){
+    if (Journal.open() == VAULT_JOURNAL_RESULT::EMPTY){
+        VAULT_INIT_RESULT imported;
+        if (importLegacyEeprom(imported)){
+            return imported;
+        }
 
         ForceReset();
-
+        VaultEntries.clear();
         this->VaultInitialized = true;
-
         return VAULT_INIT_RESULT::SUCCESS_NEWBORN;
     }
 
+    // Записи ничего не копируют и не выделяют: смещения в журнал в статической таблице
+    if (!reloadEntries()){
+        return VAULT_INIT_RESULT::MALFORMED;
+    }
+
+    SendDebugMessage("ENTRIES FOUND: ", std::to_string(VaultEntries.live()).c_str());
+    this->VaultInitialized = true;
+
+    return VAULT_INIT_RESULT::SUCCESS;
+}
+
+bool Salavat_::reloadEntries() {
+    auto valid = replayVaultEntries(Journal, VaultEntries);
+
+    // Параметры вывода ключа - первая запись снимка, если хранилище уже переведено на PBKDF2
+    this->Kdf = VaultKdfParams{};
+    Journal.replay([this, &valid](uint8_t type, std::string_view payload){
+        if (type == VAULT_RECORD_KDF){
+            valid = valid && decodeVaultKdf(payload, this->Kdf);
+        }
+        return false;
+    });
+
+    this->LegacySecrets = 0;
+    for (std::size_t entryId = 0; entryId < VaultEntries.size(); entryId++){
+        if (!VaultEntries.alive(entryId)){
+            continue;
+        }
+        const auto entry = VaultEntries[entryId];
+        this->LegacySecrets += entry.sealed ? 0 : 1;
+        valid = valid
+                && !entry.name.empty() && entry.name.size() <= TOTP_KEY_NAME_MAX_LENGTH
+                && !entry.secret.empty();
+    }
+    if (!valid){
+        VaultEntries.clear();
+    }
+    recountSnapshot();
+    return valid;
+}
+
+void Salavat_::recountSnapshot() {
+    const auto kdfBytes = this->Kdf.iterations > 0 ? VaultJournal::recordSize(VAULT_RECORD_KDF_SIZE) : 0;
+    this->SnapshotBytes = vaultSnapshotSize(this->VaultEntries, kdfBytes);
+}
+
+bool Salavat_::importLegacyEeprom(VAULT_INIT_RESULT & result) {
+    auto entriesCount = EEPROM.read(2);
+
+    if (EEPROM_MARKER_0 != EEPROM.read(0)
+        || EEPROM_MARKER_1 != EEPROM.read(1)
+        || entriesCount > TOTP_LEGACY_KEYS_COUNT_LIMIT){
+        return false;
+    }
+
     auto grandOffset = 3;
 
-    SendDebugMessage("ENTRIES FOUND: ", std::to_string(entriesCount).c_str());
+    SendDebugMessage("LEGACY ENTRIES FOUND: ", std::to_string(entriesCount).c_str());
     VaultEntries.clear();
 
+    // Записи переносятся готовыми данными для журнала, таблица заполняется уже из него
+    std::vector<std::string> payloads;
+    payloads.reserve(entriesCount);
+
     for(auto i = 0; i < entriesCount; i++){
         //Secret name
         auto nameLength = EEPROM.read(grandOffset++);
         if (nameLength > TOTP_KEY_NAME_MAX_LENGTH || nameLength == 0){
-            return VAULT_INIT_RESULT::MALFORMED;
+            result = VAULT_INIT_RESULT::MALFORMED;
+            return true;
         }
         std::string name;
         name.resize(nameLength);
@@ -60,9 +196,10 @@ VAULT_INIT_RESULT Salavat_::Initialize() {
         auto secretLength = EEPROM.read(grandOffset++);
         if (secretLength > TOTP_KEY_SECRET_MAX_LENGTH || secretLength <= 0){
             SendDebugMessage("Secret contents malformed, secret length: ", std::to_string(secretLength).c_str());
-            return VAULT_INIT_RESULT::MALFORMED;
+            result = VAULT_INIT_RESULT::MALFORMED;
+            return true;
         }
-        std::vector<uint8_t> secret;
+        std::string secret;
         secret.resize(secretLength);
         for(auto sc = 0; sc < secretLength; sc++){
             secret[sc] = EEPROM.read(grandOffset++);
@@ -70,50 +207,352 @@ VAULT_INIT_RESULT Salavat_::Initialize() {
 
         //Key characters length
         auto characterLength = EEPROM.read(grandOffset++);
-        VaultEntry entry;
-        entry.Digits = characterLength;
-        entry.Name = name;
-        entry.Secret = secret;
-        VaultEntries.push_back(entry);
+        VaultRecordEntry entry;
+        entry.digits = characterLength;
+        entry.name = name;
+        entry.secret = secret;
+        uint8_t payload[VAULT_RECORD_ENTRY_MAX];
+        auto length = encodeVaultEntry(entry, payload);
+        payloads.emplace_back(reinterpret_cast<const char *>(payload), length);
     }
-    this->VaultInitialized = true;
 
-    return VAULT_INIT_RESULT::SUCCESS;
+    // EEPROM не трогаем: если перенос оборвется, при следующем запуске он начнется заново
+    auto imported = Journal.compact([&payloads](auto && emit){
+        for (const auto & payload : payloads){
+            if (!emit(VAULT_RECORD_ADD, payload)){
+                return;
+            }
+        }
+    });
+    if (imported != VAULT_JOURNAL_RESULT::SUCCESS || !reloadEntries()){
+        result = VAULT_INIT_RESULT::MALFORMED;
+        return true;
+    }
+
+    this->VaultInitialized = true;
+    result = VAULT_INIT_RESULT::SUCCESS;
+    return true;
 }
 
 void Salavat_::ForceReset() {
-    EEPROM.write(0, EEPROM_MARKER_0);
-    EEPROM.write(1, EEPROM_MARKER_1);
-    EEPROM.write(2, 0); // <- default stored entries count
-    EEPROM.commit();
+    Journal.format();
+}
+
+VAULT_JOURNAL_RESULT Salavat_::persist(uint8_t type, std::string_view payload) {
+    auto result = Journal.append(type, payload);
+    if (result == VAULT_JOURNAL_RESULT::FULL){
+        // Снимок сохраняет идентификаторы, поэтому слоты и ключи в таблице остаются на местах
+        const auto adds = type == VAULT_RECORD_SEALED || type == VAULT_RECORD_BATCH || type == VAULT_RECORD_TRANSACTION;
+        result = compactJournal(adds ? type : 0, adds ? payload : std::string_view());
+        if (result == VAULT_JOURNAL_RESULT::SUCCESS && !reloadEntries()){
+            result = VAULT_JOURNAL_RESULT::FLASH_ERROR;
+        }
+        return result;
+    }
+    if (result == VAULT_JOURNAL_RESULT::SUCCESS && type == VAULT_RECORD_SEALED){
+        if (!VaultEntries.push_back(Journal.lastPayload(), true)){
+            return VAULT_JOURNAL_RESULT::FLASH_ERROR;
+        }
+    }
+    if (result == VAULT_JOURNAL_RESULT::SUCCESS && (type == VAULT_RECORD_BATCH || type == VAULT_RECORD_TRANSACTION)){
+        // В снимке каждая запись пакета станет отдельной записью SEALED. Удаления транзакции уже сделаны в таблице
+        auto batch = Journal.lastPayload();
+        std::string_view removed;
+        if (type == VAULT_RECORD_TRANSACTION){
+            decodeVaultTransaction(batch, removed, batch);
+        }
+        std::string_view entry;
+        while (nextVaultBatchEntry(batch, entry)){
+            if (!VaultEntries.push_back(entry, true)){
+                reloadEntries();
+                return VAULT_JOURNAL_RESULT::FLASH_ERROR;
+            }
+        }
+    }
+    if (result == VAULT_JOURNAL_RESULT::SUCCESS){
+        recountSnapshot();
+    }
+    this->IdleCompactionDue = true;
+    return result;
+}
+
+VAULT_JOURNAL_RESULT Salavat_::compactJournal(uint8_t addedType, std::string_view added) {
+    // Хранилище без записи KDF после разблокировки переходит на ключ из PBKDF2: снимок перепечатывает все секреты
+    auto rekey = this->RekeyPending && this->VaultUnlocked;
+    if (rekey && !vaultEntriesReadable(VaultEntries, [this](const VaultRecordEntry & entry){
+            uint8_t plain[SECRET_PLAIN_MAX];
+            std::size_t plainLength = 0;
+            const auto opened = openEntrySecret(entry, this->MasterPasswordHash, this->SealKey, plain, plainLength);
+            secureZero(plain, sizeof(plain));
+            return opened;
+        })){
+        // Пароль проверен только по первой записи. Испорченная запись осталась бы под прежним ключом и стала бы нечитаемой
+        SendDebugMessage("Salavat: rekey skipped, unreadable entry");
+        dropRekey();
+        rekey = false;
+    }
+    const auto & kdf = rekey ? this->PendingKdf : this->Kdf;
+    const uint8_t * targetKey = rekey ? this->RekeyKey : this->SealKey;
+
+    auto result = Journal.compact([this, addedType, added, rekey, &kdf, targetKey](auto && emit){
+        uint8_t payload[VAULT_RECORD_ENTRY_MAX];
+        uint8_t plain[SECRET_PLAIN_MAX];
+        uint8_t sealed[SECRET_PLAIN_MAX];
+
+        // Пока хранилище разблокировано, секреты первой версии и секреты под прежним ключом перепечатываются
+        auto emitEntry = [&](VaultRecordEntry entry){
+            std::size_t plainLength;
+            if ((!entry.sealed || rekey) && this->VaultUnlocked
+                    && openEntrySecret(entry, this->MasterPasswordHash, this->SealKey, plain, plainLength)
+                    && plainLength + SEALED_SECRET_OVERHEAD <= sizeof(sealed)){
+                auto sealedLength = sealEntrySecret(targetKey, entry.name, plain, plainLength, sealed);
+                secureZero(plain, plainLength);
+                entry.secret = std::string_view(reinterpret_cast<const char *>(sealed), sealedLength);
+                entry.sealed = true;
+            }
+            auto length = encodeVaultEntry(entry, payload);
+            return emit(entry.sealed ? VAULT_RECORD_SEALED : VAULT_RECORD_ADD, std::string_view(reinterpret_cast<const char *>(payload), length));
+        };
+
+        if (kdf.iterations > 0 && !emit(VAULT_RECORD_KDF, std::string_view(reinterpret_cast<const char *>(payload), encodeVaultKdf(kdf, payload)))){
+            return;
+        }
+        for (std::size_t entryId = 0; entryId < VaultEntries.size(); entryId++){
+            if (!VaultEntries.alive(entryId)){
+                if (!emit(VAULT_RECORD_HOLE, std::string_view())){
+                    return;
+                }
+                continue;
+            }
+            if (!emitEntry(VaultEntries[entryId])){
+                return;
+            }
+        }
+        VaultRecordEntry entry;
+        if (addedType == VAULT_RECORD_SEALED && decodeVaultEntry(added, entry)){
+            entry.sealed = true;
+            emitEntry(entry);
+        }
+        auto batch = addedType == VAULT_RECORD_BATCH ? added : std::string_view();
+        std::string_view removed;
+        if (addedType == VAULT_RECORD_TRANSACTION){
+            decodeVaultTransaction(added, removed, batch);
+        }
+        std::string_view batchEntry;
+        while (nextVaultBatchEntry(batch, batchEntry) && decodeVaultEntry(batchEntry, entry)){
+            entry.sealed = true;
+            if (!emitEntry(entry)){
+                return;
+            }
+        }
+    });
+
+    if (rekey && result == VAULT_JOURNAL_RESULT::SUCCESS){
+        memcpy(this->SealKey, this->RekeyKey, sizeof(this->SealKey));
+        dropRekey();
+    }
+    return result;
 }
 
 VAULT_ADD_ENTRY_RESULT Salavat_::addEntry(const std::string & name, const std::string & rawSecret, int digitsCount = 6) {
+    VaultNewEntry entry;
+    entry.name = name;
+    entry.secret = rawSecret;
+    entry.digits = digitsCount;
+    std::size_t failed;
+    return addEntries(&entry, 1, failed);
+}
+
+VAULT_ADD_ENTRY_RESULT Salavat_::addEntries(const VaultNewEntry * entries, std::size_t count, std::size_t & failed) {
+    failed = 0;
     if (!this->VaultUnlocked){
         return VAULT_ADD_ENTRY_RESULT::VAULT_IS_LOCKED;
     }
+    if (this->TransactionOpen){
+        return stageEntries(entries, count, failed);
+    }
 
-    if (VaultEntries.size() + 1 > TOTP_KEYS_COUNT_LIMIT){
+    if (count > VAULT_BATCH_MAX_ENTRIES || VaultEntries.live() + count > VaultEntries.capacity()){
         return VAULT_ADD_ENTRY_RESULT::NO_MORE_SPACE;
     }
+    if (count == 0){
+        return VAULT_ADD_ENTRY_RESULT::SUCCESS;
+    }
+
+    // Одна запись пишется как SEALED, несколько - одной записью BATCH
+    uint8_t payload[VAULT_BATCH_MAX_ENTRIES * VAULT_BATCH_ENTRY_MAX];
+    HmacSha1Key keys[VAULT_BATCH_MAX_ENTRIES];
+    std::size_t length = 0;
+    auto result = VAULT_ADD_ENTRY_RESULT::SUCCESS;
+    for (; failed < count; failed++){
+        uint8_t sealed[TOTP_KEY_SECRET_MAX_BYTES + SEALED_SECRET_OVERHEAD];
+        VaultRecordEntry entry;
+        result = sealNewEntry(entries[failed], sealed, entry, keys[failed]);
+        if (result != VAULT_ADD_ENTRY_RESULT::SUCCESS){
+            break;
+        }
+        length += count == 1 ? encodeVaultEntry(entry, payload) : encodeVaultBatchEntry(entry, payload + length);
+    }
+
+    if (result == VAULT_ADD_ENTRY_RESULT::SUCCESS && VaultEntries.size() + count > VaultEntries.capacity() && !purgeTombstones()){
+        result = VAULT_ADD_ENTRY_RESULT::STORAGE_ERROR;
+    }
+
+    if (result == VAULT_ADD_ENTRY_RESULT::SUCCESS
+            && persist(count == 1 ? VAULT_RECORD_SEALED : VAULT_RECORD_BATCH,
+                       std::string_view(reinterpret_cast<const char *>(payload), length)) != VAULT_JOURNAL_RESULT::SUCCESS){
+        result = VAULT_ADD_ENTRY_RESULT::STORAGE_ERROR;
+    }
 
-    if (rawSecret.empty() || rawSecret.size() > TOTP_KEY_SECRET_MAX_LENGTH){
+    if (result == VAULT_ADD_ENTRY_RESULT::SUCCESS){
+        const auto first = this->VaultEntries.size() - count;
+        for (std::size_t i = 0; i < count; i++){
+            this->VaultEntries.key(first + i) = keys[i];
+            this->VaultEntries.markPrepared(first + i);
+        }
+        this->Codes.clear();
+        this->PrecomputeCursor = 0;
+    }
+    secureZero(keys, sizeof(keys));
+    return result;
+}
+
+VAULT_ADD_ENTRY_RESULT Salavat_::stageEntries(const VaultNewEntry * entries, std::size_t count, std::size_t & failed) {
+    if (this->StagedAdds + count > VAULT_TRANSACTION_MAX_ADDS){
+        return VAULT_ADD_ENTRY_RESULT::NO_MORE_SPACE;
+    }
+
+    auto length = this->StagedLength;
+    for (failed = 0; failed < count; failed++){
+        uint8_t sealed[TOTP_KEY_SECRET_MAX_BYTES + SEALED_SECRET_OVERHEAD];
+        VaultRecordEntry entry;
+        auto & key = this->StagedKeys[this->StagedAdds + failed];
+        auto result = sealNewEntry(entries[failed], sealed, entry, key);
+        if (result != VAULT_ADD_ENTRY_RESULT::SUCCESS){
+            secureZero(&this->StagedKeys[this->StagedAdds], failed * sizeof(HmacSha1Key));
+            return result;
+        }
+        length += encodeVaultBatchEntry(entry, this->StagedRecord + TRANSACTION_HEADER_MAX + length);
+    }
+    this->StagedLength = length;
+    this->StagedAdds += count;
+    return VAULT_ADD_ENTRY_RESULT::SUCCESS;
+}
+
+VAULT_TRANSACTION_RESULT Salavat_::beginTransaction() {
+    if (!this->VaultUnlocked){
+        return VAULT_TRANSACTION_RESULT::VAULT_IS_LOCKED;
+    }
+    if (this->TransactionOpen){
+        return VAULT_TRANSACTION_RESULT::ALREADY_STARTED;
+    }
+    this->TransactionOpen = true;
+    return VAULT_TRANSACTION_RESULT::SUCCESS;
+}
+
+VAULT_TRANSACTION_RESULT Salavat_::rollbackTransaction() {
+    if (!this->TransactionOpen){
+        return VAULT_TRANSACTION_RESULT::NOT_STARTED;
+    }
+    dropTransaction();
+    return VAULT_TRANSACTION_RESULT::SUCCESS;
+}
+
+VAULT_TRANSACTION_RESULT Salavat_::commitTransaction() {
+    if (!this->VaultUnlocked){
+        return VAULT_TRANSACTION_RESULT::VAULT_IS_LOCKED;
+    }
+    if (!this->TransactionOpen){
+        return VAULT_TRANSACTION_RESULT::NOT_STARTED;
+    }
+
+    const auto adds = this->StagedAdds;
+    const auto removes = this->StagedRemoveCount;
+    if (adds == 0 && removes == 0){
+        dropTransaction();
+        return VAULT_TRANSACTION_RESULT::SUCCESS;
+    }
+    if (VaultEntries.live() - removes + adds > VaultEntries.capacity()){
+        dropTransaction();
+        return VAULT_TRANSACTION_RESULT::NO_MORE_SPACE;
+    }
+
+    // Удаления делаются в таблице до записи, как в removeEntry(): снимок при заполненном банке их уже не увидит
+    for (std::size_t i = 0; i < removes; i++){
+        VaultEntries.erase(this->StagedRemoves[i]);
+    }
+
+    const auto batch = reinterpret_cast<const char *>(this->StagedRecord) + TRANSACTION_HEADER_MAX;
+    if (VaultEntries.size() + adds > VaultEntries.capacity()){
+        // Идентификаторы кончились: надгробия убираются тем же снимком, который пишет новые записи, он тоже атомарен
+        VaultEntries.purge();
+        if (compactJournal(VAULT_RECORD_BATCH, std::string_view(batch, this->StagedLength)) != VAULT_JOURNAL_RESULT::SUCCESS || !reloadEntries()){
+            // Прежний банк цел, но ключи таблицы уже переставлены
+            reloadEntries();
+            lock();
+            return VAULT_TRANSACTION_RESULT::STORAGE_ERROR;
+        }
+    }
+    else {
+        const auto headerSize = vaultTransactionHeaderSize(removes);
+        auto record = this->StagedRecord + TRANSACTION_HEADER_MAX - headerSize;
+        encodeVaultTransactionHeader(this->StagedRemoves, removes, record);
+        if (persist(VAULT_RECORD_TRANSACTION, std::string_view(reinterpret_cast<const char *>(record), headerSize + this->StagedLength)) != VAULT_JOURNAL_RESULT::SUCCESS){
+            for (std::size_t i = 0; i < removes; i++){
+                VaultEntries.restore(this->StagedRemoves[i]);
+            }
+            dropTransaction();
+            return VAULT_TRANSACTION_RESULT::STORAGE_ERROR;
+        }
+    }
+
+    const auto first = this->VaultEntries.size() - adds;
+    for (std::size_t i = 0; i < adds; i++){
+        this->VaultEntries.key(first + i) = this->StagedKeys[i];
+        this->VaultEntries.markPrepared(first + i);
+    }
+    dropTransaction();
+    this->Codes.clear();
+    this->PrecomputeCursor = 0;
+    return VAULT_TRANSACTION_RESULT::SUCCESS;
+}
+
+void Salavat_::dropTransaction() {
+    this->TransactionOpen = false;
+    secureZero(this->StagedRecord, sizeof(this->StagedRecord));
+    secureZero(this->StagedKeys, sizeof(this->StagedKeys));
+    this->StagedLength = 0;
+    this->StagedAdds = 0;
+    this->StagedRemoveCount = 0;
+}
+
+VAULT_ADD_ENTRY_RESULT Salavat_::sealNewEntry(const VaultNewEntry & newEntry, uint8_t sealed[TOTP_KEY_SECRET_MAX_BYTES + SEALED_SECRET_OVERHEAD],
+                                              VaultRecordEntry & entry, HmacSha1Key & key) {
+    if (newEntry.secret.empty() || newEntry.secret.size() > TOTP_KEY_SECRET_MAX_LENGTH){
         return VAULT_ADD_ENTRY_RESULT::SECRET_LENGTH_EXCEEDED;
     }
 
-    if (name.empty() || name.size() > TOTP_KEY_NAME_MAX_LENGTH){
+    if (newEntry.name.empty() || newEntry.name.size() > TOTP_KEY_NAME_MAX_LENGTH){
         return VAULT_ADD_ENTRY_RESULT::NAME_LENGTH_EXCEEDED;
     }
 
-    VaultEntry entry;
-    entry.Name = name;
-    entry.Digits = digitsCount;
-    entry.Secret = encryptSecret(rawSecret, this->MasterPasswordHash);
+    if (newEntry.digits < TOTP_KEY_DIGITS_MIN || newEntry.digits > TOTP_KEY_DIGITS_MAX){
+        return VAULT_ADD_ENTRY_RESULT::INVALID_DIGITS;
+    }
 
-    auto rawSecretBytes = decodeBase32Secret(rawSecret);
-    this->VaultEntries.push_back(entry);
-    this->UnencryptedSecrets.push_back(rawSecretBytes);
-    this->burnVaultEntries();
+    uint8_t secretBytes[TOTP_KEY_SECRET_MAX_BYTES];
+    std::size_t secretLength;
+    if (!decodeBase32Secret(newEntry.secret, secretBytes, secretLength)){
+        return VAULT_ADD_ENTRY_RESULT::MALFORMED_SECRET;
+    }
+    entry.name = newEntry.name;
+    entry.digits = (uint8_t)newEntry.digits;
+    entry.secret = std::string_view(reinterpret_cast<const char *>(sealed),
+                                    sealEntrySecret(this->SealKey, newEntry.name, secretBytes, secretLength, sealed));
+    entry.sealed = true;
+
+    hmacSha1Prepare(secretBytes, secretLength, key);
+    secureZero(secretBytes, sizeof(secretBytes));
     return VAULT_ADD_ENTRY_RESULT::SUCCESS;
 }
 
@@ -121,47 +560,39 @@ VAULT_REMOVE_ENTRY_RESULT Salavat_::removeEntry(int entryId) {
     if(!this->VaultUnlocked){
         return VAULT_REMOVE_ENTRY_RESULT::VAULT_IS_LOCKED;
     }
-    if (entryId < 0 || entryId >= VaultEntries.size()){
+    if (entryId < 0 || !VaultEntries.alive(entryId)){
         return VAULT_REMOVE_ENTRY_RESULT::NOT_FOUND;
     }
 
-    VaultEntries.erase(VaultEntries.begin() + entryId);
-    UnencryptedSecrets.erase(UnencryptedSecrets.begin() + entryId);
-    this->burnVaultEntries();
-
-    return VAULT_REMOVE_ENTRY_RESULT::SUCCESS;
-}
-
-void Salavat_::burnVaultEntries() {
-    EEPROM.write(0, EEPROM_MARKER_0);
-    EEPROM.write(1, EEPROM_MARKER_1);
-    SendDebugMessage("Burning entries length: ", std::to_string(VaultEntries.size()).c_str());
-    EEPROM.write(2, VaultEntries.size());
-    auto grandIndex = 3;
-
-    for(const auto & entry : VaultEntries){
-        SendDebugMessage("Burning name length: ", std::to_string(entry.Name.size()).c_str());
-        EEPROM.write(grandIndex++, entry.Name.size());
-        for(auto& c : entry.Name){
-            SendDebugMessage("Burning name byte: ", std::to_string(c).c_str());
-            EEPROM.write(grandIndex++, c);
+    // В транзакции удаление только запоминается, запись пропадет при фиксации
+    if (this->TransactionOpen){
+        const auto staged = std::find(this->StagedRemoves, this->StagedRemoves + this->StagedRemoveCount, (uint16_t)entryId);
+        if (staged != this->StagedRemoves + this->StagedRemoveCount){
+            return VAULT_REMOVE_ENTRY_RESULT::NOT_FOUND;
         }
-
-        SendDebugMessage("Burning secret length: ", std::to_string(entry.Secret.size()).c_str());
-        EEPROM.write(grandIndex++, entry.Secret.size());
-        for(auto& c : entry.Secret){
-            SendDebugMessage("Burning secret byte: ", std::to_string(c).c_str());
-            EEPROM.write(grandIndex++, c);
+        if (this->StagedRemoveCount == VAULT_TRANSACTION_MAX_REMOVES){
+            return VAULT_REMOVE_ENTRY_RESULT::TRANSACTION_FULL;
         }
+        this->StagedRemoves[this->StagedRemoveCount++] = (uint16_t)entryId;
+        return VAULT_REMOVE_ENTRY_RESULT::SUCCESS;
+    }
 
-        SendDebugMessage("Burning digits: ", std::to_string(entry.Digits).c_str());
-        EEPROM.write(grandIndex++, entry.Digits);
+    // Запись становится надгробием, идентификаторы остальных не меняются. Откат снимает отметку
+    VaultEntries.erase(entryId);
+
+    uint8_t payload[2];
+    auto length = encodeVaultRemove((std::size_t)entryId, payload);
+    if (persist(VAULT_RECORD_TOMBSTONE, std::string_view(reinterpret_cast<const char *>(payload), length)) != VAULT_JOURNAL_RESULT::SUCCESS){
+        VaultEntries.restore(entryId);
+        return VAULT_REMOVE_ENTRY_RESULT::STORAGE_ERROR;
     }
 
-    EEPROM.commit();
+    Codes.clear();
+
+    return VAULT_REMOVE_ENTRY_RESULT::SUCCESS;
 }
 
-VAULT_UNLOCK_RESULT Salavat_::unlock(const std::string & password) {
+VAULT_UNLOCK_RESULT Salavat_::beginUnlock(const std::string & password) {
     if (password.empty() || password.size() > TOTP_KEY_PASSWORD_MAX_LENGTH){
         return VAULT_UNLOCK_RESULT::MALFORMED_PASSWORD;
     }
@@ -172,52 +603,265 @@ VAULT_UNLOCK_RESULT Salavat_::unlock(const std::string & password) {
     Sha1.init();
     Sha1.print(password.c_str());
     auto hashPointer = Sha1.result();
-    std::vector<uint8_t> passwordHash(hashPointer, hashPointer + 20);
+    this->PendingPasswordHash.assign(hashPointer, hashPointer + 20);
 
-    if (this->VaultEntries.empty()){
-        SendDebugMessage("Salavat: vault was empty");
-        this->VaultUnlocked = true;
-        this->MasterPasswordHash = passwordHash;
-        return VAULT_UNLOCK_RESULT::SUCCESS;
+    // Хранилище без записи KDF получает новые параметры, они запишутся вместе с перепечатанными секретами
+    if (this->Kdf.iterations > 0){
+        this->PendingKdf = this->Kdf;
+    }else{
+        this->PendingKdf = VaultKdfParams{};
+        this->PendingKdf.iterations = VAULT_KDF_ITERATIONS;
+        makeKdfSalt(this->PendingKdf.salt);
     }
 
-    if (verifySecretKey(this->VaultEntries[0].Secret, passwordHash)){
-        this->VaultUnlocked = true;
-        this->MasterPasswordHash = passwordHash;
-        this->UnencryptedSecrets.clear();
+    this->KeyDerivation.begin(this->PendingPasswordHash.data(), this->PendingPasswordHash.size(),
+                              this->PendingKdf.salt, VAULT_KDF_SALT_LENGTH, this->PendingKdf.iterations);
+    this->UnlockResult = VAULT_UNLOCK_RESULT::PENDING;
+    return VAULT_UNLOCK_RESULT::PENDING;
+}
 
-        for(auto& entry : this->VaultEntries){
-            this->UnencryptedSecrets.push_back(decryptWithMasterKey(entry.Secret, passwordHash));
-        }
+bool Salavat_::unlockNext() {
+    if (this->UnlockResult != VAULT_UNLOCK_RESULT::PENDING){
+        return false;
+    }
+    if (!this->KeyDerivation.step(VAULT_KDF_SLICE_ITERATIONS)){
+        return true;
+    }
 
-        return VAULT_UNLOCK_RESULT::SUCCESS;
+    // Пока ключ выводился, хранилище могло перейти на PBKDF2 с другой солью: вывод начинается заново с его параметрами
+    if (this->Kdf.iterations > 0 && (this->Kdf.iterations != this->PendingKdf.iterations
+            || memcmp(this->Kdf.salt, this->PendingKdf.salt, VAULT_KDF_SALT_LENGTH) != 0)){
+        this->PendingKdf = this->Kdf;
+        this->KeyDerivation.begin(this->PendingPasswordHash.data(), this->PendingPasswordHash.size(),
+                                  this->PendingKdf.salt, VAULT_KDF_SALT_LENGTH, this->PendingKdf.iterations);
+        return true;
+    }
+
+    uint8_t derived[SHA1_HASH_LENGTH];
+    this->KeyDerivation.finish(derived);
+    this->UnlockResult = completeUnlock(derived);
+    secureZero(derived, sizeof(derived));
+    return false;
+}
+
+VAULT_UNLOCK_RESULT Salavat_::completeUnlock(const uint8_t derived[SHA1_HASH_LENGTH]) {
+    // С записью KDF секреты запечатаны ключом из PBKDF2, без нее - ключом из хеша пароля или XOR первой версии
+    uint8_t derivedKey[CHACHA20_KEY_LENGTH];
+    uint8_t hashKey[CHACHA20_KEY_LENGTH];
+    deriveSealKey(derived, SHA1_HASH_LENGTH, derivedKey);
+    deriveSealKey(this->PendingPasswordHash.data(), this->PendingPasswordHash.size(), hashKey);
+    const auto hasKdf = this->Kdf.iterations > 0;
+    const auto currentKey = hasKdf ? derivedKey : hashKey;
+
+    // Пароль проверяется по первой живой записи: запечатанный секрет тегом, секрет первой версии маркерами
+    std::size_t firstEntry = 0;
+    while (firstEntry < this->VaultEntries.size() && !this->VaultEntries.alive(firstEntry)){
+        firstEntry++;
+    }
+    auto valid = true;
+    if (firstEntry < this->VaultEntries.size()){
+        uint8_t plain[SECRET_PLAIN_MAX];
+        std::size_t plainLength = 0;
+        valid = openEntrySecret(this->VaultEntries[firstEntry], this->PendingPasswordHash, currentKey, plain, plainLength);
+        secureZero(plain, plainLength);
     }else{
-        return VAULT_UNLOCK_RESULT::INVALID_PASSWORD;
+        SendDebugMessage("Salavat: vault was empty");
+    }
+
+    if (valid){
+        this->VaultUnlocked = true;
+        this->MasterPasswordHash = this->PendingPasswordHash;
+        memcpy(this->SealKey, currentKey, sizeof(this->SealKey));
+        dropRekey();
+        if (!hasKdf){
+            memcpy(this->RekeyKey, derivedKey, sizeof(this->RekeyKey));
+            this->RekeyPending = true;
+        }
+        this->NonceCounter = micros();
+        this->Codes.clear();
+        this->PrecomputeCursor = 0;
+        this->LastKeyUse = millis();
     }
+    secureZero(derivedKey, sizeof(derivedKey));
+    secureZero(hashKey, sizeof(hashKey));
+    secureZero(this->PendingPasswordHash.data(), this->PendingPasswordHash.size());
+    this->PendingPasswordHash.clear();
+    return valid ? VAULT_UNLOCK_RESULT::SUCCESS : VAULT_UNLOCK_RESULT::INVALID_PASSWORD;
 }
 
-std::pair<VAULT_GET_KEY_RESULT, std::string> Salavat_::getKey(int entryId, long currentUtc) {
+VAULT_UNLOCK_RESULT Salavat_::unlockStatus() {
+    return this->UnlockResult;
+}
+
+unsigned Salavat_::unlockProgress() {
+    const auto total = this->KeyDerivation.iterations();
+    return total == 0 ? 100 : (unsigned)((uint64_t)this->KeyDerivation.completed() * 100 / total);
+}
+
+void Salavat_::dropRekey() {
+    secureZero(this->RekeyKey, sizeof(this->RekeyKey));
+    this->RekeyPending = false;
+}
+
+VAULT_GET_KEY_RESULT Salavat_::keysStatus() {
     if (!this->VaultInitialized){
-        return std::make_pair(VAULT_GET_KEY_RESULT::VAULT_NOT_INITIALIZED,std::string());
+        return VAULT_GET_KEY_RESULT::VAULT_NOT_INITIALIZED;
     }
     if (!this->VaultUnlocked){
-        return std::make_pair(VAULT_GET_KEY_RESULT::VAULT_IS_LOCKED,std::string());
+        return VAULT_GET_KEY_RESULT::VAULT_IS_LOCKED;
     }
-    if (this->VaultEntries.empty() || entryId >= VaultEntries.size() || entryId < 0){
+    return VAULT_GET_KEY_RESULT::SUCCESS;
+}
+
+std::pair<VAULT_GET_KEY_RESULT, std::string> Salavat_::getKey(int entryId, long currentUtc) {
+    auto status = keysStatus();
+    if (status != VAULT_GET_KEY_RESULT::SUCCESS){
+        return std::make_pair(status, std::string());
+    }
+    if (entryId < 0 || !VaultEntries.alive(entryId)){
         return std::make_pair(VAULT_GET_KEY_RESULT::NOT_FOUND, std::string());
     }
 
-    auto& unencryptedSecret = this->UnencryptedSecrets[entryId];
-    auto rawSecret = std::string(unencryptedSecret.begin(), unencryptedSecret.end());
+    noteHostTime(currentUtc);
 
-    SendDebugMessage("Current UTC", std::to_string(currentUtc).c_str());
-    SendDebugMessage("Current secret", rawSecret.c_str());
-    SendDebugMessage("Unencrypted secret length", std::to_string(unencryptedSecret.size()).c_str());
+    uint8_t counter[OTP_COUNTER_LENGTH];
+    totpCounter(currentUtc, counter);
 
-    TOTP totp(&unencryptedSecret.front(), (int)unencryptedSecret.size());
-    auto code = totp.getCode(currentUtc);
+    char code[OTP_CODE_MAX_LENGTH + 1];
+    if (!entryCode(entryId, totpStep(currentUtc), counter, code)){
+        return std::make_pair(VAULT_GET_KEY_RESULT::CORRUPTED, std::string());
+    }
 
-    return std::make_pair(VAULT_GET_KEY_RESULT::SUCCESS, std::string(code, code + 6));
+    auto result = std::make_pair(VAULT_GET_KEY_RESULT::SUCCESS, std::string(code));
+    secureZero(code, sizeof(code));
+    return result;
+}
+
+bool Salavat_::entryCode(std::size_t entryId, uint32_t step, const uint8_t counter[OTP_COUNTER_LENGTH], char out[OTP_CODE_MAX_LENGTH + 1]) {
+    this->LastKeyUse = millis();
+    if (this->Codes.find(entryId, step, out)){
+        return true;
+    }
+    if (!prepareKey(entryId)){
+        return false;
+    }
+    hotpCode(this->VaultEntries.key(entryId), counter, out, entryDigits(entryId));
+    this->Codes.store(entryId, step, out);
+    return true;
+}
+
+std::size_t Salavat_::entryDigits(std::size_t entryId) {
+    const auto digits = this->VaultEntries[entryId].digits;
+    return digits >= TOTP_KEY_DIGITS_MIN && digits <= TOTP_KEY_DIGITS_MAX ? digits : OTP_CODE_LENGTH;
+}
+
+bool Salavat_::prepareKey(std::size_t entryId) {
+    if (this->VaultEntries.prepared(entryId)){
+        return true;
+    }
+    // Пэды HMAC считаются один раз на запись, дальше каждый код стоит два сжатия SHA-1
+    uint8_t secret[SECRET_PLAIN_MAX];
+    std::size_t length = 0;
+    if (!openEntrySecret(this->VaultEntries[entryId], this->MasterPasswordHash, this->SealKey, secret, length)){
+        return false;
+    }
+    hmacSha1Prepare(secret, length, this->VaultEntries.key(entryId));
+    secureZero(secret, length);
+    this->VaultEntries.markPrepared(entryId);
+    return true;
+}
+
+std::size_t Salavat_::sealEntrySecret(const uint8_t key[CHACHA20_KEY_LENGTH], std::string_view name, const uint8_t * plain, std::size_t length, uint8_t * out) {
+    // Нонс: поколение и заполнение журнала растут с каждой записью, счетчик различает запечатывания в одном снимке
+    uint32_t words[3] = {Journal.generation(), (uint32_t)Journal.used(), this->NonceCounter++};
+    uint8_t nonce[CHACHA20_NONCE_LENGTH];
+    memcpy(nonce, words, sizeof(nonce));
+    return sealSecret(key, nonce, name, plain, length, out);
+}
+
+bool Salavat_::dropIdleKeys() {
+    if (!this->VaultUnlocked || !this->VaultEntries.anyPrepared() || millis() - this->LastKeyUse < this->KeyIdleTimeout){
+        return false;
+    }
+    // Хранилище остается разблокированным, следующий код подготовит ключ записи заново
+    this->VaultEntries.wipeKeys();
+    this->Codes.clear();
+    this->PrecomputeEnabled = false;
+    return false;
+}
+
+void Salavat_::setKeyIdleTimeout(unsigned long timeoutMillis) {
+    this->KeyIdleTimeout = timeoutMillis;
+}
+
+void Salavat_::lock() {
+    this->VaultUnlocked = false;
+    this->VaultEntries.wipeKeys();
+    if (!this->MasterPasswordHash.empty()){
+        secureZero(this->MasterPasswordHash.data(), this->MasterPasswordHash.size());
+    }
+    this->MasterPasswordHash.clear();
+    secureZero(this->SealKey, sizeof(this->SealKey));
+    dropRekey();
+    dropTransaction();
+
+    // Незаконченный вывод ключа прерывается
+    this->KeyDerivation.reset();
+    if (!this->PendingPasswordHash.empty()){
+        secureZero(this->PendingPasswordHash.data(), this->PendingPasswordHash.size());
+    }
+    this->PendingPasswordHash.clear();
+    this->UnlockResult = VAULT_UNLOCK_RESULT::LOCKED;
+    this->Codes.clear();
+    this->PrecomputeEnabled = false;
+}
+
+void Salavat_::noteHostTime(long currentUtc) {
+    const auto nextStep = totpStep(currentUtc) + 1;
+    if (this->PrecomputeEnabled && this->PrecomputeStep == nextStep){
+        return;
+    }
+    this->PrecomputeStep = nextStep;
+    this->PrecomputeCursor = 0;
+    this->PrecomputeEnabled = true;
+}
+
+bool Salavat_::precomputeNext() {
+    if (!this->PrecomputeEnabled || !this->VaultUnlocked){
+        return false;
+    }
+
+    while (this->PrecomputeCursor < this->VaultEntries.size()){
+        const auto entryId = this->PrecomputeCursor++;
+        if (!this->VaultEntries.alive(entryId)){
+            continue;
+        }
+        // Только записи, код которых запрашивали на текущем шаге: при сотнях записей кеш не забивается остальными
+        if (this->Codes.contains(entryId, this->PrecomputeStep) || !this->Codes.contains(entryId, this->PrecomputeStep - 1)){
+            continue;
+        }
+
+        uint8_t counter[OTP_COUNTER_LENGTH];
+        totpStepCounter(this->PrecomputeStep, counter);
+        char code[OTP_CODE_MAX_LENGTH + 1];
+        if (!prepareKey(entryId)){
+            return this->PrecomputeCursor < this->VaultEntries.size();
+        }
+        hotpCode(this->VaultEntries.key(entryId), counter, code, entryDigits(entryId));
+        this->Codes.store(entryId, this->PrecomputeStep, code);
+        secureZero(code, sizeof(code));
+
+        return this->PrecomputeCursor < this->VaultEntries.size();
+    }
+    return false;
+}
+
+const OtpCache & Salavat_::codeCache() const {
+    return this->Codes;
+}
+
+const VaultJournal & Salavat_::journal() const {
+    return this->Journal;
 }
 
 std::vector<uint8_t> Salavat_::_service_read_eeprom_header() {
@@ -229,100 +873,128 @@ std::vector<uint8_t> Salavat_::_service_read_eeprom_header() {
 }
 
 std::size_t Salavat_::secretsCount() {
-    return this->VaultEntries.size();
+    return this->VaultEntries.live();
 }
 
-std::vector<std::string> Salavat_::getEntryNames() {
-    std::vector<std::string> acc;
-    acc.reserve(this->VaultEntries.size()); // reserve для оптимизации push_back. Не путать с resize
-    for (const auto &item: this->VaultEntries){
-        acc.push_back(item.Name);
-    }
-    return acc;
+std::size_t Salavat_::entryIdCount() {
+    return this->VaultEntries.size();
 }
 
-std::vector<uint8_t> encryptSecret(const std::string & rawSecret, const std::vector<uint8_t> & secretKey) {
-    std::vector<uint8_t> result;
-    auto rawSecretDecoded = decodeBase32Secret(rawSecret);
-    result.resize(rawSecretDecoded.size() + 4);
-    result[0] = SECRET_LEFT_MARKER_0 ^ secretKey[0];
-    result[1] = SECRET_LEFT_MARKER_1 ^ secretKey[1];
-
-#ifdef KEECHAIN_DEBUG_ENABLED
-    auto hex = vectorToHex(rawSecretDecoded);
-    SendDebugMessage("Raw secret: ", hex.c_str());
-#endif
-
-    SendDebugMessage("Secret key: ", std::string(secretKey.begin(), secretKey.end()).c_str());
-
-    auto secretKeySize = secretKey.size();
-    auto rawSecretSize = rawSecretDecoded.size();
-    auto secretKeyIndex = 2;
+std::string_view Salavat_::entryName(std::size_t entryId) {
+    return this->VaultEntries.alive(entryId) ? this->VaultEntries[entryId].name : std::string_view();
+}
 
-    for(auto i = 0; i < rawSecretSize; i++ ){
-        result[i + 2] = rawSecretDecoded[i] ^ secretKey[secretKeyIndex];
-        secretKeyIndex = (secretKeyIndex + 1) % (int)secretKeySize;
+bool Salavat_::purgeTombstones() {
+    this->VaultEntries.purge();
+    this->Codes.clear();
+    this->PrecomputeCursor = 0;
+    if (compactJournal() == VAULT_JOURNAL_RESULT::SUCCESS && reloadEntries()){
+        return true;
     }
-    result[rawSecretSize + 2] = SECRET_RIGHT_MARKER_0 ^ secretKey[secretKeyIndex];
-    secretKeyIndex = (secretKeyIndex + 1) % (int)secretKeySize;
-    result[rawSecretSize + 3] = SECRET_RIGHT_MARKER_1 ^ secretKey[secretKeyIndex];
-
-    SendDebugMessage("Result length: ", std::to_string(result.size()).c_str());
 
-    return result;
+    // В журнале остались прежние идентификаторы, ключи таблицы им уже не соответствуют
+    reloadEntries();
+    lock();
+    return false;
 }
 
-std::vector<uint8_t> decryptSecretWithMarkers(const std::vector<uint8_t> & encryptedSecret, const std::vector<uint8_t> & secretKey){
-    auto bytes = encryptedSecret;
+bool Salavat_::compactIdle() {
+    // Во время транзакции ключ печати не должен смениться: накопленные секреты уже запечатаны им
+    if (!this->VaultInitialized || this->TransactionOpen){
+        return false;
+    }
 
-    SendDebugMessage("Salavat: encrypted secret: ", vectorToHex(bytes).c_str());
+    // Секреты первой версии и хранилище без записи KDF переводятся снимком, как только хранилище разблокировано
+    if ((this->LegacySecrets > 0 || this->RekeyPending) && this->VaultUnlocked){
+        if (compactJournal() != VAULT_JOURNAL_RESULT::SUCCESS || !reloadEntries()){
+            // Не повторять на каждом проходе: секреты перенесет следующее обычное уплотнение, ключ - следующая разблокировка
+            reloadEntries();
+            this->LegacySecrets = 0;
+            dropRekey();
+        }
+        return false;
+    }
 
-    std::vector<uint8_t> result;
-    result.resize(encryptedSecret.size());
-    auto secretKeyIndex = 0;
-    auto secretKeyLength = secretKey.size();
+    if (!this->IdleCompactionDue){
+        return false;
+    }
+    this->IdleCompactionDue = false;
 
-    for(auto i = 0; i < encryptedSecret.size(); i++){
-        result[i] = encryptedSecret[i] ^ secretKey[secretKeyIndex];
-        secretKeyIndex = (secretKeyIndex + 1) % (int)secretKeyLength;
+    if (!vaultIdleCompactionDue(Journal, this->SnapshotBytes, VAULT_IDLE_COMPACTION_RESERVE)){
+        return false;
     }
 
-    return result;
+    if (compactJournal() != VAULT_JOURNAL_RESULT::SUCCESS || !reloadEntries()){
+        // Прежний банк цел: надгробия и идентификаторы берутся из него заново
+        reloadEntries();
+    }
+    return false;
 }
 
-std::vector<uint8_t> decryptWithMasterKey(const std::vector<uint8_t> & encryptedSecret, const std::vector<uint8_t> & masterPassword){
-    auto raw = decryptSecretWithMarkers(encryptedSecret, masterPassword);
-    return std::vector<uint8_t>(raw.begin() + 2, raw.end() - 2);
+std::size_t Salavat_::findEntry(std::string_view name) {
+    return this->VaultEntries.find(name);
 }
 
-bool verifySecretKey(const std::vector<uint8_t> & encryptedSecret, const std::vector<uint8_t> & secretKey){
-    auto decrypted = decryptSecretWithMarkers(encryptedSecret, secretKey);
+static void deriveSealKey(const uint8_t * prk, std::size_t prkLength, uint8_t out[CHACHA20_KEY_LENGTH]) {
+    const auto infoLength = sizeof(SEAL_KEY_INFO) - 1;
+    uint8_t message[SHA1_HASH_LENGTH + sizeof(SEAL_KEY_INFO)];
+    uint8_t block[SHA1_HASH_LENGTH];
+    std::size_t previous = 0;
+    std::size_t produced = 0;
+    for (uint8_t counter = 1; produced < CHACHA20_KEY_LENGTH; counter++){
+        memcpy(message + previous, SEAL_KEY_INFO, infoLength);
+        message[previous + infoLength] = counter;
+        hmacSha1(prk, prkLength, message, previous + infoLength + 1, block);
+
+        const auto chunk = std::min(SHA1_HASH_LENGTH, CHACHA20_KEY_LENGTH - produced);
+        memcpy(out + produced, block, chunk);
+        produced += chunk;
+        memcpy(message, block, SHA1_HASH_LENGTH);
+        previous = SHA1_HASH_LENGTH;
+    }
+    secureZero(message, sizeof(message));
+    secureZero(block, sizeof(block));
+}
 
-    SendDebugMessage("Salavat: decrypted key with markers: ", vectorToHex(decrypted).c_str());
+static void makeKdfSalt(uint8_t out[VAULT_KDF_SALT_LENGTH]) {
+    // Серийный номер SAMD21 - четыре слова по адресам из раздела 10.3.3 документации
+    static const uintptr_t serialWords[] = {0x0080A00C, 0x0080A040, 0x0080A044, 0x0080A048};
+    Sha1Context sha;
+    sha.init();
+    for (auto address : serialWords){
+        const uint32_t word = *reinterpret_cast<const volatile uint32_t *>(address);
+        sha.update(reinterpret_cast<const uint8_t *>(&word), sizeof(word));
+    }
+    const uint32_t now[2] = {(uint32_t)micros(), (uint32_t)millis()};
+    sha.update(reinterpret_cast<const uint8_t *>(now), sizeof(now));
 
-    auto size = decrypted.size();
-    return size > 4
-            && decrypted[0] == SECRET_LEFT_MARKER_0
-            && decrypted[1] == SECRET_LEFT_MARKER_1
-            && decrypted[size - 2] == SECRET_RIGHT_MARKER_0
-            && decrypted[size - 1] == SECRET_RIGHT_MARKER_1;
+    uint8_t hash[SHA1_HASH_LENGTH];
+    sha.finish(hash);
+    memcpy(out, hash, VAULT_KDF_SALT_LENGTH);
+    secureZero(hash, sizeof(hash));
 }
 
-std::vector<uint8_t> decodeBase32Secret(std::string secret) {
-    Base32 base32;
-    byte* secretBytesPointer;
+static bool openEntrySecret(const VaultRecordEntry & entry, const std::vector<uint8_t> & passwordHash,
+                            const uint8_t sealKey[CHACHA20_KEY_LENGTH], uint8_t * out, std::size_t & length) {
+    if (entry.sealed){
+        return openSecret(sealKey, entry.secret, entry.name, out, length);
+    }
+    return openLegacySecret(entry.secret, passwordHash.data(), passwordHash.size(), out, length);
+}
 
-    auto length = base32.fromBase32(const_cast<byte *>(reinterpret_cast<const byte *>(secret.c_str())), secret.size(), secretBytesPointer);
-    return std::vector<uint8_t>(secretBytesPointer, secretBytesPointer + length);
+bool decodeBase32Secret(std::string_view secret, uint8_t out[TOTP_KEY_SECRET_MAX_BYTES], std::size_t & length) {
+    if (secret.size() > TOTP_KEY_SECRET_MAX_LENGTH){
+        length = 0;
+        return false;
+    }
+    return base32Decode(secret, out, TOTP_KEY_SECRET_MAX_BYTES, length) && length > 0;
 }
 
-std::string vectorToHex(std::vector<uint8_t> &vector) {
+std::string bytesToHex(const uint8_t * pointer, std::size_t length) {
     static const auto hex = "0123456789ABCDEF";
     std::string str;
-    auto pointer = vector.data();
-    auto length = vector.size();
 
-    for(auto i = 0; i < length; i++){
+    for(std::size_t i = 0; i < length; i++){
         str += (char)hex[pointer[i] / 16];
         str += (char)hex[pointer[i] % 16];
         str += " ";
@@ -4,13 +4,26 @@
 #ifndef KEECHAIN_SALAVAT_H_GUARD
 #define KEECHAIN_SALAVAT_H_GUARD
 #pragma once
+#include <Base32.h>
+#include <Cipher.h>
 #include <EnumReflection.h>
+#include <Otp.h>
+#include <VaultStorage.h>
 #include <string>
+#include <string_view>
 #include <vector>
 
-constexpr auto TOTP_KEYS_COUNT_LIMIT = 5;
+constexpr auto TOTP_KEYS_COUNT_LIMIT = 300;
+// Предел записей в EEPROM первой версии, для проверки при переносе
+constexpr auto TOTP_LEGACY_KEYS_COUNT_LIMIT = 5;
 constexpr auto TOTP_KEY_NAME_MAX_LENGTH = 20;
 constexpr auto TOTP_KEY_SECRET_MAX_LENGTH = 50;
+// Допустимое количество цифр кода записи, RFC 4226
+constexpr auto TOTP_KEY_DIGITS_MIN = 6;
+constexpr auto TOTP_KEY_DIGITS_MAX = 8;
+static_assert(TOTP_KEY_DIGITS_MAX <= OTP_CODE_MAX_LENGTH, "OTP code buffers must fit the longest entry code");
+// Наибольшая длина секрета в байтах после декодирования Base32
+constexpr auto TOTP_KEY_SECRET_MAX_BYTES = base32DecodedLength(TOTP_KEY_SECRET_MAX_LENGTH);
 constexpr auto TOTP_KEY_PASSWORD_MAX_LENGTH = 30;
 
 Z_ENUM_NS(
@@ -18,7 +31,9 @@ Z_ENUM_NS(
     SUCCESS,
     MALFORMED_PASSWORD,
     INVALID_PASSWORD,
-    NOT_INITIALIZED
+    NOT_INITIALIZED,
+    PENDING,
+    LOCKED
 )
 
 Z_ENUM_NS(
@@ -27,7 +42,10 @@ Z_ENUM_NS(
     VAULT_IS_LOCKED,
     NAME_LENGTH_EXCEEDED,
     SECRET_LENGTH_EXCEEDED,
-    NO_MORE_SPACE
+    NO_MORE_SPACE,
+    STORAGE_ERROR,
+    MALFORMED_SECRET,
+    INVALID_DIGITS
 )
 
 Z_ENUM_NS(
@@ -42,7 +60,19 @@ Z_ENUM_NS(
     VAULT_REMOVE_ENTRY_RESULT,
     SUCCESS,
     VAULT_IS_LOCKED,
-    NOT_FOUND
+    NOT_FOUND,
+    STORAGE_ERROR,
+    TRANSACTION_FULL
+)
+
+Z_ENUM_NS(
+    VAULT_TRANSACTION_RESULT,
+    SUCCESS,
+    VAULT_IS_LOCKED,
+    ALREADY_STARTED,
+    NOT_STARTED,
+    NO_MORE_SPACE,
+    STORAGE_ERROR
 )
 
 Z_ENUM_NS(
@@ -50,38 +80,267 @@ Z_ENUM_NS(
     VAULT_NOT_INITIALIZED,
     VAULT_IS_LOCKED,
     NOT_FOUND,
+    CORRUPTED,
     SUCCESS)
 
-struct VaultEntry
+// Флеш-память под журнал хранилища, на устройстве - область в памяти программы
+FlashDevice & vaultFlash();
+
+// Количество банков журнала, по которым распределяются стирания
+constexpr std::size_t VAULT_JOURNAL_BANKS = 3;
+
+// Через сколько миллисекунд без запросов кодов подготовленные ключи затираются, по умолчанию
+constexpr unsigned long VAULT_KEY_IDLE_TIMEOUT_MILLIS = 5ul * 60 * 1000;
+
+/*
+ * Итерации PBKDF2-HMAC-SHA1 для нового хранилища, хранятся в записи KDF журнала
+ * На SAMD21 итерация - два сжатия SHA-1, вывод занимает порядка секунды
+ */
+constexpr uint32_t VAULT_KDF_ITERATIONS = 20000;
+
+// Итераций за один вызов unlockNext(), чтобы кусок фоновой работы укладывался в бюджет главного цикла
+constexpr uint32_t VAULT_KDF_SLICE_ITERATIONS = 8;
+
+// Если в банке журнала осталось меньше места, он уплотняется в простое, а не посреди запроса
+constexpr std::size_t VAULT_IDLE_COMPACTION_RESERVE = 2048;
+
+// Наибольшее количество записей в одном addEntries(), все они пишутся одной записью журнала
+constexpr std::size_t VAULT_BATCH_MAX_ENTRIES = 8;
+
+// Длина записи в данных BATCH с самыми длинными именем и секретом
+constexpr std::size_t VAULT_BATCH_ENTRY_MAX =
+    (3 + TOTP_KEY_NAME_MAX_LENGTH + TOTP_KEY_SECRET_MAX_BYTES + SEALED_SECRET_OVERHEAD + FLASH_WORD_SIZE - 1) / FLASH_WORD_SIZE * FLASH_WORD_SIZE;
+
+// Сколько новых записей и удалений может накопить одна транзакция
+constexpr std::size_t VAULT_TRANSACTION_MAX_ADDS = 16;
+constexpr std::size_t VAULT_TRANSACTION_MAX_REMOVES = 32;
+
+// Новая запись для addEntries(), секрет в Base32
+struct VaultNewEntry
 {
-    std::string Name;
-    std::vector<uint8_t> Secret;
-    int Digits;
+    std::string_view name;
+    std::string_view secret;
+    int digits = 6;
 };
 
 class Salavat_{
 public:
     VAULT_ADD_ENTRY_RESULT addEntry(const std::string & name, const std::string & rawSecret, int digitsCount);
+
+    /*
+     * Добавить до VAULT_BATCH_MAX_ENTRIES записей одной записью журнала: сохраняются все или ни одной
+     * Все записи проверяются и запечатываются до записи во флеш, failed - номер записи, не прошедшей проверку
+     */
+    VAULT_ADD_ENTRY_RESULT addEntries(const VaultNewEntry * entries, std::size_t count, std::size_t & failed);
+
+    /*
+     * Начать транзакцию: до commitTransaction() добавления и удаления только копятся в ОЗУ,
+     * журнал и идентификаторы не меняются. Сбой до фиксации оставляет хранилище прежним
+     */
+    VAULT_TRANSACTION_RESULT beginTransaction();
+
+    // Записать накопленное одной записью журнала: все изменения или ни одного. Транзакция закрывается в любом случае
+    VAULT_TRANSACTION_RESULT commitTransaction();
+
+    // Отбросить накопленные изменения
+    VAULT_TRANSACTION_RESULT rollbackTransaction();
     VAULT_REMOVE_ENTRY_RESULT removeEntry(int entryId);
     std::pair<VAULT_GET_KEY_RESULT, std::string> getKey(int entryId, long currentUtc);
+
+    // Готово ли хранилище выдавать коды: SUCCESS, VAULT_NOT_INITIALIZED или VAULT_IS_LOCKED
+    VAULT_GET_KEY_RESULT keysStatus();
+
+    /*
+     * Коды всех записей на момент currentUtc за один проход
+     * Счетчик TOTP собирается один раз, sink вызывается с кодом каждой записи по порядку
+     */
+    template<typename Sink>
+    VAULT_GET_KEY_RESULT generateAll(long currentUtc, Sink && sink);
+
+    // Заблокировать хранилище: подготовленные ключи, хеш пароля и кеш кодов затираются
+    void lock();
+
+    // Кеш кодов, для статистики попаданий
+    const OtpCache & codeCache() const;
+
+    // Журнал хранилища, для отчета об износе
+    const VaultJournal & journal() const;
+
+    /*
+     * Заранее посчитать код следующего шага для одной записи, по последнему времени от хоста
+     * true, если работа еще осталась. Один вызов - не больше одного расчета HMAC
+     */
+    bool precomputeNext();
+
+    /*
+     * Уплотнить журнал в простое, если в нем накопилось много удаленных записей или кончается место
+     * Идентификаторы записей при этом не меняются. Возвращает false: одно уплотнение за вызов
+     */
+    bool compactIdle();
+
+    /*
+     * Затереть подготовленные ключи, если коды не запрашивались дольше заданного времени простоя
+     * Хранилище остается разблокированным. Возвращает false: работа делается за один вызов
+     */
+    bool dropIdleKeys();
+
+    // Время простоя, после которого dropIdleKeys() затирает ключи
+    void setKeyIdleTimeout(unsigned long timeoutMillis);
     void ForceReset();
     VAULT_INIT_RESULT Initialize();
-    VAULT_UNLOCK_RESULT unlock(const std::string & password);
+    /*
+     * Начать разблокировку: PENDING, если пароль принят к проверке. Ключ выводится по кускам в unlockNext(),
+     * хранилище до конца вывода остается в прежнем состоянии
+     */
+    VAULT_UNLOCK_RESULT beginUnlock(const std::string & password);
+
+    // Продвинуть вывод ключа на VAULT_KDF_SLICE_ITERATIONS итераций. true, если работа еще осталась
+    bool unlockNext();
+
+    // PENDING во время вывода, затем итог последней разблокировки. LOCKED после блокировки
+    VAULT_UNLOCK_RESULT unlockStatus();
+
+    // Готовность вывода ключа в процентах
+    unsigned unlockProgress();
     std::vector<uint8_t> _service_read_eeprom_header();
+    // Количество живых записей
     std::size_t secretsCount();
-    std::vector<std::string> getEntryNames();
+
+    // Количество идентификаторов записей, включая удаленные: GET_ENTRIES и GENERATE_ALL отдают столько частей
+    std::size_t entryIdCount();
+
+    // Название записи, представление в образ флеш-памяти. Пустое для удаленной и несуществующей записи
+    std::string_view entryName(std::size_t entryId);
+
+    // Идентификатор записи с именем name, entryIdCount() если такой нет. O(log n) по индексу имен
+    std::size_t findEntry(std::string_view name);
+
+    // Записи, имена которых начинаются с prefix, в порядке имен: sink(entryId, name) для каждой
+    template<typename Sink>
+    void findEntries(std::string_view prefix, Sink && sink);
 private:
     /*
-     * Прожиг состояния хранилища на плату
-     * Использовать с осторожностью! Тратит ресурс микросхемы памяти
+     * Расшифровать секрет записи и подготовить ключ HMAC, если это еще не сделано после разблокировки
+     * false, если секрет не открылся: тег или маркеры не сошлись
+     */
+    bool prepareKey(std::size_t entryId);
+
+    // Проверить и запечатать записи в буфер транзакции: все или ни одной
+    VAULT_ADD_ENTRY_RESULT stageEntries(const VaultNewEntry * entries, std::size_t count, std::size_t & failed);
+
+    // Закрыть транзакцию и затереть накопленные ключи
+    void dropTransaction();
+
+    /*
+     * Проверить новую запись, запечатать ее секрет в sealed и подготовить ключ HMAC
+     * entry ссылается на имя из newEntry и на sealed
      */
-    void burnVaultEntries();
+    VAULT_ADD_ENTRY_RESULT sealNewEntry(const VaultNewEntry & newEntry, uint8_t sealed[TOTP_KEY_SECRET_MAX_BYTES + SEALED_SECRET_OVERHEAD],
+                                        VaultRecordEntry & entry, HmacSha1Key & key);
+
+    // Запечатать секрет записи с именем name ключом key и новым нонсом, возвращает длину в out
+    std::size_t sealEntrySecret(const uint8_t key[CHACHA20_KEY_LENGTH], std::string_view name, const uint8_t * plain, std::size_t length, uint8_t * out);
+
+    // Код записи entryId для шага step: из кеша, иначе расчет и сохранение в кеш. false, если секрет испорчен
+    bool entryCode(std::size_t entryId, uint32_t step, const uint8_t counter[OTP_COUNTER_LENGTH], char out[OTP_CODE_MAX_LENGTH + 1]);
+
+    // Количество цифр кода записи. Записи, сохраненные до проверки количества цифр, дают OTP_CODE_LENGTH, как раньше
+    std::size_t entryDigits(std::size_t entryId);
+
+    /*
+     * Дописать изменение в журнал. Если банк заполнен, журнал уплотняется снимком VaultEntries,
+     * поэтому удаление в памяти делается до вызова, а добавленная запись попадает в таблицу только здесь
+     */
+    VAULT_JOURNAL_RESULT persist(uint8_t type, std::string_view payload);
+
+    // Снимок всех записей и, если заданы, новых записей added (SEALED, BATCH или TRANSACTION) в свободный банк журнала
+    VAULT_JOURNAL_RESULT compactJournal(uint8_t addedType = 0, std::string_view added = {});
+
+    // Проверить пароль по выведенному ключу и разблокировать хранилище
+    VAULT_UNLOCK_RESULT completeUnlock(const uint8_t derived[SHA1_HASH_LENGTH]);
+
+    // Отменить переход на ключ из PBKDF2 и затереть новый ключ
+    void dropRekey();
+
+    // Разобрать записи и параметры KDF из активного банка журнала. false, если хранилище повреждено
+    bool reloadEntries();
+
+    // Пересчитать SnapshotBytes по таблице записей и параметрам KDF
+    void recountSnapshot();
+
+    /*
+     * Кончились идентификаторы: убрать надгробия, переписав журнал. Идентификаторы записей меняются.
+     * При сбое хранилище блокируется, потому что ключи таблицы уже переставлены
+     */
+    bool purgeTombstones();
+
+    // Размер снимка живых записей и надгробий: сколько займет журнал после уплотнения. Пересчитывается после каждого изменения
+    std::size_t SnapshotBytes = 0;
+
+    // Журнал изменялся после последней проверки в простое
+    bool IdleCompactionDue = false;
 
-    std::vector<VaultEntry> VaultEntries;
+    // Живые записи с секретом первой версии (XOR), переносятся снимком после разблокировки
+    std::size_t LegacySecrets = 0;
 
+    // Время последнего запроса кода по millis() и время простоя до затирания ключей
+    unsigned long LastKeyUse = 0;
+    unsigned long KeyIdleTimeout = VAULT_KEY_IDLE_TIMEOUT_MILLIS;
+
+    // Перенос записей из EEPROM первой версии в журнал. false, если в EEPROM нет хранилища
+    bool importLegacyEeprom(VAULT_INIT_RESULT & result);
+
+    VaultJournal Journal{vaultFlash(), VAULT_JOURNAL_BANKS};
+
+    /*
+     * Записи: смещения в образ журнала и ключи HMAC, подготовленные при первом коде записи, в статической таблице
+     * Имя и зашифрованный секрет не копируются в кучу, расшифрованные секреты не хранятся
+     */
+    VaultEntryTable<TOTP_KEYS_COUNT_LIMIT> VaultEntries{vaultFlash()};
+
+    // Хеш пароля нужен для секретов первой версии, ключ ChaCha20 выводится из него при разблокировке
     std::vector<uint8_t> MasterPasswordHash;
+    uint8_t SealKey[CHACHA20_KEY_LENGTH]{};
 
-    std::vector<std::vector<uint8_t>> UnencryptedSecrets;
+    // Третье слово нонса, начинается со случайного значения micros() при разблокировке
+    uint32_t NonceCounter = 0;
+
+    // Параметры KDF из журнала, iterations == 0 - хранилище еще не переведено на PBKDF2
+    VaultKdfParams Kdf{};
+
+    // Разблокировка в процессе: параметры, вывод ключа и хеш пароля до проверки
+    VaultKdfParams PendingKdf{};
+    Pbkdf2Sha1 KeyDerivation;
+    std::vector<uint8_t> PendingPasswordHash;
+    VAULT_UNLOCK_RESULT UnlockResult = VAULT_UNLOCK_RESULT::LOCKED;
+
+    // Ключ из PBKDF2 для хранилища без записи KDF: снимок перепечатает им секреты и запишет параметры
+    uint8_t RekeyKey[CHACHA20_KEY_LENGTH]{};
+    bool RekeyPending = false;
+
+    /*
+     * Открытая транзакция. Новые записи лежат в формате данных BATCH после места под заголовок TRANSACTION,
+     * заголовок с удалениями пишется перед ними при фиксации, чтобы запись журнала не копировать
+     */
+    static constexpr std::size_t TRANSACTION_HEADER_MAX = vaultTransactionHeaderSize(VAULT_TRANSACTION_MAX_REMOVES);
+    bool TransactionOpen = false;
+    uint8_t StagedRecord[TRANSACTION_HEADER_MAX + VAULT_TRANSACTION_MAX_ADDS * VAULT_BATCH_ENTRY_MAX]{};
+    std::size_t StagedLength = 0;
+    HmacSha1Key StagedKeys[VAULT_TRANSACTION_MAX_ADDS]{};
+    std::size_t StagedAdds = 0;
+    uint16_t StagedRemoves[VAULT_TRANSACTION_MAX_REMOVES]{};
+    std::size_t StagedRemoveCount = 0;
+
+    // Коды текущего и следующего шага, сбрасываются при любом изменении набора записей и при блокировке
+    OtpCache Codes;
+
+    // Запомнить время от хоста, чтобы в простое считать коды следующего шага
+    void noteHostTime(long currentUtc);
+
+    // Шаг, коды которого считаются в простое, и следующая запись для него
+    uint32_t PrecomputeStep = 0;
+    std::size_t PrecomputeCursor = 0;
+    bool PrecomputeEnabled = false;
 
     bool VaultUnlocked = false;
 
@@ -89,8 +348,60 @@ private:
     bool VaultInitialized = false;
 };
 
-std::vector<uint8_t> decodeBase32Secret(std::string secret);
+template<typename Sink>
+VAULT_GET_KEY_RESULT Salavat_::generateAll(long currentUtc, Sink && sink)
+{
+    auto status = keysStatus();
+    if (status != VAULT_GET_KEY_RESULT::SUCCESS){
+        return status;
+    }
+
+    noteHostTime(currentUtc);
+
+    const auto step = totpStep(currentUtc);
+    uint8_t counter[OTP_COUNTER_LENGTH];
+    totpCounter(currentUtc, counter);
+
+    char code[OTP_CODE_MAX_LENGTH + 1];
+    for (std::size_t entryId = 0; entryId < this->VaultEntries.size(); entryId++){
+        // Удаленная запись занимает пустую часть, чтобы коды совпадали с идентификаторами
+        if (!this->VaultEntries.alive(entryId)){
+            sink(std::string_view());
+            continue;
+        }
+        // Запись с испорченным секретом тоже отдает пустую часть
+        if (!entryCode(entryId, step, counter, code)){
+            sink(std::string_view());
+            continue;
+        }
+        sink(std::string_view(code));
+    }
+    secureZero(code, sizeof(code));
+
+    return VAULT_GET_KEY_RESULT::SUCCESS;
+}
+
+template<typename Sink>
+void Salavat_::findEntries(std::string_view prefix, Sink && sink)
+{
+    for (auto rank = this->VaultEntries.lowerBound(prefix); rank < this->VaultEntries.indexed(); rank++){
+        const auto entryId = this->VaultEntries.byName(rank);
+        const auto name = this->VaultEntries[entryId].name;
+        if (name.substr(0, prefix.size()) != prefix){
+            return;
+        }
+        if (this->VaultEntries.alive(entryId)){
+            sink(entryId, name);
+        }
+    }
+}
+
+/*
+ * Секрет из Base32 в out емкостью TOTP_KEY_SECRET_MAX_BYTES, длина в length
+ * false, если строка не Base32, длиннее TOTP_KEY_SECRET_MAX_LENGTH или пуста после декодирования
+ */
+bool decodeBase32Secret(std::string_view secret, uint8_t out[TOTP_KEY_SECRET_MAX_BYTES], std::size_t & length);
 
-std::string vectorToHex(std::vector<uint8_t> & vector);
+std::string bytesToHex(const uint8_t * bytes, std::size_t length);
 
 #endif //KEECHAIN_SALAVAT_H_GUARD
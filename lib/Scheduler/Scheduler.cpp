@@ -0,0 +1,56 @@
+// (c) 2024 Takhir Latypov <cregennandev@gmail.com>
+// MIT License
+
+#include "Scheduler.h"
+
+void schedulerNoIdle()
+{
+}
+
+void Scheduler_::onEvent(SchedulerEventSource source, SchedulerEventHandler handler)
+{
+    eventSource = source;
+    eventHandler = handler;
+}
+
+bool Scheduler_::addTask(SchedulerTask task)
+{
+    if (task == nullptr || tasksCount == SCHEDULER_MAX_TASKS)
+    {
+        return false;
+    }
+    tasks[tasksCount++] = task;
+    return true;
+}
+
+void Scheduler_::setIdleHook(SchedulerIdleHook hook)
+{
+    idleHook = hook != nullptr ? hook : schedulerNoIdle;
+}
+
+void Scheduler_::run()
+{
+    auto hasEvents = [this]{ return eventSource != nullptr && eventSource(); };
+
+    while (hasEvents())
+    {
+        eventHandler();
+    }
+
+    auto busy = false;
+    for (std::size_t i = 0; i < tasksCount; i++)
+    {
+        busy |= tasks[i]();
+
+        // Входящий запрос важнее фоновой работы
+        if (hasEvents())
+        {
+            return;
+        }
+    }
+
+    if (!busy)
+    {
+        idleHook();
+    }
+}
@@ -0,0 +1,54 @@
+// (c) 2024 Takhir Latypov <cregennandev@gmail.com>
+// MIT License
+
+#ifndef KEECHAIN_SCHEDULER_H_GUARD
+#define KEECHAIN_SCHEDULER_H_GUARD
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+// Максимальное количество фоновых задач
+static constexpr std::size_t SCHEDULER_MAX_TASKS = 8;
+
+// Источник событий, true если есть входящие данные и спать нельзя
+typedef bool (*SchedulerEventSource)();
+
+// Обработчик событий, вызывается подряд, пока источник сообщает о данных
+typedef void (*SchedulerEventHandler)();
+
+// Фоновая задача, выполняет небольшой кусок работы. true, если работа еще осталась
+typedef bool (*SchedulerTask)();
+
+// Ожидание в простое, например __WFI() на SAMD
+typedef void (*SchedulerIdleHook)();
+
+// Пустой обработчик простоя для хостовых сборок
+void schedulerNoIdle();
+
+/*
+ * Главный цикл без фиксированных задержек
+ * Входящие данные обрабатываются сразу, затем по одному проходу каждой фоновой
+ * задачи. Если ни данных, ни работы нет, вызывается обработчик простоя
+ */
+class Scheduler_
+{
+    public:
+        void onEvent(SchedulerEventSource source, SchedulerEventHandler handler);
+
+        // false, если задач уже SCHEDULER_MAX_TASKS
+        bool addTask(SchedulerTask task);
+
+        void setIdleHook(SchedulerIdleHook hook);
+
+        // Один проход главного цикла
+        void run();
+    private:
+        SchedulerEventSource eventSource = nullptr;
+        SchedulerEventHandler eventHandler = nullptr;
+        std::array<SchedulerTask, SCHEDULER_MAX_TASKS> tasks{};
+        std::size_t tasksCount = 0;
+        SchedulerIdleHook idleHook = schedulerNoIdle;
+};
+
+#endif // Guard
@@ -0,0 +1,559 @@
+// (c) 2024 Takhir Latypov <cregennandev@gmail.com>
+// MIT License
+
+#include "VaultStorage.h"
+#include <Packet.h>
+#include <cstring>
+
+static constexpr uint8_t BANK_MAGIC[4] = {'K', 'C', 'V', 'J'};
+static constexpr uint8_t BANK_VERSION = 1;
+static constexpr std::size_t BANK_CRC_OFFSET = 6;
+static constexpr std::size_t BANK_SEQUENCE_OFFSET = 8;
+static constexpr std::size_t BANK_ERASES_OFFSET = 12;
+static constexpr std::size_t BANK_COMMIT_OFFSET = 16;
+static constexpr uint32_t BANK_COMMITTED = 0;
+
+static uint32_t readLe32(const uint8_t * data)
+{
+    return (uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+static void writeLe32(uint8_t * data, uint32_t value)
+{
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+    data[2] = (uint8_t)(value >> 16);
+    data[3] = (uint8_t)(value >> 24);
+}
+
+// CRC заголовка банка: все поля, кроме самой CRC и признака завершения
+static uint16_t bankHeaderCrc(const uint8_t * header)
+{
+    auto crc = packetCrc16(header, BANK_CRC_OFFSET);
+    return packetCrc16(header + BANK_SEQUENCE_OFFSET, BANK_COMMIT_OFFSET - BANK_SEQUENCE_OFFSET, crc);
+}
+
+VaultJournal::VaultJournal(FlashDevice & flash, std::size_t banks)
+    : flash(flash), banks(banks < 2 ? 2 : banks > VAULT_JOURNAL_MAX_BANKS ? VAULT_JOURNAL_MAX_BANKS : banks)
+{
+}
+
+VAULT_JOURNAL_RESULT VaultJournal::open()
+{
+    opened = false;
+    tailDirty = false;
+
+    auto found = false;
+    for (std::size_t bank = 0; bank < banks; bank++)
+    {
+        uint32_t bankSequence;
+        bool committed;
+        if (!readBankHeader(bank, bankSequence, erases[bank], committed))
+        {
+            erases[bank] = 0;
+            continue;
+        }
+
+        // Поколения сравниваются с учетом переполнения счетчика
+        if (committed && (!found || (int32_t)(bankSequence - sequence) > 0))
+        {
+            found = true;
+            activeBank = bank;
+            sequence = bankSequence;
+        }
+    }
+
+    if (!found)
+    {
+        return VAULT_JOURNAL_RESULT::EMPTY;
+    }
+
+    const auto end = bankOffset(activeBank) + bankSize();
+    auto offset = bankOffset(activeBank) + VAULT_JOURNAL_BANK_HEADER_SIZE;
+    uint8_t type;
+    std::string_view payload;
+    std::size_t next;
+    while (offset < end && readRecord(offset, type, payload, next))
+    {
+        offset = next;
+    }
+    writeOffset = offset;
+    lastOffset = 0;
+
+    const auto image = flash.image();
+    for (auto i = offset; i < end; i++)
+    {
+        if (image[i] != FLASH_ERASED_BYTE)
+        {
+            tailDirty = true;
+            break;
+        }
+    }
+
+    opened = true;
+    return VAULT_JOURNAL_RESULT::SUCCESS;
+}
+
+VAULT_JOURNAL_RESULT VaultJournal::format()
+{
+    opened = false;
+    if (!flash.erase(0, banks * bankSize()))
+    {
+        return VAULT_JOURNAL_RESULT::FLASH_ERROR;
+    }
+    for (std::size_t bank = 0; bank < banks; bank++)
+    {
+        erases[bank]++;
+    }
+
+    activeBank = 0;
+    sequence++;
+    auto result = writeBankHeader(activeBank, sequence);
+    if (result == VAULT_JOURNAL_RESULT::SUCCESS)
+    {
+        result = commitBank(activeBank);
+    }
+    if (result != VAULT_JOURNAL_RESULT::SUCCESS)
+    {
+        return result;
+    }
+
+    writeOffset = bankOffset(activeBank) + VAULT_JOURNAL_BANK_HEADER_SIZE;
+    lastOffset = 0;
+    tailDirty = false;
+    opened = true;
+    return VAULT_JOURNAL_RESULT::SUCCESS;
+}
+
+VAULT_JOURNAL_RESULT VaultJournal::append(uint8_t type, std::string_view payload)
+{
+    if (!opened)
+    {
+        auto result = format();
+        if (result != VAULT_JOURNAL_RESULT::SUCCESS)
+        {
+            return result;
+        }
+    }
+    if (payload.size() > UINT16_MAX || recordSize(payload.size()) > bankSize() - VAULT_JOURNAL_BANK_HEADER_SIZE)
+    {
+        return VAULT_JOURNAL_RESULT::TOO_LARGE;
+    }
+    if (tailDirty || !fits(payload.size()))
+    {
+        return VAULT_JOURNAL_RESULT::FULL;
+    }
+    return write(activeBank, type, payload);
+}
+
+std::string_view VaultJournal::lastPayload() const
+{
+    uint8_t type;
+    std::string_view payload;
+    std::size_t next;
+    if (!opened || lastOffset == 0 || !readRecord(lastOffset, type, payload, next))
+    {
+        return {};
+    }
+    return payload;
+}
+
+bool VaultJournal::fits(std::size_t payloadLength) const
+{
+    return opened && writeOffset + recordSize(payloadLength) <= bankOffset(activeBank) + bankSize();
+}
+
+std::size_t VaultJournal::recordSize(std::size_t payloadLength)
+{
+    const auto size = VAULT_JOURNAL_RECORD_HEADER_SIZE + payloadLength + VAULT_JOURNAL_RECORD_TRAILER_SIZE;
+    return (size + FLASH_WORD_SIZE - 1) / FLASH_WORD_SIZE * FLASH_WORD_SIZE;
+}
+
+std::size_t VaultJournal::bankSize() const
+{
+    const auto rows = flash.size() / flash.rowSize() / banks;
+    return rows * flash.rowSize();
+}
+
+std::size_t VaultJournal::bankCount() const
+{
+    return banks;
+}
+
+uint32_t VaultJournal::bankErases(std::size_t bank) const
+{
+    return bank < banks ? erases[bank] : 0;
+}
+
+std::size_t VaultJournal::used() const
+{
+    return opened ? writeOffset - bankOffset(activeBank) : 0;
+}
+
+uint32_t VaultJournal::generation() const
+{
+    return sequence;
+}
+
+std::size_t VaultJournal::bankOffset(std::size_t bank) const
+{
+    return bank * bankSize();
+}
+
+std::size_t VaultJournal::spareBank() const
+{
+    return (activeBank + 1) % banks;
+}
+
+bool VaultJournal::readBankHeader(std::size_t bank, uint32_t & bankSequence, uint32_t & bankErases, bool & committed) const
+{
+    const auto header = flash.image() + bankOffset(bank);
+    if (memcmp(header, BANK_MAGIC, sizeof(BANK_MAGIC)) != 0 || header[4] != BANK_VERSION)
+    {
+        return false;
+    }
+    const auto crc = (uint16_t)(header[BANK_CRC_OFFSET] | header[BANK_CRC_OFFSET + 1] << 8);
+    if (crc != bankHeaderCrc(header))
+    {
+        return false;
+    }
+    bankSequence = readLe32(header + BANK_SEQUENCE_OFFSET);
+    bankErases = readLe32(header + BANK_ERASES_OFFSET);
+    committed = readLe32(header + BANK_COMMIT_OFFSET) == BANK_COMMITTED;
+    return true;
+}
+
+bool VaultJournal::readRecord(std::size_t offset, uint8_t & type, std::string_view & payload, std::size_t & next) const
+{
+    const auto end = (offset / bankSize() + 1) * bankSize();
+    if (offset + VAULT_JOURNAL_RECORD_HEADER_SIZE > end)
+    {
+        return false;
+    }
+
+    const auto record = flash.image() + offset;
+    if (record[0] == VAULT_JOURNAL_END)
+    {
+        return false;
+    }
+
+    const std::size_t length = record[2] | record[3] << 8;
+    next = offset + recordSize(length);
+    if (next > end)
+    {
+        return false;
+    }
+
+    const auto crcOffset = VAULT_JOURNAL_RECORD_HEADER_SIZE + length;
+    const auto crc = (uint16_t)(record[crcOffset] << 8 | record[crcOffset + 1]);
+    if (crc != packetCrc16(record, crcOffset))
+    {
+        return false;
+    }
+
+    type = record[0];
+    payload = std::string_view(reinterpret_cast<const char *>(record + VAULT_JOURNAL_RECORD_HEADER_SIZE), length);
+    return true;
+}
+
+VAULT_JOURNAL_RESULT VaultJournal::writeBankHeader(std::size_t bank, uint32_t bankSequence)
+{
+    uint8_t header[BANK_COMMIT_OFFSET];
+    memcpy(header, BANK_MAGIC, sizeof(BANK_MAGIC));
+    header[4] = BANK_VERSION;
+    header[5] = FLASH_ERASED_BYTE;
+    writeLe32(header + BANK_SEQUENCE_OFFSET, bankSequence);
+    writeLe32(header + BANK_ERASES_OFFSET, erases[bank]);
+    const auto crc = bankHeaderCrc(header);
+    header[BANK_CRC_OFFSET] = (uint8_t)crc;
+    header[BANK_CRC_OFFSET + 1] = (uint8_t)(crc >> 8);
+
+    return flash.program(bankOffset(bank), header, sizeof(header)) ? VAULT_JOURNAL_RESULT::SUCCESS : VAULT_JOURNAL_RESULT::FLASH_ERROR;
+}
+
+VAULT_JOURNAL_RESULT VaultJournal::commitBank(std::size_t bank)
+{
+    uint8_t commit[4];
+    writeLe32(commit, BANK_COMMITTED);
+    return flash.program(bankOffset(bank) + BANK_COMMIT_OFFSET, commit, sizeof(commit)) ? VAULT_JOURNAL_RESULT::SUCCESS : VAULT_JOURNAL_RESULT::FLASH_ERROR;
+}
+
+VAULT_JOURNAL_RESULT VaultJournal::beginCompaction()
+{
+    if (!opened)
+    {
+        auto result = format();
+        if (result != VAULT_JOURNAL_RESULT::SUCCESS)
+        {
+            return result;
+        }
+    }
+
+    const auto spare = spareBank();
+    if (!flash.erase(bankOffset(spare), bankSize()))
+    {
+        return VAULT_JOURNAL_RESULT::FLASH_ERROR;
+    }
+    erases[spare]++;
+    spareOffset = bankOffset(spare) + VAULT_JOURNAL_BANK_HEADER_SIZE;
+    return writeBankHeader(spare, sequence + 1);
+}
+
+VAULT_JOURNAL_RESULT VaultJournal::finishCompaction()
+{
+    const auto spare = spareBank();
+    auto result = commitBank(spare);
+    if (result != VAULT_JOURNAL_RESULT::SUCCESS)
+    {
+        return result;
+    }
+
+    activeBank = spare;
+    sequence++;
+    writeOffset = spareOffset;
+    lastOffset = 0;
+    tailDirty = false;
+    return VAULT_JOURNAL_RESULT::SUCCESS;
+}
+
+VAULT_JOURNAL_RESULT VaultJournal::write(std::size_t bank, uint8_t type, std::string_view payload)
+{
+    auto & offset = bank == activeBank ? writeOffset : spareOffset;
+    const auto size = recordSize(payload.size());
+    if (offset + size > bankOffset(bank) + bankSize())
+    {
+        return VAULT_JOURNAL_RESULT::FULL;
+    }
+
+    // Запись собирается по словам на стеке, чтобы не держать во флеш-памяти недописанный заголовок
+    uint8_t chunk[64];
+    std::size_t position = 0;
+    std::size_t written = 0;
+    auto crc = (uint16_t)0xFFFF;
+
+    auto put = [&](const uint8_t * bytes, std::size_t length, bool checksum){
+        if (checksum)
+        {
+            crc = packetCrc16(bytes, length, crc);
+        }
+        while (length > 0)
+        {
+            const auto part = length < sizeof(chunk) - position ? length : sizeof(chunk) - position;
+            memcpy(chunk + position, bytes, part);
+            position += part;
+            bytes += part;
+            length -= part;
+            if (position == sizeof(chunk))
+            {
+                if (!flash.program(offset + written, chunk, position))
+                {
+                    return false;
+                }
+                written += position;
+                position = 0;
+            }
+        }
+        return true;
+    };
+
+    const uint8_t header[VAULT_JOURNAL_RECORD_HEADER_SIZE] = {
+        type, FLASH_ERASED_BYTE, (uint8_t)payload.size(), (uint8_t)(payload.size() >> 8)
+    };
+    auto ok = put(header, sizeof(header), true)
+           && put(reinterpret_cast<const uint8_t *>(payload.data()), payload.size(), true);
+
+    const uint8_t trailer[VAULT_JOURNAL_RECORD_TRAILER_SIZE] = {(uint8_t)(crc >> 8), (uint8_t)crc};
+    const uint8_t padding[FLASH_WORD_SIZE] = {FLASH_ERASED_BYTE, FLASH_ERASED_BYTE, FLASH_ERASED_BYTE, FLASH_ERASED_BYTE};
+    ok = ok && put(trailer, sizeof(trailer), false)
+            && put(padding, size - written - position, false);
+
+    if (ok && position > 0)
+    {
+        ok = flash.program(offset + written, chunk, position);
+    }
+    if (!ok)
+    {
+        // Оборванную запись нельзя дописывать, журнал уплотнится при следующем изменении
+        if (bank == activeBank)
+        {
+            tailDirty = true;
+        }
+        return VAULT_JOURNAL_RESULT::FLASH_ERROR;
+    }
+
+    if (bank == activeBank)
+    {
+        lastOffset = offset;
+    }
+    offset += size;
+    return VAULT_JOURNAL_RESULT::SUCCESS;
+}
+
+std::size_t encodeVaultEntry(const VaultRecordEntry & entry, uint8_t out[VAULT_RECORD_ENTRY_MAX])
+{
+    if (entry.name.size() > UINT8_MAX || entry.secret.size() > UINT8_MAX)
+    {
+        return 0;
+    }
+
+    std::size_t length = 0;
+    out[length++] = (uint8_t)entry.name.size();
+    memcpy(out + length, entry.name.data(), entry.name.size());
+    length += entry.name.size();
+    out[length++] = (uint8_t)entry.secret.size();
+    memcpy(out + length, entry.secret.data(), entry.secret.size());
+    length += entry.secret.size();
+    out[length++] = entry.digits;
+    return length;
+}
+
+bool decodeVaultEntry(std::string_view payload, VaultRecordEntry & out)
+{
+    if (payload.empty())
+    {
+        return false;
+    }
+    const auto nameLength = (uint8_t)payload[0];
+    if (payload.size() < 1u + nameLength + 1u)
+    {
+        return false;
+    }
+    out.name = payload.substr(1, nameLength);
+    payload.remove_prefix(1 + nameLength);
+
+    const auto secretLength = (uint8_t)payload[0];
+    if (payload.size() != 1u + secretLength + 1u)
+    {
+        return false;
+    }
+    out.secret = payload.substr(1, secretLength);
+    out.digits = (uint8_t)payload[1 + secretLength];
+    return true;
+}
+
+std::size_t encodeVaultBatchEntry(const VaultRecordEntry & entry, uint8_t out[VAULT_RECORD_BATCH_ENTRY_MAX])
+{
+    auto length = encodeVaultEntry(entry, out);
+    if (length == 0)
+    {
+        return 0;
+    }
+    while (length % FLASH_WORD_SIZE != 0)
+    {
+        out[length++] = 0;
+    }
+    return length;
+}
+
+bool nextVaultBatchEntry(std::string_view & batch, std::string_view & entry)
+{
+    if (batch.empty())
+    {
+        return false;
+    }
+    const std::size_t nameLength = (uint8_t)batch[0];
+    if (batch.size() < 1 + nameLength + 1)
+    {
+        return false;
+    }
+    const std::size_t length = 1 + nameLength + 1 + (uint8_t)batch[1 + nameLength] + 1;
+    const auto padded = (length + FLASH_WORD_SIZE - 1) / FLASH_WORD_SIZE * FLASH_WORD_SIZE;
+    if (batch.size() < padded)
+    {
+        return false;
+    }
+    entry = batch.substr(0, length);
+    batch.remove_prefix(padded);
+    return true;
+}
+
+std::size_t encodeVaultTransactionHeader(const uint16_t * removed, std::size_t count, uint8_t * out)
+{
+    const auto size = vaultTransactionHeaderSize(count);
+    memset(out, 0, size);
+    encodeVaultRemove(count, out);
+    for (std::size_t i = 0; i < count; i++)
+    {
+        encodeVaultRemove(removed[i], out + 2 + 2 * i);
+    }
+    return size;
+}
+
+bool decodeVaultTransaction(std::string_view payload, std::string_view & removed, std::string_view & batch)
+{
+    std::size_t count;
+    if (payload.size() < 2 || !decodeVaultRemove(payload.substr(0, 2), count))
+    {
+        return false;
+    }
+    const auto size = vaultTransactionHeaderSize(count);
+    if (payload.size() < size)
+    {
+        return false;
+    }
+    removed = payload.substr(2, 2 * count);
+    batch = payload.substr(size);
+    return true;
+}
+
+std::size_t encodeVaultRemove(std::size_t index, uint8_t out[2])
+{
+    out[0] = (uint8_t)index;
+    out[1] = (uint8_t)(index >> 8);
+    return 2;
+}
+
+bool decodeVaultRemove(std::string_view payload, std::size_t & index)
+{
+    if (payload.size() != 2)
+    {
+        return false;
+    }
+    index = (uint8_t)payload[0] | (std::size_t)(uint8_t)payload[1] << 8;
+    return true;
+}
+
+std::size_t encodeVaultKdf(const VaultKdfParams & params, uint8_t out[VAULT_RECORD_KDF_SIZE])
+{
+    out[0] = params.algorithm;
+    for (std::size_t i = 0; i < 4; i++)
+    {
+        out[1 + i] = (uint8_t)(params.iterations >> (8 * i));
+    }
+    memcpy(out + 5, params.salt, VAULT_KDF_SALT_LENGTH);
+    return VAULT_RECORD_KDF_SIZE;
+}
+
+bool decodeVaultKdf(std::string_view payload, VaultKdfParams & out)
+{
+    if (payload.size() != VAULT_RECORD_KDF_SIZE || (uint8_t)payload[0] != VAULT_KDF_PBKDF2_SHA1)
+    {
+        return false;
+    }
+    out.algorithm = (uint8_t)payload[0];
+    out.iterations = 0;
+    for (std::size_t i = 0; i < 4; i++)
+    {
+        out.iterations |= (uint32_t)(uint8_t)payload[1 + i] << (8 * i);
+    }
+    memcpy(out.salt, payload.data() + 5, VAULT_KDF_SALT_LENGTH);
+    return out.iterations > 0;
+}
+
+bool vaultIdleCompactionDue(const VaultJournal & journal, std::size_t snapshotBytes, std::size_t reserve)
+{
+    const auto used = journal.used();
+    const auto garbage = used > snapshotBytes ? used - snapshotBytes : 0;
+    const auto spare = journal.bankSize() - used;
+    return garbage > 0 && (garbage >= journal.bankSize() / 4 || spare < reserve);
+}
+
+bool vaultKeyIdleTimeoutMillis(long seconds, unsigned long & timeoutMillis)
+{
+    if (seconds <= 0 || seconds > VAULT_KEY_IDLE_TIMEOUT_MAX_SECONDS)
+    {
+        return false;
+    }
+    timeoutMillis = (unsigned long)seconds * 1000;
+    return true;
+}
@@ -0,0 +1,665 @@
+// (c) 2024 Takhir Latypov <cregennandev@gmail.com>
+// MIT License
+
+#ifndef KEECHAIN_VAULT_STORAGE_H_GUARD
+#define KEECHAIN_VAULT_STORAGE_H_GUARD
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <EnumReflection.h>
+#include <Otp.h>
+
+// Минимальная единица записи во флеш: слово, адрес и длина кратны ему
+static constexpr std::size_t FLASH_WORD_SIZE = 4;
+
+// Значение стертого байта флеш-памяти
+static constexpr uint8_t FLASH_ERASED_BYTE = 0xFF;
+
+/*
+ * Флеш-память под журнал хранилища
+ * Стирание - целыми строками rowSize(), запись только сбрасывает биты из 1 в 0.
+ * Память читается напрямую через image(): на SAMD флеш отображается в адресное пространство
+ */
+class FlashDevice
+{
+    public:
+        virtual ~FlashDevice() = default;
+
+        virtual const uint8_t * image() const = 0;
+        virtual std::size_t size() const = 0;
+        virtual std::size_t rowSize() const = 0;
+
+        // Стереть строки, покрывающие [offset, offset + length). offset кратен rowSize()
+        virtual bool erase(std::size_t offset, std::size_t length) = 0;
+
+        // Записать данные в стертую область. offset и length кратны FLASH_WORD_SIZE
+        virtual bool program(std::size_t offset, const void * data, std::size_t length) = 0;
+};
+
+Z_ENUM_NS(
+    VAULT_JOURNAL_RESULT,
+    SUCCESS,
+    EMPTY,
+    FULL,
+    TOO_LARGE,
+    FLASH_ERROR
+)
+
+// Тип записи 0xFF зарезервирован: так выглядит стертая память после последней записи
+static constexpr uint8_t VAULT_JOURNAL_END = 0xFF;
+
+// Заголовок банка: магия, версия, CRC, номер поколения, счетчик стираний банка, признак завершенного снимка
+static constexpr std::size_t VAULT_JOURNAL_BANK_HEADER_SIZE = 20;
+
+// Наибольшее количество банков в журнале
+static constexpr std::size_t VAULT_JOURNAL_MAX_BANKS = 8;
+
+// Заголовок записи: тип, резерв, длина данных (uint16_t LE). После данных CRC16 и выравнивание до слова
+static constexpr std::size_t VAULT_JOURNAL_RECORD_HEADER_SIZE = 4;
+static constexpr std::size_t VAULT_JOURNAL_RECORD_TRAILER_SIZE = 2;
+
+/*
+ * Журнал хранилища с добавлением в конец
+ * Память делится на пул банков из целых строк. Активный банк - заголовок и за ним записи, каждая со своей CRC.
+ * Изменение хранилища - одна дописанная запись, без стирания. Когда банк заполнен,
+ * живое состояние переписывается снимком в следующий по кругу банк, и только тогда стирается строка,
+ * так что стирания распределяются по всему пулу поровну. Действующий банк при запуске - завершенный
+ * с наибольшим номером поколения, для этого читаются только заголовки банков.
+ * Снимок считается действующим после записи признака завершения в заголовок, поэтому
+ * сбой питания во время уплотнения оставляет прежний банк нетронутым.
+ * Оборванная запись в конце банка отбрасывается при открытии, следующее изменение уплотняет журнал
+ */
+class VaultJournal
+{
+    public:
+        // banks - размер пула, от 2 до VAULT_JOURNAL_MAX_BANKS. Банк занимает целое число строк
+        explicit VaultJournal(FlashDevice & flash, std::size_t banks = 2);
+
+        // Найти действующий банк и конец журнала. EMPTY, если журнал еще не создавался
+        VAULT_JOURNAL_RESULT open();
+
+        // Стереть журнал и начать новый пустой банк
+        VAULT_JOURNAL_RESULT format();
+
+        /*
+         * Дописать запись. FULL, если в банке не хватает места и нужно уплотнение через compact()
+         * TOO_LARGE, если запись не помещается даже в пустой банк
+         */
+        VAULT_JOURNAL_RESULT append(uint8_t type, std::string_view payload);
+
+        /*
+         * Уплотнение: снимок живого состояния в другой банк
+         * snapshot получает функцию emit(type, payload) и должен вызвать ее для каждой живой записи
+         */
+        template<typename Snapshot>
+        VAULT_JOURNAL_RESULT compact(Snapshot && snapshot)
+        {
+            auto result = beginCompaction();
+            if (result != VAULT_JOURNAL_RESULT::SUCCESS)
+            {
+                return result;
+            }
+            snapshot([this, &result](uint8_t type, std::string_view payload){
+                if (result == VAULT_JOURNAL_RESULT::SUCCESS)
+                {
+                    result = write(spareBank(), type, payload);
+                }
+                return result == VAULT_JOURNAL_RESULT::SUCCESS;
+            });
+            if (result != VAULT_JOURNAL_RESULT::SUCCESS)
+            {
+                return result == VAULT_JOURNAL_RESULT::FULL ? VAULT_JOURNAL_RESULT::TOO_LARGE : result;
+            }
+            return finishCompaction();
+        }
+
+        /*
+         * Пройти по записям активного банка по порядку
+         * visitor(type, payload) получает данные прямо из образа флеш-памяти; false прекращает проход
+         */
+        template<typename Visitor>
+        void replay(Visitor && visitor) const
+        {
+            if (!opened)
+            {
+                return;
+            }
+            auto offset = bankOffset(activeBank) + VAULT_JOURNAL_BANK_HEADER_SIZE;
+            uint8_t type;
+            std::string_view payload;
+            std::size_t next;
+            while (offset < writeOffset && readRecord(offset, type, payload, next))
+            {
+                if (!visitor(type, payload))
+                {
+                    return;
+                }
+                offset = next;
+            }
+        }
+
+        // Данные последней записи, дописанной через append(), прямо в образе флеш-памяти. Пусто после открытия и уплотнения
+        std::string_view lastPayload() const;
+
+        // Место в активном банке для записи с данными длины payloadLength
+        bool fits(std::size_t payloadLength) const;
+
+        // Размер записи во флеш-памяти с заголовком, CRC и выравниванием
+        static std::size_t recordSize(std::size_t payloadLength);
+
+        std::size_t bankSize() const;
+        std::size_t bankCount() const;
+        std::size_t used() const;
+        uint32_t generation() const;
+
+        // Сколько раз стирался банк bank, хранится в его заголовке. Для отчета об износе
+        uint32_t bankErases(std::size_t bank) const;
+    private:
+        std::size_t bankOffset(std::size_t bank) const;
+        std::size_t spareBank() const;
+
+        // Проверить заголовок банка: false, если он испорчен или не записан. committed - снимок завершен
+        bool readBankHeader(std::size_t bank, uint32_t & sequence, uint32_t & erases, bool & committed) const;
+
+        // Разобрать запись по смещению, false для стертой памяти и оборванной записи
+        bool readRecord(std::size_t offset, uint8_t & type, std::string_view & payload, std::size_t & next) const;
+
+        VAULT_JOURNAL_RESULT writeBankHeader(std::size_t bank, uint32_t sequence);
+        VAULT_JOURNAL_RESULT commitBank(std::size_t bank);
+        VAULT_JOURNAL_RESULT beginCompaction();
+        VAULT_JOURNAL_RESULT finishCompaction();
+
+        // Дописать запись в банк bank: в активный по writeOffset, в запасной по spareOffset
+        VAULT_JOURNAL_RESULT write(std::size_t bank, uint8_t type, std::string_view payload);
+
+        FlashDevice & flash;
+        std::size_t banks;
+        std::array<uint32_t, VAULT_JOURNAL_MAX_BANKS> erases{};
+        bool opened = false;
+        std::size_t activeBank = 0;
+        uint32_t sequence = 0;
+        std::size_t writeOffset = 0;
+        std::size_t spareOffset = 0;
+        std::size_t lastOffset = 0;
+
+        // После конца журнала есть недописанные байты, дописывать туда нельзя до уплотнения
+        bool tailDirty = false;
+};
+
+/*
+ * Типы записей журнала хранилища
+ * ADD - запись со следующим идентификатором, секрет зашифрован XOR первой версии. SEALED - то же,
+ * но секрет запечатан ChaCha20-Poly1305. TOMBSTONE - удаление записи по идентификатору,
+ * остальные идентификаторы не меняются. HOLE - в снимке занимает идентификатор удаленной записи.
+ * KDF - параметры вывода ключа из пароля, первая запись снимка. BATCH - несколько записей SEALED
+ * одной записью журнала: с общей CRC они появляются все сразу или ни одна. TRANSACTION - надгробия
+ * и новые записи одной записью журнала
+ */
+static constexpr uint8_t VAULT_RECORD_ADD = 0x01;
+static constexpr uint8_t VAULT_RECORD_TOMBSTONE = 0x02;
+static constexpr uint8_t VAULT_RECORD_HOLE = 0x03;
+static constexpr uint8_t VAULT_RECORD_SEALED = 0x04;
+static constexpr uint8_t VAULT_RECORD_KDF = 0x05;
+static constexpr uint8_t VAULT_RECORD_BATCH = 0x06;
+static constexpr uint8_t VAULT_RECORD_TRANSACTION = 0x07;
+
+/*
+ * Запись ADD и SEALED: длина имени, имя, длина секрета, зашифрованный секрет, количество цифр
+ * Поля ссылаются на данные записи, при разборе - прямо на образ флеш-памяти.
+ * Формат секрета задается типом записи и в данные не входит
+ */
+struct VaultRecordEntry
+{
+    std::string_view name;
+    std::string_view secret;
+    uint8_t digits = 0;
+    bool sealed = false;
+};
+
+// Максимальная длина данных записи ADD
+static constexpr std::size_t VAULT_RECORD_ENTRY_MAX = 3 + 2 * UINT8_MAX;
+
+// Данные записи ADD в out, возвращает длину. 0, если имя или секрет длиннее 255 байт
+std::size_t encodeVaultEntry(const VaultRecordEntry & entry, uint8_t out[VAULT_RECORD_ENTRY_MAX]);
+
+bool decodeVaultEntry(std::string_view payload, VaultRecordEntry & out);
+
+// Максимальная длина одной записи в данных BATCH: данные SEALED, выровненные до слова
+static constexpr std::size_t VAULT_RECORD_BATCH_ENTRY_MAX = (VAULT_RECORD_ENTRY_MAX + FLASH_WORD_SIZE - 1) / FLASH_WORD_SIZE * FLASH_WORD_SIZE;
+
+/*
+ * Запись в данных BATCH: данные SEALED, дополненные нулями до слова, чтобы каждая запись
+ * в образе флеш-памяти начиналась с начала слова. Возвращает длину с выравниванием, 0 как у encodeVaultEntry()
+ */
+std::size_t encodeVaultBatchEntry(const VaultRecordEntry & entry, uint8_t out[VAULT_RECORD_BATCH_ENTRY_MAX]);
+
+/*
+ * Отделить от начала данных BATCH очередную запись, без выравнивания, в entry
+ * false, когда данные кончились или запись некорректна: после полного разбора batch пуст
+ */
+bool nextVaultBatchEntry(std::string_view & batch, std::string_view & entry);
+
+// Длина заголовка TRANSACTION с count удалениями, с выравниванием до слова
+constexpr std::size_t vaultTransactionHeaderSize(std::size_t count)
+{
+    return (2 + 2 * count + FLASH_WORD_SIZE - 1) / FLASH_WORD_SIZE * FLASH_WORD_SIZE;
+}
+
+/*
+ * Заголовок записи TRANSACTION: количество удалений (uint16_t LE), идентификаторы, как в TOMBSTONE, нули до слова
+ * За заголовком идут новые записи в формате данных BATCH. Возвращает vaultTransactionHeaderSize(count)
+ */
+std::size_t encodeVaultTransactionHeader(const uint16_t * removed, std::size_t count, uint8_t * out);
+
+// Разделить данные TRANSACTION на идентификаторы удаляемых записей (по 2 байта, как TOMBSTONE) и данные BATCH
+bool decodeVaultTransaction(std::string_view payload, std::string_view & removed, std::string_view & batch);
+
+// Запись TOMBSTONE: идентификатор удаляемой записи, uint16_t LE
+std::size_t encodeVaultRemove(std::size_t index, uint8_t out[2]);
+
+bool decodeVaultRemove(std::string_view payload, std::size_t & index);
+
+// Длина соли вывода ключа
+static constexpr std::size_t VAULT_KDF_SALT_LENGTH = 16;
+
+// Алгоритм вывода ключа: PBKDF2-HMAC-SHA1 от SHA-1 пароля
+static constexpr uint8_t VAULT_KDF_PBKDF2_SHA1 = 0x01;
+
+// Запись KDF: алгоритм, количество итераций (uint32_t LE), соль
+struct VaultKdfParams
+{
+    uint8_t algorithm = VAULT_KDF_PBKDF2_SHA1;
+    uint32_t iterations = 0;
+    uint8_t salt[VAULT_KDF_SALT_LENGTH]{};
+};
+
+static constexpr std::size_t VAULT_RECORD_KDF_SIZE = 5 + VAULT_KDF_SALT_LENGTH;
+
+std::size_t encodeVaultKdf(const VaultKdfParams & params, uint8_t out[VAULT_RECORD_KDF_SIZE]);
+
+// false для неизвестного алгоритма и нулевого количества итераций
+bool decodeVaultKdf(std::string_view payload, VaultKdfParams & out);
+
+/*
+ * Записи хранилища в памяти: фиксированная емкость, структура массивов без кучи
+ * Идентификатор записи - номер ее слота, он не меняется при удалении других записей. Слот хранит
+ * смещение данных ADD в образе флеш-памяти в словах (образ до 256 КБ в 16 битах), длины имени и секрета,
+ * количество цифр, формат секрета и ключ HMAC, который готовится при первом использовании. Удаленная запись остается надгробием:
+ * erase() только ставит отметку, идентификаторы сдвигаются лишь при явном purge().
+ * Индекс sorted - идентификаторы по возрастанию имен. Надгробия убираются из него лениво, при перезаполнении
+ */
+template<std::size_t Capacity>
+class VaultEntryTable
+{
+    static_assert(Capacity > 0 && Capacity <= UINT16_MAX, "VaultEntryTable identifiers must fit in 16 bits");
+
+    public:
+        explicit VaultEntryTable(const FlashDevice & flash) : flash(flash)
+        {
+        }
+
+        static constexpr std::size_t capacity() { return Capacity; }
+
+        // Количество идентификаторов, включая надгробия
+        std::size_t size() const { return count; }
+
+        // Количество живых записей
+        std::size_t live() const { return liveCount; }
+
+        bool empty() const { return liveCount == 0; }
+
+        // Свободных идентификаторов не осталось, хотя место может освободить purge()
+        bool full() const { return count == Capacity; }
+
+        bool alive(std::size_t id) const { return id < count && !dead[id]; }
+
+        // Запись по идентификатору, поля - представления в образ флеш-памяти. У надгробия после перезаполнения поля пустые
+        VaultRecordEntry operator[](std::size_t id) const
+        {
+            VaultRecordEntry entry;
+            entry.name = nameAt(id);
+            entry.secret = std::string_view(entry.name.data() + entry.name.size() + 1, secretLengths[id]);
+            entry.digits = digits[id];
+            entry.sealed = sealedSecrets[id];
+            return entry;
+        }
+
+        // Размер индекса имен, в нем могут оставаться надгробия
+        std::size_t indexed() const { return sortedCount; }
+
+        // Идентификатор записи с номером rank в порядке имен, может быть надгробием
+        std::size_t byName(std::size_t rank) const { return sorted[rank]; }
+
+        // Номер в порядке имен первой записи с именем не меньше name, O(log n) сравнений
+        std::size_t lowerBound(std::string_view name) const
+        {
+            std::size_t first = 0, length = sortedCount;
+            while (length > 0)
+            {
+                const auto half = length / 2;
+                if (nameAt(sorted[first + half]) < name)
+                {
+                    first += half + 1;
+                    length -= half + 1;
+                }
+                else
+                {
+                    length = half;
+                }
+            }
+            return first;
+        }
+
+        // Первая живая запись с именем name, size() если такой нет
+        std::size_t find(std::string_view name) const
+        {
+            for (auto rank = lowerBound(name); rank < sortedCount && nameAt(sorted[rank]) == name; rank++)
+            {
+                if (!dead[sorted[rank]])
+                {
+                    return sorted[rank];
+                }
+            }
+            return count;
+        }
+
+        // Подготовленный ключ записи, действителен после markPrepared(id)
+        HmacSha1Key & key(std::size_t id) { return keys[id]; }
+        const HmacSha1Key & key(std::size_t id) const { return keys[id]; }
+
+        bool prepared(std::size_t id) const { return ready[id]; }
+        void markPrepared(std::size_t id) { ready[id] = true; }
+
+        // Есть ли хоть один подготовленный ключ
+        bool anyPrepared() const { return ready.any(); }
+
+        /*
+         * Добавить запись со следующим идентификатором по данным записи ADD или SEALED,
+         * лежащим в образе флеш-памяти с начала слова.
+         * false, если идентификаторы кончились, данные некорректны или лежат вне образа
+         */
+        bool push_back(std::string_view payload, bool sealed = false)
+        {
+            VaultRecordEntry entry;
+            std::size_t words;
+            if (full() || !locate(payload, words) || !decodeVaultEntry(payload, entry))
+            {
+                return false;
+            }
+            const auto id = count++;
+            payloadWords[id] = (uint16_t)words;
+            nameLengths[id] = (uint8_t)entry.name.size();
+            secretLengths[id] = (uint8_t)entry.secret.size();
+            digits[id] = entry.digits;
+            sealedSecrets[id] = sealed;
+            dead[id] = false;
+            liveCount++;
+            insertSorted(id);
+            return true;
+        }
+
+        // Занять следующий идентификатор надгробием, без данных. false, если идентификаторы кончились
+        bool pushTombstone()
+        {
+            if (full())
+            {
+                return false;
+            }
+            const auto id = count++;
+            payloadWords[id] = 0;
+            nameLengths[id] = 0;
+            secretLengths[id] = 0;
+            digits[id] = 0;
+            sealedSecrets[id] = false;
+            dead[id] = true;
+            ready[id] = false;
+            return true;
+        }
+
+        // Удалить запись за O(1): идентификатор становится надгробием, остальные не меняются. Ключ затирается
+        void erase(std::size_t id)
+        {
+            dead[id] = true;
+            ready[id] = false;
+            secureZero(&keys[id], sizeof(keys[id]));
+            liveCount--;
+        }
+
+        // Отменить erase(id), пока таблица не перезаполнялась. Ключ будет подготовлен заново
+        void restore(std::size_t id)
+        {
+            dead[id] = false;
+            liveCount++;
+        }
+
+        /*
+         * Убрать надгробия: живые записи вместе с ключами сдвигаются к началу, идентификаторы меняются.
+         * Смещения остаются прежними, журнал после этого нужно уплотнить тем же порядком
+         */
+        void purge()
+        {
+            std::size_t kept = 0;
+            for (std::size_t id = 0; id < count; id++)
+            {
+                if (dead[id])
+                {
+                    continue;
+                }
+                payloadWords[kept] = payloadWords[id];
+                nameLengths[kept] = nameLengths[id];
+                secretLengths[kept] = secretLengths[id];
+                digits[kept] = digits[id];
+                sealedSecrets[kept] = sealedSecrets[id];
+                keys[kept] = keys[id];
+                ready[kept] = ready[id];
+                dead[kept] = false;
+                kept++;
+            }
+            secureZero(&keys[kept], (count - kept) * sizeof(keys[0]));
+            for (auto id = kept; id < count; id++)
+            {
+                ready[id] = false;
+            }
+            count = sortedCount = liveCount = 0;
+            for (std::size_t id = 0; id < kept; id++)
+            {
+                count++;
+                liveCount++;
+                insertSorted(id);
+            }
+        }
+
+        /*
+         * Забыть записи вместе с ключами: после повторного заполнения идентификатор может
+         * достаться другой записи, ключи готовятся заново
+         */
+        void clear()
+        {
+            count = sortedCount = liveCount = 0;
+            wipeKeys();
+        }
+
+        // Затереть подготовленные ключи всех слотов
+        void wipeKeys()
+        {
+            secureZero(keys.data(), sizeof(keys));
+            ready.reset();
+        }
+    private:
+        std::string_view nameAt(std::size_t id) const
+        {
+            const auto payload = reinterpret_cast<const char *>(flash.image()) + payloadWords[id] * FLASH_WORD_SIZE;
+            return std::string_view(payload + 1, nameLengths[id]);
+        }
+
+        // Вставить идентификатор в индекс имен. Равные имена - в порядке вставки
+        void insertSorted(std::size_t id)
+        {
+            const auto name = nameAt(id);
+            std::size_t first = 0, length = sortedCount;
+            while (length > 0)
+            {
+                const auto half = length / 2;
+                if (!(name < nameAt(sorted[first + half])))
+                {
+                    first += half + 1;
+                    length -= half + 1;
+                }
+                else
+                {
+                    length = half;
+                }
+            }
+            std::memmove(&sorted[first + 1], &sorted[first], (sortedCount - first) * sizeof(sorted[0]));
+            sorted[first] = (uint16_t)id;
+            sortedCount++;
+        }
+
+        // Смещение payload в образе флеш-памяти в словах, false если данные вне образа или не с начала слова
+        bool locate(std::string_view payload, std::size_t & words) const
+        {
+            const auto image = reinterpret_cast<uintptr_t>(flash.image());
+            const auto data = reinterpret_cast<uintptr_t>(payload.data());
+            if (data < image || data + payload.size() > image + flash.size() || (data - image) % FLASH_WORD_SIZE != 0)
+            {
+                return false;
+            }
+            words = (data - image) / FLASH_WORD_SIZE;
+            return words <= UINT16_MAX;
+        }
+
+        const FlashDevice & flash;
+        std::array<uint16_t, Capacity> payloadWords{};
+        std::array<uint16_t, Capacity> sorted{};
+        std::array<uint8_t, Capacity> nameLengths{};
+        std::array<uint8_t, Capacity> secretLengths{};
+        std::array<uint8_t, Capacity> digits{};
+        std::bitset<Capacity> sealedSecrets{};
+        std::bitset<Capacity> dead{};
+        std::bitset<Capacity> ready{};
+        std::array<HmacSha1Key, Capacity> keys{};
+        std::size_t count = 0;
+        std::size_t liveCount = 0;
+        std::size_t sortedCount = 0;
+};
+
+/*
+ * Заполнить таблицу записями после проигрывания журнала
+ * Имена и секреты остаются в образе флеш-памяти, в кучу ничего не копируется.
+ * false, если запись некорректна или идентификаторов больше емкости таблицы
+ */
+template<std::size_t Capacity>
+bool replayVaultEntries(const VaultJournal & journal, VaultEntryTable<Capacity> & entries)
+{
+    entries.clear();
+    auto valid = true;
+    journal.replay([&entries, &valid](uint8_t type, std::string_view payload){
+        std::size_t id;
+        if ((type == VAULT_RECORD_ADD || type == VAULT_RECORD_SEALED) && entries.push_back(payload, type == VAULT_RECORD_SEALED))
+        {
+            return true;
+        }
+        // Пакет и транзакция применяются целиком: надгробия, затем новые записи с идентификаторами подряд
+        if (type == VAULT_RECORD_BATCH || type == VAULT_RECORD_TRANSACTION)
+        {
+            std::string_view removed;
+            std::string_view entry;
+            auto parsed = type == VAULT_RECORD_BATCH ? !payload.empty() : decodeVaultTransaction(payload, removed, payload);
+            for (; parsed && !removed.empty(); removed.remove_prefix(2))
+            {
+                parsed = decodeVaultRemove(removed.substr(0, 2), id) && entries.alive(id);
+                if (parsed)
+                {
+                    entries.erase(id);
+                }
+            }
+            while (parsed && nextVaultBatchEntry(payload, entry))
+            {
+                parsed = entries.push_back(entry, true);
+            }
+            if (parsed && payload.empty())
+            {
+                return true;
+            }
+        }
+        if (type == VAULT_RECORD_TOMBSTONE && decodeVaultRemove(payload, id) && entries.alive(id))
+        {
+            entries.erase(id);
+            return true;
+        }
+        if (type == VAULT_RECORD_HOLE && payload.empty() && entries.pushTombstone())
+        {
+            return true;
+        }
+        // Параметры вывода ключа идентификатора не занимают, их читает владелец таблицы
+        if (type == VAULT_RECORD_KDF)
+        {
+            return true;
+        }
+        valid = false;
+        return false;
+    });
+    return valid;
+}
+
+/*
+ * Сколько займет журнал сразу после уплотнения таблицы entries: заголовок банка, запись на каждую живую
+ * запись и HOLE на каждое надгробие. extraBytes - записи снимка вне таблицы, например KDF.
+ * Считается заново по таблице, а не поправками к прежнему значению: после уплотнения посреди
+ * изменения поправка учла бы удаленную запись дважды
+ */
+template<std::size_t Capacity>
+std::size_t vaultSnapshotSize(const VaultEntryTable<Capacity> & entries, std::size_t extraBytes = 0)
+{
+    auto size = VAULT_JOURNAL_BANK_HEADER_SIZE + extraBytes;
+    for (std::size_t id = 0; id < entries.size(); id++)
+    {
+        if (!entries.alive(id))
+        {
+            size += VaultJournal::recordSize(0);
+            continue;
+        }
+        const auto entry = entries[id];
+        size += VaultJournal::recordSize(3 + entry.name.size() + entry.secret.size());
+    }
+    return size;
+}
+
+/*
+ * Открываются ли все живые записи: open(entry) возвращает true, если секрет записи читается
+ * Проверка перед сменой ключа печати: запись, которую не открыть прежним ключом, в снимке под новым пропадет
+ */
+template<std::size_t Capacity, typename Open>
+bool vaultEntriesReadable(const VaultEntryTable<Capacity> & entries, Open && open)
+{
+    for (std::size_t id = 0; id < entries.size(); id++)
+    {
+        if (entries.alive(id) && !open(entries[id]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Пора ли уплотнить журнал в простое: мусор сверх снимка snapshotBytes занял четверть банка
+ * или свободного места осталось меньше reserve. Без мусора уплотнение ничего не освободит
+ */
+bool vaultIdleCompactionDue(const VaultJournal & journal, std::size_t snapshotBytes, std::size_t reserve);
+
+// Наибольший срок хранения подготовленных ключей без запросов кодов, сутки. В миллисекундах он далек от переполнения
+static constexpr long VAULT_KEY_IDLE_TIMEOUT_MAX_SECONDS = 24L * 60 * 60;
+
+/*
+ * Срок хранения ключей из секунд запроса в миллисекунды для millis()
+ * false для сроков вне 1..VAULT_KEY_IDLE_TIMEOUT_MAX_SECONDS: умножение не должно переполняться
+ */
+bool vaultKeyIdleTimeoutMillis(long seconds, unsigned long & timeoutMillis);
+
+#endif // Guard
@@ -2,121 +2,207 @@
 // MIT License
 
 #include <Warlin.h>
-inline std::deque<std::string> split(const std::string& s);
 
 Warlin_::Warlin_() = default;
 
 bool Warlin_::available()
 {
-    return Serial.available();
+    return Serial.available() || !rx.empty();
 }
 
 void Warlin_::process()
 {
-    std::string line(Serial.readStringUntil('\n').c_str());
-    auto parts = split(line);
-    if (parts.empty())
+    // Берем только то, что уже пришло: время прохода ограничено объемом данных, а не таймаутом Stream
+    auto pending = Serial.available();
+    while (pending-- > 0 && !rx.full())
+    {
+        rx.push((uint8_t)Serial.read());
+    }
+
+    uint8_t value;
+    while (rx.pop(value))
+    {
+        const auto wasInFrame = assembler.inFrame();
+        const auto result = assembler.feed(value);
+        // Отметка ставится по первому байту каждого кадра: обработчики предыдущих кадров прохода в задержку не входят
+        if (!wasInFrame && assembler.inFrame())
+        {
+            requestMicros = micros();
+        }
+
+        switch (result)
+        {
+            case PACKET_FEED_RESULT::FRAME:
+                awaitingResponse = true;
+                dispatch(assembler.frame());
+                awaitingResponse = false;
+                requestId = {};
+                break;
+            case PACKET_FEED_RESULT::BINARY_FRAME:
+                awaitingResponse = true;
+                respondBinary = true;
+                requestId = assembler.requestId();
+                dispatchBinary(assembler.opcode(), assembler.frame());
+                respondBinary = false;
+                awaitingResponse = false;
+                requestId = {};
+                break;
+            case PACKET_FEED_RESULT::CORRUPT:
+                // Идентификатору из испорченного кадра верить нельзя, хост узнает о потере по таймауту
+                SendErrorMessage("Binary frame corrupt, dropped");
+                break;
+            case PACKET_FEED_RESULT::GARBAGE:
+                SendErrorMessage("Non-Warlin string recieved");
+                break;
+            case PACKET_FEED_RESULT::TOO_LONG:
+                SendErrorMessage("Request too long, dropped");
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void Warlin_::dispatch(std::string_view view)
+{
+    const auto splitted = splitPacket(view, DEFAULT_DELIMITER, packet);
+
+    if (packet.empty())
     {
         SendErrorMessage("Empty string recieved");
         return;
     }
 
-    if (parts[0] != PROTOCOL_MAGIC_BEGIN)
+    // Идентификатор разбирается первым, чтобы даже отказ можно было сопоставить с запросом
+    if (!parsePacketHead(packet.front(), PROTOCOL_MAGIC_BEGIN, requestId))
+    {
+        SendErrorMessage("Non-Warlin string recieved", view);
+        return;
+    }
+
+    if (!splitted)
     {
-        SendErrorMessage("Non-Warlin string recieved", line.c_str());
+        reject(ANSWER_MALFORMED_REQUEST, "Too many parts in request");
         return;
     }
 
-    auto magic_begin = parts.front();
-    parts.pop_front();
+    packet.popFront();
 
-    if (parts.empty())
+    if (packet.empty())
     {
-        SendErrorMessage("No Request type was provided");
+        reject(ANSWER_MALFORMED_REQUEST, "No Request type was provided");
         return;
     }
 
-    const auto strType = parts.front();
-    parts.pop_front();
+    const auto strType = packet.front();
+    packet.popFront();
 
-    auto& reflector = EnumReflector::For<PROTOCOL_REQUEST_TYPE>();
-    auto parseResult = reflector.Find(strType);
-    if (!parseResult.IsValid())
+    PROTOCOL_REQUEST_TYPE requestType;
+    if (!EnumFromName(strType, requestType))
     {
-        SendErrorMessage("Unable to parse PROTOCOL_REQUEST_TYPE:", strType.c_str());
+        reject(ANSWER_UNKNOWN_REQUEST, "Unable to parse PROTOCOL_REQUEST_TYPE:", strType);
         return;
     }
-    const auto requestType = static_cast<PROTOCOL_REQUEST_TYPE>(parseResult.Value());
 
-    if (listeners.count(requestType) == 0)
+    invoke(requestType);
+}
+
+void Warlin_::dispatchBinary(uint8_t opcode, std::string_view payload)
+{
+    if (opcode >= PROTOCOL_REQUEST_TYPE_COUNT)
     {
-        SendErrorMessage("Unable to find corresponding listener to type", strType.c_str());
+        reject(ANSWER_UNKNOWN_REQUEST, "Unknown binary request opcode, dropped");
         return;
     }
-    const auto listener = listeners.at(requestType);
 
-    if (listener == nullptr)
+    if (!decodeBinaryPacket(payload, packet))
     {
-        SendErrorMessage("Listener was NULL for type", strType.c_str());
+        reject(ANSWER_MALFORMED_REQUEST, "Malformed binary request arguments, dropped");
         return;
     }
 
-    listener(parts);
+    invoke(static_cast<PROTOCOL_REQUEST_TYPE>(opcode));
+}
+
+void Warlin_::invoke(PROTOCOL_REQUEST_TYPE type)
+{
+    if (listeners == nullptr)
+    {
+        SendErrorMessage("No listeners were bound, dropped", NameOf(type));
+        return;
+    }
+    const auto listener = (*listeners)[static_cast<std::size_t>(type)];
 
-    parts.clear(); // Чистим память после себя
-    line.clear();
+    listener(packet);
 }
 
-void Warlin_::bind(const PROTOCOL_REQUEST_TYPE type, void (*func)(std::deque<std::string>&))
+void Warlin_::reject(const char * answer, const char * message, std::string_view detail)
 {
-    if (func != nullptr)
+    if (requestId.present)
     {
-        this->listeners[type] = func;
-    }else
+        respond(PROTOCOL_RESPONSE_TYPE::ERROR, answer);
+        return;
+    }
+
+    if (detail.empty())
     {
-        SendErrorMessage("Attempt to bind nullptr function");
+        SendErrorMessage(message);
+        return;
     }
+    SendErrorMessage(message, detail);
 }
 
-void Warlin_::writeLine(const std::string & str)
+void Warlin_::setBinaryFraming(bool enabled)
 {
-    Serial.write(PROTOCOL_MAGIC_BEGIN);
-    Serial.write(DEFAULT_DELIMITER);
-    Serial.write(str.c_str());
-    Serial.write('\n');
+    assembler.setBinaryEnabled(enabled);
+}
+
+void Warlin_::bind(const WarlinDispatchTable & table)
+{
+    this->listeners = &table;
 }
 
-void Warlin_::writeLine(const std::initializer_list<std::string>& args)
+PacketWriter & Warlin_::beginResponse(PROTOCOL_RESPONSE_TYPE type)
 {
-    Serial.write(PROTOCOL_MAGIC_BEGIN);
-    Serial.write(DEFAULT_DELIMITER);
-    auto iterator = args.begin();
-    Serial.write((*iterator++).c_str());
-    while(iterator != args.end()) {
-        Serial.write(DEFAULT_DELIMITER);
-        Serial.write((*iterator++).c_str());
+    if (respondBinary)
+    {
+        return writer.beginBinary(static_cast<uint8_t>(type), requestId);
     }
-    Serial.write('\n');
+    return writer.begin(requestId).append(type);
 }
 
-void Warlin_::writeLine(PROTOCOL_RESPONSE_TYPE type, std::vector<std::string> &params) {
-    Serial.write(PROTOCOL_MAGIC_BEGIN);
-    Serial.write(DEFAULT_DELIMITER);
-    Serial.write(NameOf(type).c_str());
-    if (!params.empty()){
-        for (const auto &item: params){
-            Serial.write(DEFAULT_DELIMITER);
-            Serial.write(item.c_str());
-        }
+void Warlin_::endResponse()
+{
+    if (!writer.finish())
+    {
+        // Аргумент двоичного ответа больше буфера, вместо последнего кадра уходит короткая ошибка
+        writer.beginBinary(static_cast<uint8_t>(PROTOCOL_RESPONSE_TYPE::ERROR), requestId).append(ANSWER_RESPONSE_TOO_LONG);
+        writer.finish();
     }
-    Serial.write('\n');
+    noteResponse();
 }
 
-void Warlin_::writeLine(PROTOCOL_RESPONSE_TYPE type) {
-    Serial.write(PROTOCOL_MAGIC_BEGIN);
-    Serial.write(DEFAULT_DELIMITER);
-    Serial.write(NameOf(type).c_str());
-    Serial.write('\n');
+const WarlinLatency & Warlin_::latency() const
+{
+    return latencyStats;
+}
+
+void Warlin_::noteResponse()
+{
+    if (!awaitingResponse)
+    {
+        return;
+    }
+    awaitingResponse = false;
+
+    const auto elapsed = micros() - requestMicros;
+    latencyStats.count++;
+    latencyStats.last = elapsed;
+    latencyStats.total += elapsed;
+    if (elapsed > latencyStats.max)
+    {
+        latencyStats.max = elapsed;
+    }
 }
 
 void SendDebugMessage(const char * const message)
@@ -159,24 +245,12 @@ void SendErrorMessage(const char* part1, const char* part2)
     Serial.write('\n');
 }
 
-inline std::deque<std::string> split(const std::string& s)
+void SendErrorMessage(const char* part1, std::string_view part2)
 {
-    std::deque<std::string> output;
-
-    std::string::size_type prev_pos = 0, pos = 0;
-
-    while((pos = s.find(DEFAULT_DELIMITER, pos)) != std::string::npos)
-    {
-        std::string substring( s.substr(prev_pos, pos-prev_pos) );
-
-        output.push_back(substring);
-
-        pos += strlen(DEFAULT_DELIMITER);
-
-        prev_pos = pos;
-    }
-
-    output.push_back(s.substr(prev_pos, pos-prev_pos));
-
-    return output;
-}
\ No newline at end of file
+    Serial.write(PROTOCOL_ERROR_BEGIN);
+    Serial.write(": ");
+    Serial.write(part1);
+    Serial.write(" ");
+    Serial.write(part2.data(), part2.size());
+    Serial.write('\n');
+}
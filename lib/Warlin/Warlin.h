@@ -6,9 +6,10 @@
 #pragma once
 
 #include <Arduino.h>
-#include <deque>
-#include <unordered_map>
+#include <array>
 #include <EnumReflection.h>
+#include <Packet.h>
+#include <string_view>
 #include <vector>
 
 #define KEECHAIN_DEBUG_ENABLED // Закомментировать в продакшене
@@ -33,7 +34,19 @@ Z_ENUM_NS(
     REMOVE_ENTRY,
     GENERATE,
     TEST_EXPLICIT_CODE,
-    SERVICE_TRY_READ_EEPROM
+    SERVICE_TRY_READ_EEPROM,
+    SERVICE_LATENCY,
+    GENERATE_ALL,
+    LOCK,
+    SERVICE_OTP_CACHE,
+    SERVICE_STORAGE,
+    GENERATE_BY_NAME,
+    FIND_ENTRIES,
+    UNLOCK_STATUS,
+    STORE_ENTRIES,
+    BEGIN,
+    COMMIT,
+    ROLLBACK
 );
 
 Z_ENUM_NS(
@@ -43,22 +56,151 @@ Z_ENUM_NS(
     SERVICE,
     ENTRIES,
     OTP,
-    ERROR
+    ERROR,
+    LATENCY,
+    OTPS,
+    OTP_CACHE,
+    STORAGE,
+    FOUND,
+    PENDING
 );
 
+#define ANSWER_RESPONSE_TOO_LONG "RESPONSE_TOO_LONG"
+#define ANSWER_MALFORMED_REQUEST "MALFORMED_REQUEST"
+#define ANSWER_UNKNOWN_REQUEST "UNKNOWN_REQUEST"
+
+// Обработчик запроса, получает аргументы запроса без магии и типа
+typedef void (*WarlinHandler)(const Packet &);
+
+static constexpr auto PROTOCOL_REQUEST_TYPE_COUNT = EnumCount<PROTOCOL_REQUEST_TYPE>();
+
+// Таблица обработчиков, индекс - значение PROTOCOL_REQUEST_TYPE
+typedef std::array<WarlinHandler, PROTOCOL_REQUEST_TYPE_COUNT> WarlinDispatchTable;
+
+// Привязка обработчика к типу запроса для makeWarlinDispatchTable
+template<PROTOCOL_REQUEST_TYPE Type, WarlinHandler Handler>
+struct WarlinBinding
+{
+    static_assert(Handler != nullptr, "Warlin handler must not be nullptr");
+
+    static constexpr auto type = Type;
+    static constexpr auto handler = Handler;
+};
+
+// Каждый тип запроса привязан ровно один раз
+template<typename... Bindings>
+constexpr bool warlinBindingsComplete()
+{
+    const PROTOCOL_REQUEST_TYPE types[] = { Bindings::type... };
+    std::array<bool, PROTOCOL_REQUEST_TYPE_COUNT> bound{};
+    for (auto type : types)
+    {
+        const auto index = static_cast<std::size_t>(type);
+        if (index >= PROTOCOL_REQUEST_TYPE_COUNT || bound[index])
+        {
+            return false;
+        }
+        bound[index] = true;
+    }
+    return sizeof...(Bindings) == PROTOCOL_REQUEST_TYPE_COUNT;
+}
+
+/*
+ * Собирает таблицу обработчиков на этапе компиляции
+ * Не привязанный или привязанный дважды тип запроса - ошибка компиляции
+ */
+template<typename... Bindings>
+constexpr WarlinDispatchTable makeWarlinDispatchTable()
+{
+    static_assert(warlinBindingsComplete<Bindings...>(), "Every PROTOCOL_REQUEST_TYPE must be bound exactly once");
+
+    WarlinDispatchTable table{};
+    ((table[static_cast<std::size_t>(Bindings::type)] = Bindings::handler), ...);
+    return table;
+}
+
+// Задержка от разбора первого байта запроса до отправки ответа, в микросекундах
+struct WarlinLatency
+{
+    unsigned long count = 0;
+    unsigned long last = 0;
+    unsigned long max = 0;
+    unsigned long total = 0;
+};
+
+/*
+ * Запросы можно отправлять окном, не дожидаясь ответов: все кадры, накопленные в приемном буфере,
+ * обрабатываются подряд, и ответ на каждый уходит сразу после его обработчика.
+ * Чтобы сопоставить ответ с запросом, хост добавляет идентификатор (WARLIN#42<PART>... или
+ * PACKET_BINARY_TAGGED_START), и устройство повторяет его в каждом ответе на этот запрос, включая ERROR
+ */
 class Warlin_
 {
     public:
-        void bind(PROTOCOL_REQUEST_TYPE, void(*)(std::deque<std::string>&));
+        void bind(const WarlinDispatchTable & table);
         bool available();
         void process();
         Warlin_();
-        void writeLine(const std::string & str);
-        void writeLine(const std::initializer_list<std::string> & args);
-        void writeLine(PROTOCOL_RESPONSE_TYPE type, std::vector<std::string> & params);
-        void writeLine(PROTOCOL_RESPONSE_TYPE type);
+
+        /*
+         * Отправить ответ одной записью в Serial
+         * Аргументы: строки, целые числа и перечисления Z_ENUM в любом сочетании
+         */
+        template<typename... Args>
+        void respond(PROTOCOL_RESPONSE_TYPE type, const Args & ... args)
+        {
+            auto & response = beginResponse(type);
+            (response.append(args), ...);
+            endResponse();
+        }
+
+        // Ответ с переменным количеством частей: beginResponse, затем append/appendEach, затем endResponse
+        PacketWriter & beginResponse(PROTOCOL_RESPONSE_TYPE type);
+        void endResponse();
+
+        const WarlinLatency & latency() const;
+
+        // Разрешить прием двоичных кадров, согласуется через DISCOVER<PART>BINARY
+        void setBinaryFraming(bool enabled);
     private:
-        std::unordered_map<PROTOCOL_REQUEST_TYPE, void(*)(std::deque<std::string>&)> listeners{};
+        // Разбор и вызов обработчика для одного собранного текстового кадра
+        void dispatch(std::string_view frame);
+
+        // Разбор и вызов обработчика для одного двоичного кадра
+        void dispatchBinary(uint8_t opcode, std::string_view payload);
+
+        // Вызов обработчика для разобранного запроса
+        void invoke(PROTOCOL_REQUEST_TYPE type);
+
+        // Отказ в обработке: ERROR с идентификатором, если хост его передал, иначе WARLIN_ERROR для совместимости
+        void reject(const char * answer, const char * message, std::string_view detail = {});
+
+        // Учет задержки для первого ответа на текущий запрос
+        void noteResponse();
+
+        const WarlinDispatchTable * listeners = nullptr;
+
+        RingBuffer<PACKET_RX_BUFFER_SIZE> rx{};
+
+        PacketAssembler assembler{PROTOCOL_MAGIC_BEGIN};
+
+        Packet packet{};
+
+        unsigned long requestMicros = 0;
+
+        bool awaitingResponse = false;
+
+        // Идентификатор текущего запроса, повторяется в ответах на него
+        PacketRequestId requestId{};
+
+        // Ответ на текущий запрос отправляется двоичным кадром
+        bool respondBinary = false;
+
+        WarlinLatency latencyStats{};
+
+        PacketWriter writer{PROTOCOL_MAGIC_BEGIN, DEFAULT_DELIMITER, [](const char * data, std::size_t length){
+            Serial.write(data, length);
+        }};
 };
 
 void SendDebugMessage(const char * message);
@@ -69,4 +211,6 @@ void SendErrorMessage(const char * message);
 
 void SendErrorMessage(const char * part1, const char * part2);
 
+void SendErrorMessage(const char * part1, std::string_view part2);
+
 #endif // Guard
\ No newline at end of file
@@ -1,14 +1,34 @@
 #include "main.h"
 #include "TOTP.h"
+#include <climits>
+
+// Количество цифр кода из пакета: число вне допустимого диапазона не сужается до int, а отклоняется
+static bool digitsArgument(long value){
+    return value >= TOTP_KEY_DIGITS_MIN && value <= TOTP_KEY_DIGITS_MAX;
+}
+
+// Идентификатор записи из пакета: число вне int становится -1, и Salavat ответит NOT_FOUND, а не найдет запись по усеченному номеру
+static int entryIdArgument(long value){
+    return value < 0 || value > INT_MAX ? -1 : (int)value;
+}
 
 /*
  * Обработчик DISCOVER
- * Аргументов нет
- * Отвечает ACK
+ * Аргументы (необязательно):
+ * - string BINARY, чтобы включить двоичные кадры
+ * Отвечает ACK, при включении двоичных кадров ACK + BINARY
+ * DISCOVER без аргумента возвращает устройство к одному текстовому протоколу
  */
-void discoverHandler(std::deque<std::string> & params)
+void discoverHandler(const Packet & params)
 {
-   Warlin.writeLine(NameOf(PROTOCOL_RESPONSE_TYPE::ACK));
+    auto binary = params.size() >= 1 && params[0] == FRAMING_BINARY;
+    Warlin.setBinaryFraming(binary);
+
+    if (binary){
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ACK, FRAMING_BINARY);
+        return;
+    }
+    Warlin.respond(PROTOCOL_RESPONSE_TYPE::ACK);
 }
 
 /*
@@ -16,37 +36,70 @@ void discoverHandler(std::deque<std::string> & params)
  * Аргументов нет
  * Отвечает SYNCR + int количество ключей в памяти
  */
-void syncHandler(std::deque<std::string> & params)
+void syncHandler(const Packet & params)
 {
     auto result = Salavat.Initialize();
 
     if (result == VAULT_INIT_RESULT::MALFORMED){
-        Warlin.writeLine({ NameOf(PROTOCOL_RESPONSE_TYPE::ERROR), ANSWER_INIT_MALFORMED });
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, ANSWER_INIT_MALFORMED);
         return;
     }
 
-    Warlin.writeLine({ NameOf(PROTOCOL_RESPONSE_TYPE::SYNCR), std::to_string(Salavat.secretsCount()) });
+    Warlin.respond(PROTOCOL_RESPONSE_TYPE::SYNCR, Salavat.secretsCount());
 }
 
 /*
  * Обработчик для UNLOCK
- * Аргумент: string мастер-пароль
- * Отвечает ACK
+ * Аргументы:
+ * - string мастер-пароль
+ * - int через сколько секунд без запросов кодов затирать ключи записей (необязательно, по умолчанию 300,
+ *   от 1 до VAULT_KEY_IDLE_TIMEOUT_MAX_SECONDS, иначе MALFORMED_NUMBER)
+ * Ключ выводится из пароля в фоне, устройство продолжает отвечать на запросы. Итог - через UNLOCK_STATUS.
+ * Проверяется только пароль, ключ записи готовится при первом коде для нее
+ * Отвечает PENDING
+ * - int готовность вывода ключа в процентах
  */
-void unlockHandler(std::deque<std::string> & params){
+void unlockHandler(const Packet & params){
     if (params.size() < 1){
-        Warlin.writeLine({NameOf(PROTOCOL_RESPONSE_TYPE::ERROR), ANSWER_NOT_ENOUGH_PARAMS});
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, ANSWER_NOT_ENOUGH_PARAMS);
+        return;
+    }
+
+    long idleSeconds = VAULT_KEY_IDLE_TIMEOUT_MILLIS / 1000;
+    unsigned long idleMillis;
+    if ((params.size() >= 2 && !params.integer(1, idleSeconds)) || !vaultKeyIdleTimeoutMillis(idleSeconds, idleMillis)){
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, ANSWER_MALFORMED_NUMBER);
         return;
     }
 
-    auto password = params[0];
-    auto unlockResult = Salavat.unlock(password);
-    if (unlockResult != VAULT_UNLOCK_RESULT::SUCCESS){
-        Warlin.writeLine({ NameOf(PROTOCOL_RESPONSE_TYPE::ERROR), NameOf(unlockResult) });
+    auto password = std::string(params[0]);
+    auto unlockResult = Salavat.beginUnlock(password);
+    if (unlockResult != VAULT_UNLOCK_RESULT::PENDING){
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, unlockResult);
         return;
     }
 
-    Warlin.writeLine(NameOf(PROTOCOL_RESPONSE_TYPE::ACK));
+    Salavat.setKeyIdleTimeout(idleMillis);
+    Warlin.respond(PROTOCOL_RESPONSE_TYPE::PENDING, Salavat.unlockProgress());
+}
+
+/*
+ * Обработчик для UNLOCK_STATUS
+ * Аргументов нет
+ * Возвращает PENDING + int готовность в процентах, пока ключ выводится,
+ * ACK, если последняя разблокировка удалась, иначе ERROR + VAULT_UNLOCK_RESULT
+ */
+void unlockStatusHandler(const Packet & params){
+    auto status = Salavat.unlockStatus();
+    if (status == VAULT_UNLOCK_RESULT::PENDING){
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::PENDING, Salavat.unlockProgress());
+        return;
+    }
+    if (status == VAULT_UNLOCK_RESULT::SUCCESS){
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ACK);
+        return;
+    }
+    Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, status);
 }
 
 /*
@@ -54,7 +107,7 @@ void unlockHandler(std::deque<std::string> & params){
  * Аргументов нет
  * Возвращает SERVICE
  */
-void serviceEEPROMHandler(std::deque<std::string> & params){
+void serviceEEPROMHandler(const Packet & params){
     auto t = Salavat._service_read_eeprom_header();
     SendDebugMessage("EEPROM READ COMPLETED, COUNT: ", std::to_string(t.size()).c_str());
     std::string result;
@@ -65,18 +118,22 @@ void serviceEEPROMHandler(std::deque<std::string> & params){
     }
     SendDebugMessage(result.c_str());
 
-    Warlin.writeLine({NameOf(PROTOCOL_RESPONSE_TYPE::SERVICE)});
+    Warlin.respond(PROTOCOL_RESPONSE_TYPE::SERVICE);
 }
 
 /*
  * Обработчик GET_ENTRIES
  * Аргументов нет
  * Возвращает ENTRIES
- * - string[] названия ключей
+ * - string[] названия ключей по идентификаторам, у удаленной записи - пустая строка
  */
-void getStoredNamesHandler(std::deque<std::string> & params){
-    auto names = Salavat.getEntryNames();
-    Warlin.writeLine(PROTOCOL_RESPONSE_TYPE::ENTRIES, names);
+void getStoredNamesHandler(const Packet & params){
+    // Названия уходят прямо из флеш-памяти, без промежуточного списка: записей могут быть сотни
+    auto & response = Warlin.beginResponse(PROTOCOL_RESPONSE_TYPE::ENTRIES);
+    for (std::size_t entryId = 0; entryId < Salavat.entryIdCount(); entryId++){
+        response.append(Salavat.entryName(entryId));
+    }
+    Warlin.endResponse();
 }
 
 /*
@@ -84,23 +141,85 @@ void getStoredNamesHandler(std::deque<std::string> & params){
  * Аргументы:
  * - string название
  * - string base32-кодированный секрет в верхнем регистре
- * - int количество цифр (UNUSED)
+ * - int количество цифр кода, от TOTP_KEY_DIGITS_MIN до TOTP_KEY_DIGITS_MAX
  * Возвращает ACK
  */
-void storeSecretHandler(std::deque<std::string> & params){
+void storeSecretHandler(const Packet & params){
     if (params.size() < 3){
-        Warlin.writeLine({ NameOf(PROTOCOL_RESPONSE_TYPE::ERROR), ANSWER_NOT_ENOUGH_PARAMS });
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, ANSWER_NOT_ENOUGH_PARAMS);
         return;
     }
-    auto digits = std::stoi(params[2]);
-    auto result = Salavat.addEntry(params[0], params[1], digits);
+    long digits;
+    if (!params.integer(2, digits)){
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, ANSWER_MALFORMED_NUMBER);
+        return;
+    }
+    if (!digitsArgument(digits)){
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, VAULT_ADD_ENTRY_RESULT::INVALID_DIGITS);
+        return;
+    }
+    auto result = Salavat.addEntry(std::string(params[0]), std::string(params[1]), (int)digits);
+
+    if (result != VAULT_ADD_ENTRY_RESULT::SUCCESS){
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, result);
+        return;
+    }
+
+    Warlin.respond(PROTOCOL_RESPONSE_TYPE::ACK);
+}
+
+// Записей STORE_ENTRIES в одном пакете: тройки аргументов после магии и типа запроса
+static constexpr auto STORE_ENTRIES_MAX = (PACKET_MAX_PARTS - 2) / 3;
+static_assert(STORE_ENTRIES_MAX <= VAULT_BATCH_MAX_ENTRIES, "STORE_ENTRIES must fit in one vault batch");
 
+// Самый длинный кадр STORE_ENTRIES: магия с идентификатором запроса и записи наибольшей длины с двузначным количеством цифр
+static constexpr auto STORE_ENTRIES_HEADER_LENGTH = std::char_traits<char>::length(PROTOCOL_MAGIC_BEGIN) + 1 + 10
+        + std::char_traits<char>::length(DEFAULT_DELIMITER) + std::char_traits<char>::length("STORE_ENTRIES");
+static constexpr auto STORE_ENTRIES_ENTRY_LENGTH = 3 * std::char_traits<char>::length(DEFAULT_DELIMITER)
+        + TOTP_KEY_NAME_MAX_LENGTH + TOTP_KEY_SECRET_MAX_LENGTH + 2;
+static_assert(STORE_ENTRIES_HEADER_LENGTH + STORE_ENTRIES_MAX * STORE_ENTRIES_ENTRY_LENGTH <= PACKET_MAX_LENGTH,
+              "STORE_ENTRIES frame with the maximum number of entries must fit in PACKET_MAX_LENGTH");
+
+/*
+ * Обработчик STORE_ENTRIES, массовое добавление одной записью журнала: сохраняются все записи или ни одной
+ * Аргументы: для каждой записи тройка, как в STORE_ENTRY
+ * - string название
+ * - string base32-кодированный секрет
+ * - int количество цифр
+ * Возвращает ACK с количеством добавленных записей
+ * При ошибке ERROR с причиной и номером записи, на которой она случилась
+ */
+void storeEntriesHandler(const Packet & params){
+    if (params.size() < 3 || params.size() % 3 != 0){
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, ANSWER_NOT_ENOUGH_PARAMS);
+        return;
+    }
+
+    VaultNewEntry entries[STORE_ENTRIES_MAX];
+    const auto count = params.size() / 3;
+    for (std::size_t i = 0; i < count; i++){
+        long digits;
+        if (!params.integer(i * 3 + 2, digits)){
+            Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, ANSWER_MALFORMED_NUMBER, i);
+            return;
+        }
+        if (!digitsArgument(digits)){
+            Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, VAULT_ADD_ENTRY_RESULT::INVALID_DIGITS, i);
+            return;
+        }
+        entries[i].name = params[i * 3];
+        entries[i].secret = params[i * 3 + 1];
+        entries[i].digits = (int)digits;
+    }
+
+    std::size_t failed;
+    auto result = Salavat.addEntries(entries, count, failed);
     if (result != VAULT_ADD_ENTRY_RESULT::SUCCESS){
-        Warlin.writeLine({NameOf(PROTOCOL_RESPONSE_TYPE::ERROR), NameOf(result)});
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, result, failed);
         return;
     }
 
-    Warlin.writeLine(PROTOCOL_RESPONSE_TYPE::ACK);
+    Warlin.respond(PROTOCOL_RESPONSE_TYPE::ACK, count);
 }
 
 /*
@@ -111,27 +230,119 @@ void storeSecretHandler(std::deque<std::string> & params){
  * Возвращает OTP
  * - string одноразовый код
  */
-void generateHandler(std::deque<std::string> &params) {
+void generateHandler(const Packet & params) {
 
     if (params.size() < 2){
-        Warlin.writeLine({ NameOf(PROTOCOL_RESPONSE_TYPE::ERROR), ANSWER_NOT_ENOUGH_PARAMS });
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, ANSWER_NOT_ENOUGH_PARAMS);
         return;
     }
 
-    auto index = std::stoi(params[0]);
-    auto currentUtc = std::stol(params[1]);
+    long index, currentUtc;
+    if (!params.integer(0, index) || !params.integer(1, currentUtc)){
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, ANSWER_MALFORMED_NUMBER);
+        return;
+    }
 
-    auto result = Salavat.getKey(index, currentUtc);
+    auto result = Salavat.getKey(entryIdArgument(index), currentUtc);
     auto status = result.first;
     auto code = result.second;
 
     if (status != VAULT_GET_KEY_RESULT::SUCCESS){
 
-        Warlin.writeLine({NameOf(PROTOCOL_RESPONSE_TYPE::ERROR), NameOf(status)});
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, status);
         return;
     }
 
-    Warlin.writeLine({NameOf(PROTOCOL_RESPONSE_TYPE::OTP), code});
+    Warlin.respond(PROTOCOL_RESPONSE_TYPE::OTP, code);
+}
+
+/*
+ * Обработчик для GENERATE_BY_NAME
+ * Аргументы:
+ * - string название ключа
+ * - long текущая метка UNIX
+ * Возвращает OTP
+ * - string одноразовый код
+ * При одинаковых названиях выбирается запись, добавленная раньше
+ */
+void generateByNameHandler(const Packet & params) {
+    if (params.size() < 2){
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, ANSWER_NOT_ENOUGH_PARAMS);
+        return;
+    }
+
+    long currentUtc;
+    if (!params.integer(1, currentUtc)){
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, ANSWER_MALFORMED_NUMBER);
+        return;
+    }
+
+    auto entryId = Salavat.findEntry(params[0]);
+    if (entryId >= Salavat.entryIdCount()){
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, VAULT_GET_KEY_RESULT::NOT_FOUND);
+        return;
+    }
+
+    auto result = Salavat.getKey((int)entryId, currentUtc);
+    if (result.first != VAULT_GET_KEY_RESULT::SUCCESS){
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, result.first);
+        return;
+    }
+
+    Warlin.respond(PROTOCOL_RESPONSE_TYPE::OTP, result.second);
+}
+
+/*
+ * Обработчик для FIND_ENTRIES
+ * Аргументы:
+ * - string начало названия, пустая строка - все записи
+ * Возвращает FOUND, по две части на запись в порядке названий
+ * - int индекс ключа
+ * - string название
+ */
+void findEntriesHandler(const Packet & params) {
+    if (params.size() < 1){
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, ANSWER_NOT_ENOUGH_PARAMS);
+        return;
+    }
+
+    auto & response = Warlin.beginResponse(PROTOCOL_RESPONSE_TYPE::FOUND);
+    Salavat.findEntries(params[0], [&response](std::size_t entryId, std::string_view name){
+        response.append(entryId).append(name);
+    });
+    Warlin.endResponse();
+}
+
+/*
+ * Обработчик для GENERATE_ALL
+ * Аргументы:
+ * - long текущая метка UNIX
+ * Возвращает OTPS
+ * - string[] одноразовые коды всех записей в порядке GET_ENTRIES, у удаленной записи - пустая строка
+ */
+void generateAllHandler(const Packet & params) {
+    if (params.size() < 1){
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, ANSWER_NOT_ENOUGH_PARAMS);
+        return;
+    }
+
+    long currentUtc;
+    if (!params.integer(0, currentUtc)){
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, ANSWER_MALFORMED_NUMBER);
+        return;
+    }
+
+    auto status = Salavat.keysStatus();
+    if (status != VAULT_GET_KEY_RESULT::SUCCESS){
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, status);
+        return;
+    }
+
+    auto & response = Warlin.beginResponse(PROTOCOL_RESPONSE_TYPE::OTPS);
+    Salavat.generateAll(currentUtc, [&response](std::string_view code){
+        response.append(code);
+    });
+    Warlin.endResponse();
 }
 
 /*
@@ -143,58 +354,243 @@ void generateHandler(std::deque<std::string> &params) {
  * Возвращает OTP
  * - string одноразовый код
  */
-void testGenerateOTPByExplicitSecret(std::deque<std::string> &params) {
+void testGenerateOTPByExplicitSecret(const Packet & params) {
     if (params.size() < 2) {
-        Warlin.writeLine({NameOf(PROTOCOL_RESPONSE_TYPE::ERROR), ANSWER_NOT_ENOUGH_PARAMS});
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, ANSWER_NOT_ENOUGH_PARAMS);
         return;
     }
 
-    auto secret = params[0];
-    auto currentUtc = std::stol(params[1]);
+    long currentUtc;
+    if (!params.integer(1, currentUtc)) {
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, ANSWER_MALFORMED_NUMBER);
+        return;
+    }
 
-    auto decoded = decodeBase32Secret(secret);
-    auto decodedPointer = decoded.data();
-    auto decodedLength = decoded.size();
+    uint8_t decoded[TOTP_KEY_SECRET_MAX_BYTES];
+    std::size_t decodedLength;
+    if (!decodeBase32Secret(params[0], decoded, decodedLength)) {
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, VAULT_ADD_ENTRY_RESULT::MALFORMED_SECRET);
+        return;
+    }
 
 #ifdef KEECHAIN_DEBUG_ENABLED
-    SendDebugMessage("Bytes parsed from secret key: ", vectorToHex(decoded).c_str());
+    SendDebugMessage("Bytes parsed from secret key: ", bytesToHex(decoded, decodedLength).c_str());
 #endif
 
-    TOTP totp(decodedPointer, decodedLength);
+    TOTP totp(decoded, decodedLength);
 
     auto code = totp.getCode(currentUtc);
 
-    Warlin.writeLine({NameOf(PROTOCOL_RESPONSE_TYPE::OTP), std::string(code)});
+    Warlin.respond(PROTOCOL_RESPONSE_TYPE::OTP, code);
 }
 
 /*
  * Обработчик для REMOVE_ENTRY
  * Аргументы:
- * - int индекс секрета
- * Возвращает ACK
+ * - int идентификатор записи, идентификаторы остальных записей не меняются
+ * Возвращает ACK. После BEGIN удаление только запоминается до COMMIT
  */
-void removeEntryHandler(std::deque<std::string> &params){
+void removeEntryHandler(const Packet & params){
     if (params.size() < 1) {
-        Warlin.writeLine({NameOf(PROTOCOL_RESPONSE_TYPE::ERROR), ANSWER_NOT_ENOUGH_PARAMS});
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, ANSWER_NOT_ENOUGH_PARAMS);
         return;
     }
 
-    auto index = std::stoi(params[0]);
+    long index;
+    if (!params.integer(0, index)) {
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, ANSWER_MALFORMED_NUMBER);
+        return;
+    }
 
-    auto result = Salavat.removeEntry(index);
+    auto result = Salavat.removeEntry(entryIdArgument(index));
     if (result == VAULT_REMOVE_ENTRY_RESULT::SUCCESS){
-        Warlin.writeLine(NameOf(PROTOCOL_RESPONSE_TYPE::ACK));
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ACK);
+        return;
+    }
+
+    Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, result);
+}
+
+/*
+ * Обработчик для SERVICE_LATENCY
+ * Аргументов нет
+ * Возвращает LATENCY, все времена в микросекундах
+ * - int количество измеренных запросов
+ * - int задержка последнего запроса
+ * - int максимальная задержка
+ * - int средняя задержка
+ */
+void serviceLatencyHandler(const Packet & params){
+    auto& latency = Warlin.latency();
+    auto average = latency.count == 0 ? 0 : latency.total / latency.count;
+
+    Warlin.respond(PROTOCOL_RESPONSE_TYPE::LATENCY, latency.count, latency.last, latency.max, average);
+}
+
+/*
+ * Обработчик для BEGIN
+ * Аргументов нет
+ * Открывает транзакцию: STORE_ENTRY, STORE_ENTRIES и REMOVE_ENTRY до COMMIT копятся в памяти,
+ * GET_ENTRIES и коды по-прежнему отражают сохраненное хранилище. LOCK отменяет транзакцию
+ * Возвращает ACK
+ */
+void beginHandler(const Packet & params){
+    auto result = Salavat.beginTransaction();
+    if (result != VAULT_TRANSACTION_RESULT::SUCCESS){
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, result);
+        return;
+    }
+    Warlin.respond(PROTOCOL_RESPONSE_TYPE::ACK);
+}
+
+/*
+ * Обработчик для COMMIT
+ * Аргументов нет
+ * Записывает все изменения транзакции одной записью журнала: либо все, либо ни одного
+ * Новые записи получают идентификаторы по порядку после существующих
+ * Возвращает ACK, транзакция закрывается и при ошибке
+ */
+void commitHandler(const Packet & params){
+    auto result = Salavat.commitTransaction();
+    if (result != VAULT_TRANSACTION_RESULT::SUCCESS){
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, result);
         return;
     }
+    Warlin.respond(PROTOCOL_RESPONSE_TYPE::ACK);
+}
 
-    Warlin.writeLine({NameOf(PROTOCOL_RESPONSE_TYPE::ERROR), NameOf(result)});
+/*
+ * Обработчик для ROLLBACK
+ * Аргументов нет
+ * Отбрасывает изменения транзакции
+ * Возвращает ACK
+ */
+void rollbackHandler(const Packet & params){
+    auto result = Salavat.rollbackTransaction();
+    if (result != VAULT_TRANSACTION_RESULT::SUCCESS){
+        Warlin.respond(PROTOCOL_RESPONSE_TYPE::ERROR, result);
+        return;
+    }
+    Warlin.respond(PROTOCOL_RESPONSE_TYPE::ACK);
+}
+
+/*
+ * Обработчик для LOCK
+ * Аргументов нет
+ * Блокирует хранилище до следующего UNLOCK, кеш кодов сбрасывается
+ * Возвращает ACK
+ */
+void lockHandler(const Packet & params){
+    Salavat.lock();
+    Warlin.respond(PROTOCOL_RESPONSE_TYPE::ACK);
+}
+
+/*
+ * Обработчик для SERVICE_OTP_CACHE
+ * Аргументов нет
+ * Возвращает OTP_CACHE
+ * - int попадания в кеш кодов
+ * - int промахи
+ */
+void serviceOtpCacheHandler(const Packet & params){
+    auto& cache = Salavat.codeCache();
+    Warlin.respond(PROTOCOL_RESPONSE_TYPE::OTP_CACHE, cache.hits(), cache.misses());
+}
+
+/*
+ * Обработчик для SERVICE_STORAGE
+ * Аргументов нет
+ * Возвращает STORAGE
+ * - int поколение журнала (количество уплотнений)
+ * - int занято байт в активном банке
+ * - int размер банка
+ * - int[] количество стираний каждого банка пула
+ */
+void serviceStorageHandler(const Packet & params){
+    auto& journal = Salavat.journal();
+    auto& response = Warlin.beginResponse(PROTOCOL_RESPONSE_TYPE::STORAGE)
+        .append(journal.generation())
+        .append(journal.used())
+        .append(journal.bankSize());
+    for (std::size_t bank = 0; bank < journal.bankCount(); bank++){
+        response.append(journal.bankErases(bank));
+    }
+    Warlin.endResponse();
+}
+
+/*
+ * Фоновый расчет кодов следующего шага, чтобы запросы на границе 30 секунд отвечались из кеша
+ * Кусок работы прерывается по бюджету PRECOMPUTE_SLICE_MICROS или при приходе данных.
+ * Один расчет HMAC не делится, поэтому бюджет не может быть меньше его длительности
+ */
+bool precomputeTask()
+{
+    const auto start = micros();
+    while (Salavat.precomputeNext()){
+        if (Warlin.available() || micros() - start >= PRECOMPUTE_SLICE_MICROS){
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Отложенное уплотнение журнала, только пока нет входящих данных:
+ * стирание банка занимает заметное время и не делится на куски
+ */
+bool storageTask()
+{
+    if (Warlin.available()){
+        return false;
+    }
+    return Salavat.compactIdle();
+}
+
+/*
+ * Вывод ключа для UNLOCK по кускам итераций PBKDF2, в том же бюджете, что и фоновый расчет кодов
+ */
+bool unlockTask()
+{
+    const auto start = micros();
+    while (Salavat.unlockNext()){
+        if (Warlin.available() || micros() - start >= PRECOMPUTE_SLICE_MICROS){
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Затирание ключей записей, коды которых давно не запрашивались
+ */
+bool keyIdleTask()
+{
+    return Salavat.dropIdleKeys();
+}
+
+/*
+ * Ожидание в простое
+ * На SAMD ядро засыпает до прерывания: USB разбудит при приходе данных, SysTick не реже раза в миллисекунду
+ */
+void idleHook()
+{
+#ifdef ARDUINO_ARCH_SAMD
+    __WFI();
+#endif
 }
 
 //WARLIN<PART>DISCOVER
+//WARLIN<PART>DISCOVER<PART>BINARY
 //WARLIN<PART>SYNC
 //WARLIN<PART>UNLOCK<PART>123
 //WARLIN<PART>STORE_ENTRY<PART>Google<PART>JBSWY3DPEHPK3PXP<PART>6
 //WARLIN<PART>GET_ENTRIES
 //WARLIN<PART>GENERATE<PART>0<PART>1716740958
+//WARLIN<PART>GENERATE_ALL<PART>1716740958
+//WARLIN#7<PART>GENERATE<PART>0<PART>1716740958
 //WARLIN<PART>TEST_EXPLICIT_CODE<PART>JBSWY3DPEHPK3PXP<PART>1716740851
 //WARLIN<PART>REMOVE_ENTRY<PART>0
+//WARLIN<PART>SERVICE_LATENCY
+//WARLIN<PART>SERVICE_OTP_CACHE
+//WARLIN<PART>SERVICE_STORAGE
+//WARLIN<PART>LOCK
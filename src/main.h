@@ -3,24 +3,70 @@
 //
 
 #include "Salavat.h"
+#include "Scheduler.h"
 #include "Warlin.h"
 
 
 #ifndef KEECHAIN_EMBEDDED_MAIN_H
 #define KEECHAIN_EMBEDDED_MAIN_H
 
-void discoverHandler(std::deque<std::string> & params);
-void syncHandler(std::deque<std::string> & params);
-void serviceEEPROMHandler(std::deque<std::string> & params);
-void unlockHandler(std::deque<std::string> & params);
-void getStoredNamesHandler(std::deque<std::string> & params);
-void storeSecretHandler(std::deque<std::string> & params);
-void generateHandler(std::deque<std::string> & params);
-void testGenerateOTPByExplicitSecret(std::deque<std::string> & params);
-void removeEntryHandler(std::deque<std::string> & params);
+void discoverHandler(const Packet & params);
+void syncHandler(const Packet & params);
+void serviceEEPROMHandler(const Packet & params);
+void unlockHandler(const Packet & params);
+void getStoredNamesHandler(const Packet & params);
+void storeSecretHandler(const Packet & params);
+void generateHandler(const Packet & params);
+void testGenerateOTPByExplicitSecret(const Packet & params);
+void removeEntryHandler(const Packet & params);
+void serviceLatencyHandler(const Packet & params);
+void generateAllHandler(const Packet & params);
+void lockHandler(const Packet & params);
+void serviceOtpCacheHandler(const Packet & params);
+void serviceStorageHandler(const Packet & params);
+void generateByNameHandler(const Packet & params);
+void findEntriesHandler(const Packet & params);
+void unlockStatusHandler(const Packet & params);
+void storeEntriesHandler(const Packet & params);
+void beginHandler(const Packet & params);
+void commitHandler(const Packet & params);
+void rollbackHandler(const Packet & params);
+void idleHook();
+bool precomputeTask();
+bool storageTask();
+bool keyIdleTask();
+bool unlockTask();
+
+// Максимальная длительность одного куска фоновой работы, на столько может задержаться обработка входящего кадра
+static constexpr unsigned long PRECOMPUTE_SLICE_MICROS = 2000;
+
+static constexpr auto WarlinHandlers = makeWarlinDispatchTable<
+    WarlinBinding<PROTOCOL_REQUEST_TYPE::DISCOVER, discoverHandler>,
+    WarlinBinding<PROTOCOL_REQUEST_TYPE::SYNC, syncHandler>,
+    WarlinBinding<PROTOCOL_REQUEST_TYPE::SERVICE_TRY_READ_EEPROM, serviceEEPROMHandler>,
+    WarlinBinding<PROTOCOL_REQUEST_TYPE::UNLOCK, unlockHandler>,
+    WarlinBinding<PROTOCOL_REQUEST_TYPE::GET_ENTRIES, getStoredNamesHandler>,
+    WarlinBinding<PROTOCOL_REQUEST_TYPE::STORE_ENTRY, storeSecretHandler>,
+    WarlinBinding<PROTOCOL_REQUEST_TYPE::GENERATE, generateHandler>,
+    WarlinBinding<PROTOCOL_REQUEST_TYPE::TEST_EXPLICIT_CODE, testGenerateOTPByExplicitSecret>,
+    WarlinBinding<PROTOCOL_REQUEST_TYPE::REMOVE_ENTRY, removeEntryHandler>,
+    WarlinBinding<PROTOCOL_REQUEST_TYPE::SERVICE_LATENCY, serviceLatencyHandler>,
+    WarlinBinding<PROTOCOL_REQUEST_TYPE::GENERATE_ALL, generateAllHandler>,
+    WarlinBinding<PROTOCOL_REQUEST_TYPE::LOCK, lockHandler>,
+    WarlinBinding<PROTOCOL_REQUEST_TYPE::SERVICE_OTP_CACHE, serviceOtpCacheHandler>,
+    WarlinBinding<PROTOCOL_REQUEST_TYPE::SERVICE_STORAGE, serviceStorageHandler>,
+    WarlinBinding<PROTOCOL_REQUEST_TYPE::GENERATE_BY_NAME, generateByNameHandler>,
+    WarlinBinding<PROTOCOL_REQUEST_TYPE::FIND_ENTRIES, findEntriesHandler>,
+    WarlinBinding<PROTOCOL_REQUEST_TYPE::UNLOCK_STATUS, unlockStatusHandler>,
+    WarlinBinding<PROTOCOL_REQUEST_TYPE::STORE_ENTRIES, storeEntriesHandler>,
+    WarlinBinding<PROTOCOL_REQUEST_TYPE::BEGIN, beginHandler>,
+    WarlinBinding<PROTOCOL_REQUEST_TYPE::COMMIT, commitHandler>,
+    WarlinBinding<PROTOCOL_REQUEST_TYPE::ROLLBACK, rollbackHandler>
+>();
 
 Warlin_ Warlin;
 Salavat_ Salavat;
+Scheduler_ Scheduler;
 
 void setup() {
     Serial.begin(DEFAULT_BAUDRATE);
@@ -29,28 +75,24 @@ void setup() {
 
     }
 
-    Warlin.bind(PROTOCOL_REQUEST_TYPE::DISCOVER, discoverHandler);
-    Warlin.bind(PROTOCOL_REQUEST_TYPE::SYNC, syncHandler);
-    Warlin.bind(PROTOCOL_REQUEST_TYPE::SERVICE_TRY_READ_EEPROM, serviceEEPROMHandler);
-    Warlin.bind(PROTOCOL_REQUEST_TYPE::UNLOCK, unlockHandler);
-    Warlin.bind(PROTOCOL_REQUEST_TYPE::GET_ENTRIES, getStoredNamesHandler);
-    Warlin.bind(PROTOCOL_REQUEST_TYPE::STORE_ENTRY, storeSecretHandler);
-    Warlin.bind(PROTOCOL_REQUEST_TYPE::GENERATE, generateHandler);
-    Warlin.bind(PROTOCOL_REQUEST_TYPE::TEST_EXPLICIT_CODE, testGenerateOTPByExplicitSecret);
-    Warlin.bind(PROTOCOL_REQUEST_TYPE::REMOVE_ENTRY, removeEntryHandler);
+    Warlin.bind(WarlinHandlers);
+
+    Scheduler.onEvent([]{ return Warlin.available(); }, []{ Warlin.process(); });
+    Scheduler.addTask(precomputeTask);
+    Scheduler.addTask(storageTask);
+    Scheduler.addTask(keyIdleTask);
+    Scheduler.addTask(unlockTask);
+    Scheduler.setIdleHook(idleHook);
 }
 
 void loop() {
-    if (Warlin.available())
-    {
-        Warlin.process();
-    }
-
-    delay(100);
+    Scheduler.run();
 }
 
 #define ANSWER_INIT_MALFORMED "INIT_MALFORMED"
 #define ANSWER_NOT_ENOUGH_PARAMS "NOT_ENOUGH_PARAMS"
 #define ANSWER_INVALID_INDEX "INVALID_INDEX"
+#define ANSWER_MALFORMED_NUMBER "MALFORMED_NUMBER"
+#define FRAMING_BINARY "BINARY"
 
 #endif //KEECHAIN_EMBEDDED_MAIN_H
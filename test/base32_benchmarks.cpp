@@ -0,0 +1,72 @@
+#include <unity.h>
+#include <Base32.h>
+#include <cstdlib>
+#include <cstring>
+#include "benchmark.h"
+
+static constexpr auto BENCHMARK_ITERATIONS = 100000;
+
+// Декодер прежней библиотеки Base32 без Arduino: ветвления на каждый символ и два malloc на вызов
+static int legacyFromBase32(const uint8_t * in, long length, uint8_t *& out){
+    int result = 0;
+    int buffer = 0;
+    int bitsLeft = 0;
+    auto temp = (uint8_t *)malloc(length);
+
+    for (int i = 0; i < length; i++){
+        uint8_t ch = in[i];
+        if (ch == 0xA0 || ch == 0x09 || ch == 0x0A || ch == 0x0D || ch == 0x3D) continue;
+        if (ch == 0x30) { ch = 0x4F; } else if (ch == 0x31) { ch = 0x4C; } else if (ch == 0x38) { ch = 0x42; }
+        if ((ch >= 0x41 && ch <= 0x5A) || (ch >= 0x61 && ch <= 0x7A)) { ch = ((ch & 0x1F) - 1); }
+        else if (ch >= 0x32 && ch <= 0x37) { ch -= (0x32 - 26); }
+        else { free(temp); return 0; }
+
+        buffer <<= 5;
+        buffer |= ch;
+        bitsLeft += 5;
+        if (bitsLeft >= 8){
+            temp[result++] = (uint8_t)((unsigned int)(buffer >> (bitsLeft - 8)) & 0xFF);
+            bitsLeft -= 8;
+        }
+    }
+
+    out = (uint8_t *)malloc(result);
+    memcpy(out, temp, result);
+    free(temp);
+    return result;
+}
+
+// Самый длинный секрет записи (50 символов) прежним декодером и табличным, время и выделения памяти
+void benchmark_base32_decode(void){
+    static const char secret[] = "JBSWY3DPEHPK3PXPJBSWY3DPEHPK3PXPJBSWY3DPEHPK3PXPJB";
+    const auto secretLength = strlen(secret);
+    std::size_t sink = 0;
+
+    auto legacyNanos = benchmarkNanos(BENCHMARK_ITERATIONS, [&](std::size_t){
+        uint8_t * out = nullptr;
+        sink += legacyFromBase32(reinterpret_cast<const uint8_t *>(secret), secretLength, out);
+        sink += out[0];
+        free(out);
+    });
+
+    uint8_t decoded[base32DecodedLength(sizeof(secret) - 1)];
+    std::size_t length;
+    auto allocationsBefore = benchmarkAllocations;
+    auto tableNanos = benchmarkNanos(BENCHMARK_ITERATIONS, [&](std::size_t){
+        sink += base32Decode(std::string_view(secret, secretLength), decoded, sizeof(decoded), length);
+        sink += length + decoded[0];
+    });
+    TEST_ASSERT_EQUAL(allocationsBefore, benchmarkAllocations);
+
+    char encoded[base32EncodedLength(sizeof(decoded))];
+    auto encodeNanos = benchmarkNanos(BENCHMARK_ITERATIONS, [&](std::size_t i){
+        decoded[0] = (uint8_t)i;
+        sink += base32Encode(decoded, sizeof(decoded), encoded, sizeof(encoded));
+    });
+    // Первый байт менялся в цикле, в последнем символе отброшенные при декодировании биты
+    TEST_ASSERT_EQUAL_MEMORY(secret + 2, encoded + 2, sizeof(encoded) - 3);
+
+    printf("base32: decode 50 symbols legacy %.0f ns (2 malloc), table %.0f ns (0 malloc); encode 31 bytes %.0f ns\n",
+           legacyNanos, tableNanos, encodeNanos);
+    TEST_ASSERT_GREATER_THAN(0, sink);
+}
@@ -0,0 +1,127 @@
+#include <unity.h>
+#include <Base32.h>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+// RFC 4648, раздел 10
+static const char * const RFC4648_PLAIN[] = {"", "f", "fo", "foo", "foob", "fooba", "foobar"};
+static const char * const RFC4648_PADDED[] = {"", "MY======", "MZXQ====", "MZXW6===", "MZXW6YQ=", "MZXW6YTB", "MZXW6YTBOI======"};
+
+// Кодирование по одному биту, как в тексте RFC, для сверки в случайных прогонах
+static std::string referenceEncode(const uint8_t * in, std::size_t length){
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+    std::string out;
+    for (std::size_t bit = 0; bit < length * 8; bit += 5){
+        uint8_t value = 0;
+        for (std::size_t i = bit; i < bit + 5; i++){
+            auto set = i < length * 8 && (in[i / 8] >> (7 - i % 8)) & 1;
+            value = (uint8_t)(value << 1 | set);
+        }
+        out += alphabet[value];
+    }
+    return out;
+}
+
+static uint32_t xorshift(uint32_t & state){
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+void test_base32_rfc4648_vectors(void){
+    char encoded[16];
+    uint8_t decoded[8];
+    std::size_t length;
+
+    for (std::size_t i = 0; i < sizeof(RFC4648_PLAIN) / sizeof(RFC4648_PLAIN[0]); i++){
+        const auto plain = reinterpret_cast<const uint8_t *>(RFC4648_PLAIN[i]);
+        const auto plainLength = strlen(RFC4648_PLAIN[i]);
+        const std::string_view padded = RFC4648_PADDED[i];
+
+        TEST_ASSERT_EQUAL(padded.size(), base32EncodedLength(plainLength, true));
+        TEST_ASSERT_EQUAL(padded.size(), base32Encode(plain, plainLength, encoded, sizeof(encoded), true));
+        TEST_ASSERT_EQUAL_MEMORY(padded.data(), encoded, padded.size());
+
+        const auto bare = padded.substr(0, padded.find('='));
+        TEST_ASSERT_EQUAL(bare.size(), base32EncodedLength(plainLength));
+        TEST_ASSERT_EQUAL(bare.size(), base32Encode(plain, plainLength, encoded, sizeof(encoded)));
+        TEST_ASSERT_EQUAL_MEMORY(bare.data(), encoded, bare.size());
+
+        TEST_ASSERT_TRUE(base32Decode(padded, decoded, sizeof(decoded), length));
+        TEST_ASSERT_EQUAL(plainLength, length);
+        TEST_ASSERT_EQUAL_MEMORY(plain, decoded, length);
+        TEST_ASSERT_EQUAL(plainLength, base32DecodedLength(bare.size()));
+    }
+
+    // Буфер на символ короче точной длины: ничего не пишется
+    TEST_ASSERT_EQUAL(0, base32Encode(reinterpret_cast<const uint8_t *>("foobar"), 6, encoded, 15, true));
+}
+
+// Ввод пользователя: регистр, пробелы, опечатки, мусор и нехватка места
+void test_base32_decode_lenient(void){
+    uint8_t decoded[8];
+    std::size_t length;
+
+    TEST_ASSERT_TRUE(base32Decode("mzxw 6ytb\r\noi", decoded, sizeof(decoded), length));
+    TEST_ASSERT_EQUAL(6, length);
+    TEST_ASSERT_EQUAL_MEMORY("foobar", decoded, length);
+
+    // 0, 1, 8 - это O, L, B
+    uint8_t typo[8];
+    std::size_t typoLength;
+    TEST_ASSERT_TRUE(base32Decode("MZXW6YTB0I", typo, sizeof(typo), typoLength));
+    TEST_ASSERT_TRUE(base32Decode("MZXW6YTBOI", decoded, sizeof(decoded), length));
+    TEST_ASSERT_EQUAL(length, typoLength);
+    TEST_ASSERT_EQUAL_MEMORY(decoded, typo, length);
+    TEST_ASSERT_TRUE(base32Decode("1A8", typo, sizeof(typo), typoLength));
+    TEST_ASSERT_TRUE(base32Decode("LAB", decoded, sizeof(decoded), length));
+    TEST_ASSERT_EQUAL_MEMORY(decoded, typo, length);
+
+    TEST_ASSERT_FALSE(base32Decode("MZXW9", decoded, sizeof(decoded), length));
+    TEST_ASSERT_FALSE(base32Decode(std::string_view("MZ\0W", 4), decoded, sizeof(decoded), length));
+    TEST_ASSERT_FALSE(base32Decode("MZXW6YTBOI", decoded, 5, length));
+    TEST_ASSERT_TRUE(base32Decode("MZXW6YTBOI", decoded, 6, length));
+}
+
+/*
+ * Случайные данные: кодирование сверяется с побитовой реализацией, декодирование возвращает исходные байты
+ * Случайные строки: декодер принимает их тогда и только тогда, когда в них нет символов вне алфавита
+ */
+void test_base32_fuzz(void){
+    uint32_t state = 0x4B454543;
+    uint8_t plain[64];
+    char encoded[base32EncodedLength(sizeof(plain), true)];
+    uint8_t decoded[sizeof(plain)];
+    std::size_t length;
+
+    for (int round = 0; round < 2000; round++){
+        const auto plainLength = xorshift(state) % (sizeof(plain) + 1);
+        for (std::size_t i = 0; i < plainLength; i++){
+            plain[i] = (uint8_t)xorshift(state);
+        }
+        const auto padding = (round & 1) != 0;
+        const auto written = base32Encode(plain, plainLength, encoded, sizeof(encoded), padding);
+        TEST_ASSERT_EQUAL(base32EncodedLength(plainLength, padding), written);
+
+        const auto expected = referenceEncode(plain, plainLength);
+        TEST_ASSERT_EQUAL_MEMORY(expected.data(), encoded, expected.size());
+
+        TEST_ASSERT_TRUE(base32Decode(std::string_view(encoded, written), decoded, sizeof(decoded), length));
+        TEST_ASSERT_EQUAL(plainLength, length);
+        TEST_ASSERT_EQUAL_MEMORY(plain, decoded, length);
+    }
+
+    static const std::string_view accepted = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz234567018 \t\r\n=\xA0";
+    char noise[24];
+    for (int round = 0; round < 2000; round++){
+        auto valid = true;
+        for (auto & ch : noise){
+            ch = (char)(round & 1 ? accepted[xorshift(state) % accepted.size()] : xorshift(state));
+            valid = valid && accepted.find(ch) != std::string_view::npos;
+        }
+        TEST_ASSERT_EQUAL(valid, base32Decode(std::string_view(noise, sizeof(noise)), decoded, sizeof(decoded), length));
+        TEST_ASSERT_LESS_OR_EQUAL(base32DecodedLength(sizeof(noise)), length);
+    }
+}
@@ -0,0 +1,68 @@
+// Вспомогательные средства для хостовых бенчмарков
+#ifndef KEECHAIN_BENCHMARK_H_GUARD
+#define KEECHAIN_BENCHMARK_H_GUARD
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+
+// Количество вызовов operator new с начала работы тестов, считается в test_main.cpp
+extern std::size_t benchmarkAllocations;
+
+// Сумма запрошенных у operator new байт, без учета освобождений
+extern std::size_t benchmarkAllocatedBytes;
+
+/*
+ * Сделать память по адресу data видимой для компилятора: результат, записанный перед вызовом, считается прочитанным,
+ * и вычисление не выбрасывается и не выносится из цикла бенчмарка
+ */
+inline void benchmarkDoNotOptimize(const void * data)
+{
+#if defined(__GNUC__)
+    asm volatile("" : : "r"(data) : "memory");
+#else
+    static const void * volatile sink;
+    sink = data;
+#endif
+}
+
+// Среднее время одной итерации func в наносекундах
+template<typename Func>
+double benchmarkNanos(std::size_t iterations, Func func)
+{
+    auto begin = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < iterations; i++)
+    {
+        func(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - begin).count() / (double)iterations;
+}
+
+/*
+ * Счетчик тактов процессора, если он доступен на хосте (x86 TSC), иначе 0
+ * Такты TSC идут с номинальной частотой, поэтому сравнивать стоит только замеры одного запуска
+ */
+inline unsigned long long benchmarkCycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Среднее количество тактов на итерацию func, 0 без счетчика тактов
+template<typename Func>
+double benchmarkCyclesPerIteration(std::size_t iterations, Func func)
+{
+    auto begin = benchmarkCycles();
+    for (std::size_t i = 0; i < iterations; i++)
+    {
+        func(i);
+    }
+    return (double)(benchmarkCycles() - begin) / (double)iterations;
+}
+
+#endif // Guard
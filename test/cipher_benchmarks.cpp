@@ -0,0 +1,84 @@
+#include <unity.h>
+#include <Cipher.h>
+#include <algorithm>
+#include <vector>
+#include "benchmark.h"
+
+static constexpr auto BENCHMARK_ITERATIONS = 20000;
+
+// Шифр первой версии: побайтный XOR с хешем пароля и взятие остатка на каждом байте
+static void legacyXor(const uint8_t * key, std::size_t keyLength, const uint8_t * in, uint8_t * out, std::size_t length){
+    std::size_t keyIndex = 0;
+    for (std::size_t i = 0; i < length; i++){
+        out[i] = in[i] ^ key[keyIndex];
+        keyIndex = (keyIndex + 1) % keyLength;
+    }
+}
+
+/*
+ * Байт за такт для гаммы ChaCha20 и XOR первой версии, и время открытия секрета записи
+ * Открытие с чужим тегом должно стоить столько же, сколько с верным: тег сравнивается за постоянное время
+ */
+void benchmark_cipher_throughput(void){
+    uint8_t key[CHACHA20_KEY_LENGTH];
+    uint8_t nonce[CHACHA20_NONCE_LENGTH] = {};
+    for (std::size_t i = 0; i < sizeof(key); i++){
+        key[i] = (uint8_t)(i * 13 + 1);
+    }
+    std::vector<uint8_t> data(4096, 0x5A);
+
+    // Весь буфер после каждого прохода считается прочитанным, иначе проходы XOR сворачиваются или выбрасываются
+    auto legacyPass = [&](std::size_t){
+        benchmarkDoNotOptimize(key);
+        legacyXor(key, 20, data.data(), data.data(), data.size());
+        benchmarkDoNotOptimize(data.data());
+    };
+    auto chachaPass = [&](std::size_t i){
+        benchmarkDoNotOptimize(key);
+        chacha20Xor(key, 1 + (uint32_t)i, nonce, data.data(), data.data(), data.size());
+        benchmarkDoNotOptimize(data.data());
+    };
+    // Такты TSC сверяются со временем: оба замера должны давать одно соотношение
+    auto legacyCycles = benchmarkCyclesPerIteration(BENCHMARK_ITERATIONS / 10, legacyPass);
+    auto chachaCycles = benchmarkCyclesPerIteration(BENCHMARK_ITERATIONS / 10, chachaPass);
+    auto legacyNanos = benchmarkNanos(BENCHMARK_ITERATIONS / 10, legacyPass);
+    auto chachaNanos = benchmarkNanos(BENCHMARK_ITERATIONS / 10, chachaPass);
+
+    // Самый длинный секрет записи: 50 символов Base32 - 31 байт
+    uint8_t secret[31];
+    for (std::size_t i = 0; i < sizeof(secret); i++){
+        secret[i] = (uint8_t)i;
+    }
+    uint8_t sealed[sizeof(secret) + SEALED_SECRET_OVERHEAD];
+    sealSecret(key, nonce, "Account 299", secret, sizeof(secret), sealed);
+    const std::string_view valid(reinterpret_cast<const char *>(sealed), sizeof(sealed));
+
+    // Тег испорчен в первом и в последнем байте: время отказа не должно зависеть от места расхождения
+    uint8_t forgedFirst[sizeof(sealed)];
+    uint8_t forgedLast[sizeof(sealed)];
+    std::copy(sealed, sealed + sizeof(sealed), forgedFirst);
+    std::copy(sealed, sealed + sizeof(sealed), forgedLast);
+    forgedFirst[sizeof(sealed) - POLY1305_TAG_LENGTH] ^= 0x80;
+    forgedLast[sizeof(sealed) - 1] ^= 0x80;
+
+    uint8_t plain[sizeof(secret)];
+    std::size_t length;
+    std::size_t opened = 0;
+    auto openNanos = benchmarkNanos(BENCHMARK_ITERATIONS, [&](std::size_t){
+        opened += openSecret(key, valid, "Account 299", plain, length);
+    });
+    auto forgedFirstNanos = benchmarkNanos(BENCHMARK_ITERATIONS, [&](std::size_t){
+        opened += openSecret(key, std::string_view(reinterpret_cast<const char *>(forgedFirst), sizeof(sealed)), "Account 299", plain, length);
+    });
+    auto forgedLastNanos = benchmarkNanos(BENCHMARK_ITERATIONS, [&](std::size_t){
+        opened += openSecret(key, std::string_view(reinterpret_cast<const char *>(forgedLast), sizeof(sealed)), "Account 299", plain, length);
+    });
+    TEST_ASSERT_EQUAL(BENCHMARK_ITERATIONS, opened);
+
+    printf("cipher: legacy xor %.2f ns/byte, chacha20 %.2f ns/byte; ", legacyNanos / data.size(), chachaNanos / data.size());
+    if (legacyCycles > 0){
+        printf("legacy xor %.2f bytes/cycle, chacha20 %.2f bytes/cycle; ",
+               data.size() / legacyCycles, data.size() / chachaCycles);
+    }
+    printf("open 31-byte secret %.0f ns, forged tag first byte %.0f ns, last byte %.0f ns\n", openNanos, forgedFirstNanos, forgedLastNanos);
+}
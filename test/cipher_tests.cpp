@@ -0,0 +1,136 @@
+#include <unity.h>
+#include <Cipher.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static std::vector<uint8_t> fromHex(const char * hex){
+    std::vector<uint8_t> bytes;
+    auto nibble = [](char c){ return (uint8_t)(c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10); };
+    for (; hex[0] && hex[1]; hex += 2){
+        bytes.push_back((uint8_t)(nibble(hex[0]) << 4 | nibble(hex[1])));
+    }
+    return bytes;
+}
+
+static std::vector<uint8_t> sequence(uint8_t first, std::size_t length){
+    std::vector<uint8_t> bytes(length);
+    for (std::size_t i = 0; i < length; i++){
+        bytes[i] = (uint8_t)(first + i);
+    }
+    return bytes;
+}
+
+static const char SUNSCREEN[] = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+
+// RFC 8439, 2.3.2 и 2.4.2
+void test_cipher_chacha20_vectors(void){
+    const auto key = sequence(0, CHACHA20_KEY_LENGTH);
+    const auto blockNonce = fromHex("000000090000004a00000000");
+    uint8_t block[CHACHA20_BLOCK_LENGTH];
+    chacha20Block(key.data(), 1, blockNonce.data(), block);
+    const auto expectedBlock = fromHex(
+        "10f1e7e4d13b5915500fdd1fa32071c4c7d1f4c733c068030422aa9ac3d46c4e"
+        "d2826446079faa0914c2d705d98b02a2b5129cd1de164eb9cbd083e8a2503c4e");
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expectedBlock.data(), block, sizeof(block));
+
+    const auto nonce = fromHex("000000000000004a00000000");
+    const auto length = strlen(SUNSCREEN);
+    std::vector<uint8_t> cipher(length);
+    chacha20Xor(key.data(), 1, nonce.data(), reinterpret_cast<const uint8_t *>(SUNSCREEN), cipher.data(), length);
+    const auto expected = fromHex(
+        "6e2e359a2568f98041ba0728dd0d6981e97e7aec1d4360c20a27afccfd9fae0b"
+        "f91b65c5524733ab8f593dabcd62b3571639d624e65152ab8f530c359f0861d8"
+        "07ca0dbf500d6a6156a38e088a22b65e52bc514d16ccf806818ce91ab7793736"
+        "5af90bbf74a35be6b40b8eedf2785e42874d");
+    TEST_ASSERT_EQUAL(expected.size(), length);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected.data(), cipher.data(), length);
+
+    // Расшифровка на месте, хвост короче слова
+    chacha20Xor(key.data(), 1, nonce.data(), cipher.data(), cipher.data(), length);
+    TEST_ASSERT_EQUAL_MEMORY(SUNSCREEN, cipher.data(), length);
+}
+
+// RFC 8439, 2.5.2. Данные подаются кусками, чтобы проверить буферизацию
+void test_cipher_poly1305_vector(void){
+    const auto key = fromHex("85d6be7857556d337f4452fe42d506a80103808afb0db2fd4abff6af4149f51b");
+    const std::string message = "Cryptographic Forum Research Group";
+    uint8_t tag[POLY1305_TAG_LENGTH];
+
+    Poly1305Context poly;
+    poly.init(key.data());
+    poly.update(reinterpret_cast<const uint8_t *>(message.data()), 5);
+    poly.update(reinterpret_cast<const uint8_t *>(message.data()) + 5, 20);
+    poly.update(reinterpret_cast<const uint8_t *>(message.data()) + 25, message.size() - 25);
+    poly.finish(tag);
+
+    const auto expected = fromHex("a8061dc1305136c6c22b8baf0c0127a9");
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected.data(), tag, sizeof(tag));
+}
+
+// RFC 8439, 2.8.2: шифрование, тег и отказ при любой порче
+void test_cipher_aead_vector(void){
+    const auto key = sequence(0x80, CHACHA20_KEY_LENGTH);
+    const auto nonce = fromHex("070000004041424344454647");
+    const auto aad = fromHex("50515253c0c1c2c3c4c5c6c7");
+    const auto length = strlen(SUNSCREEN);
+
+    std::vector<uint8_t> cipher(length);
+    uint8_t tag[POLY1305_TAG_LENGTH];
+    chacha20Poly1305Seal(key.data(), nonce.data(), aad.data(), aad.size(),
+                         reinterpret_cast<const uint8_t *>(SUNSCREEN), length, cipher.data(), tag);
+
+    const auto expectedHead = fromHex("d31a8d34648e60db7b86afbc53ef7ec2");
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expectedHead.data(), cipher.data(), expectedHead.size());
+    const auto expectedTag = fromHex("1ae10b594f09e26a7e902ecbd0600691");
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expectedTag.data(), tag, sizeof(tag));
+
+    std::vector<uint8_t> plain(length);
+    TEST_ASSERT_TRUE(chacha20Poly1305Open(key.data(), nonce.data(), aad.data(), aad.size(), cipher.data(), length, tag, plain.data()));
+    TEST_ASSERT_EQUAL_MEMORY(SUNSCREEN, plain.data(), length);
+
+    cipher[length - 1] ^= 0x01;
+    TEST_ASSERT_FALSE(chacha20Poly1305Open(key.data(), nonce.data(), aad.data(), aad.size(), cipher.data(), length, tag, plain.data()));
+    TEST_ASSERT_EACH_EQUAL_UINT8(0, plain.data(), length);
+    cipher[length - 1] ^= 0x01;
+
+    TEST_ASSERT_FALSE(chacha20Poly1305Open(key.data(), nonce.data(), aad.data(), aad.size() - 1, cipher.data(), length, tag, plain.data()));
+}
+
+// Секрет записи: привязка к имени, неверный ключ и перенос из XOR первой версии
+void test_cipher_sealed_secret(void){
+    const auto key = sequence(1, CHACHA20_KEY_LENGTH);
+    const auto nonce = sequence(0x40, CHACHA20_NONCE_LENGTH);
+    const auto secret = sequence(0xA0, 20);
+
+    uint8_t sealed[20 + SEALED_SECRET_OVERHEAD];
+    TEST_ASSERT_EQUAL(sizeof(sealed), sealSecret(key.data(), nonce.data(), "GitHub", secret.data(), secret.size(), sealed));
+    TEST_ASSERT_EQUAL_MEMORY(nonce.data(), sealed, CHACHA20_NONCE_LENGTH);
+
+    const std::string_view view(reinterpret_cast<const char *>(sealed), sizeof(sealed));
+    uint8_t plain[UINT8_MAX];
+    std::size_t length = 0;
+    TEST_ASSERT_TRUE(openSecret(key.data(), view, "GitHub", plain, length));
+    TEST_ASSERT_EQUAL(secret.size(), length);
+    TEST_ASSERT_EQUAL_MEMORY(secret.data(), plain, length);
+
+    TEST_ASSERT_FALSE(openSecret(key.data(), view, "Gitea", plain, length));
+    const auto otherKey = sequence(2, CHACHA20_KEY_LENGTH);
+    TEST_ASSERT_FALSE(openSecret(otherKey.data(), view, "GitHub", plain, length));
+    TEST_ASSERT_FALSE(openSecret(key.data(), view.substr(0, SEALED_SECRET_OVERHEAD - 1), "GitHub", plain, length));
+
+    // Секрет первой версии: маркеры и XOR с хешем пароля по кругу
+    const auto passwordHash = sequence(0x11, 20);
+    std::vector<uint8_t> framed = {0xFF, 0xFA};
+    framed.insert(framed.end(), secret.begin(), secret.end());
+    framed.push_back(0xFA);
+    framed.push_back(0xFF);
+    std::string legacy(framed.size(), '\0');
+    for (std::size_t i = 0; i < framed.size(); i++){
+        legacy[i] = (char)(framed[i] ^ passwordHash[i % passwordHash.size()]);
+    }
+    TEST_ASSERT_TRUE(openLegacySecret(legacy, passwordHash.data(), passwordHash.size(), plain, length));
+    TEST_ASSERT_EQUAL(secret.size(), length);
+    TEST_ASSERT_EQUAL_MEMORY(secret.data(), plain, length);
+    TEST_ASSERT_FALSE(openLegacySecret(legacy, otherKey.data(), passwordHash.size(), plain, length));
+}
@@ -0,0 +1,80 @@
+#include <unity.h>
+#include <EnumReflection.h>
+#include "benchmark.h"
+
+Z_ENUM_NS(
+    TEST_REFLECTION_ENUM,
+    FIRST,
+    SECOND,
+    THIRD
+)
+
+Z_ENUM_NS(
+    TEST_REFLECTION_REQUEST,
+    DISCOVER,
+    SYNC,
+    UNLOCK,
+    GET_ENTRIES,
+    STORE_ENTRY,
+    REMOVE_ENTRY,
+    GENERATE,
+    TEST_EXPLICIT_CODE,
+    SERVICE_TRY_READ_EEPROM,
+    SERVICE_LATENCY
+)
+
+static_assert(EnumCount<TEST_REFLECTION_ENUM>() == 3, "EnumCount must be a constant expression");
+static_assert(NameOf(TEST_REFLECTION_ENUM::SECOND) == "SECOND", "NameOf must be a constant expression");
+
+static constexpr auto BENCHMARK_ITERATIONS = 200000;
+
+void test_enum_reflection_count(void){
+    auto& reflector = EnumReflector::For<TEST_REFLECTION_ENUM>();
+    TEST_ASSERT_EQUAL(reflector.Count(), EnumCount<TEST_REFLECTION_ENUM>());
+    TEST_ASSERT_TRUE(reflector.Find("THIRD").IsValid());
+    TEST_ASSERT_FALSE(reflector.Find("FOURTH").IsValid());
+}
+
+void test_enum_reflection_constexpr_names(void){
+    auto& reflector = EnumReflector::For<TEST_REFLECTION_REQUEST>();
+    for (const auto& enumerator : reflector){
+        auto value = static_cast<TEST_REFLECTION_REQUEST>(enumerator.Value());
+        TEST_ASSERT_TRUE(NameOf(value) == enumerator.Name());
+
+        TEST_REFLECTION_REQUEST found;
+        TEST_ASSERT_TRUE(EnumFromName(enumerator.Name(), found));
+        TEST_ASSERT_TRUE(found == value);
+    }
+
+    TEST_REFLECTION_REQUEST found;
+    TEST_ASSERT_FALSE(EnumFromName("", found));
+    TEST_ASSERT_FALSE(EnumFromName("GENERATE_", found));
+    TEST_ASSERT_FALSE(EnumFromName("generate", found));
+    TEST_ASSERT_TRUE(NameOf(static_cast<TEST_REFLECTION_REQUEST>(200)).empty());
+}
+
+void benchmark_enum_reflection_lookup(void){
+    static const std::string_view names[] = { "DISCOVER", "GENERATE", "SERVICE_LATENCY", "UNKNOWN" };
+    std::size_t sink = 0;
+
+    auto& reflector = EnumReflector::For<TEST_REFLECTION_REQUEST>();
+    auto linearNanos = benchmarkNanos(BENCHMARK_ITERATIONS, [&](std::size_t i){
+        sink += reflector.Find(names[i & 3]).Index();
+    });
+
+    auto hashNanos = benchmarkNanos(BENCHMARK_ITERATIONS, [&](std::size_t i){
+        TEST_REFLECTION_REQUEST found;
+        sink += EnumFromName(names[i & 3], found) ? static_cast<std::size_t>(found) : 0;
+    });
+
+    auto allocations = benchmarkAllocations;
+    auto nameNanos = benchmarkNanos(BENCHMARK_ITERATIONS, [&](std::size_t i){
+        sink += NameOf(static_cast<TEST_REFLECTION_REQUEST>(i % 10)).size();
+    });
+    allocations = benchmarkAllocations - allocations;
+
+    printf("enum lookup: linear Find %.1f ns/op, perfect hash %.1f ns/op, NameOf %.1f ns/op (%zu)\n",
+           linearNanos, hashNanos, nameNanos, sink);
+
+    TEST_ASSERT_EQUAL(0, allocations);
+}
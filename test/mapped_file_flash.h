@@ -0,0 +1,49 @@
+// Образ флеш-памяти из файла, отображенного в память, для хостовых тестов хранилища
+#ifndef KEECHAIN_MAPPED_FILE_FLASH_H_GUARD
+#define KEECHAIN_MAPPED_FILE_FLASH_H_GUARD
+#pragma once
+
+#include <VaultStorage.h>
+#include <sys/mman.h>
+
+/*
+ * Файл через mmap только для чтения, как область флеш-памяти на SAMD
+ * Стирание и запись не поддерживаются: журнал можно открыть и проиграть, но не изменить
+ */
+class MappedFileFlash : public FlashDevice
+{
+    public:
+        MappedFileFlash(int descriptor, std::size_t length, std::size_t rowBytes = 256)
+            : length(length), rowBytes(rowBytes)
+        {
+            auto mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            memory = mapped == MAP_FAILED ? nullptr : static_cast<const uint8_t *>(mapped);
+        }
+
+        ~MappedFileFlash() override
+        {
+            if (memory != nullptr)
+            {
+                munmap(const_cast<uint8_t *>(memory), length);
+            }
+        }
+
+        MappedFileFlash(const MappedFileFlash &) = delete;
+        MappedFileFlash & operator=(const MappedFileFlash &) = delete;
+
+        bool mapped() const { return memory != nullptr; }
+
+        const uint8_t * image() const override { return memory; }
+        std::size_t size() const override { return memory != nullptr ? length : 0; }
+        std::size_t rowSize() const override { return rowBytes; }
+
+        bool erase(std::size_t, std::size_t) override { return false; }
+        bool program(std::size_t, const void *, std::size_t) override { return false; }
+
+    private:
+        const uint8_t * memory = nullptr;
+        std::size_t length;
+        std::size_t rowBytes;
+};
+
+#endif // Guard
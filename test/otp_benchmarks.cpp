@@ -0,0 +1,171 @@
+#include <unity.h>
+#include <Otp.h>
+#include <Packet.h>
+#include <cstring>
+#include <vector>
+#include "benchmark.h"
+
+static constexpr auto BENCHMARK_ROUNDS = 2000;
+
+static std::size_t wireBytes = 0;
+static std::size_t wireFrames = 0;
+
+static void wireSink(const char *, std::size_t length){
+    wireBytes += length;
+    wireFrames++;
+}
+
+static std::vector<std::vector<uint8_t>> makeSecrets(std::size_t count){
+    std::vector<std::vector<uint8_t>> secrets(count);
+    for (std::size_t i = 0; i < count; i++){
+        secrets[i].resize(10 + i % 10);
+        for (std::size_t b = 0; b < secrets[i].size(); b++){
+            secrets[i][b] = (uint8_t)(i * 31 + b);
+        }
+    }
+    return secrets;
+}
+
+/*
+ * Полный цикл на стороне устройства: разбор текстового запроса, расчет кода, сборка ответа.
+ * Запросы хоста тоже собираются PacketWriter, чтобы учесть байты в обе стороны
+ */
+static void benchmarkGenerate(std::size_t entries){
+    auto secrets = makeSecrets(entries);
+    PacketWriter writer("WARLIN", "<PART>", wireSink);
+    Packet packet;
+    const long utc = 1716740958L;
+    char code[OTP_CODE_LENGTH + 1];
+    char request[PACKET_MAX_LENGTH];
+
+    wireBytes = wireFrames = 0;
+    auto singleNanos = benchmarkNanos(BENCHMARK_ROUNDS, [&](std::size_t){
+        for (std::size_t i = 0; i < entries; i++){
+            auto length = (std::size_t)snprintf(request, sizeof(request), "WARLIN<PART>GENERATE<PART>%zu<PART>%ld", i, utc);
+            wireBytes += length + 1;
+            splitPacket(std::string_view(request, length), "<PART>", packet);
+            long index, currentUtc;
+            packet.integer(2, index);
+            packet.integer(3, currentUtc);
+            totpCode(secrets[index].data(), secrets[index].size(), currentUtc, code);
+            writer.begin().append("OTP").append(std::string_view(code, OTP_CODE_LENGTH));
+            writer.finish();
+        }
+    });
+    auto singleBytes = wireBytes / BENCHMARK_ROUNDS;
+    auto singleRoundTrips = entries;
+
+    wireBytes = wireFrames = 0;
+    auto batchNanos = benchmarkNanos(BENCHMARK_ROUNDS, [&](std::size_t){
+        auto length = (std::size_t)snprintf(request, sizeof(request), "WARLIN<PART>GENERATE_ALL<PART>%ld", utc);
+        wireBytes += length + 1;
+        splitPacket(std::string_view(request, length), "<PART>", packet);
+        long currentUtc;
+        packet.integer(2, currentUtc);
+        uint8_t counter[OTP_COUNTER_LENGTH];
+        totpCounter(currentUtc, counter);
+        writer.begin().append("OTPS");
+        for (const auto & secret : secrets){
+            hotpCode(secret.data(), secret.size(), counter, code);
+            writer.append(std::string_view(code, OTP_CODE_LENGTH));
+        }
+        writer.finish();
+    });
+    auto batchBytes = wireBytes / BENCHMARK_ROUNDS;
+
+    printf("%zu entries: %zu x GENERATE %.1f us, %zu bytes, %zu round trips; GENERATE_ALL %.1f us, %zu bytes, 1 round trip\n",
+           entries, entries, singleNanos / 1000, singleBytes, singleRoundTrips, batchNanos / 1000, batchBytes);
+
+    TEST_ASSERT_LESS_THAN(singleBytes, batchBytes);
+}
+
+void benchmark_otp_generate_all(void){
+    benchmarkGenerate(5);
+    benchmarkGenerate(50);
+}
+
+void benchmark_otp_prepared_key(void){
+    const auto key = reinterpret_cast<const uint8_t *>("12345678901234567890");
+    HmacSha1Key prepared;
+    hmacSha1Prepare(key, 20, prepared);
+
+    uint8_t counter[OTP_COUNTER_LENGTH];
+    char fresh[OTP_CODE_LENGTH + 1], cached[OTP_CODE_LENGTH + 1];
+    const long utc = 1716740958L;
+
+    auto freshNanos = benchmarkNanos(BENCHMARK_ROUNDS * 10, [&](std::size_t i){
+        totpCounter(utc + (long)i * TOTP_TIME_STEP, counter);
+        hotpCode(key, 20, counter, fresh);
+    });
+    auto cachedNanos = benchmarkNanos(BENCHMARK_ROUNDS * 10, [&](std::size_t i){
+        totpCounter(utc + (long)i * TOTP_TIME_STEP, counter);
+        hotpCode(prepared, counter, cached);
+    });
+
+    printf("code: HMAC from secret %.0f ns (4 SHA-1 blocks), prepared pads %.0f ns (2 SHA-1 blocks)\n", freshNanos, cachedNanos);
+    TEST_ASSERT_EQUAL_STRING(fresh, cached);
+}
+
+/*
+ * Вывод ключа для UNLOCK: длительность куска, который главный цикл выполняет между запросами,
+ * и полный вывод. Одна итерация - два сжатия SHA-1
+ */
+void benchmark_otp_pbkdf2_slices(void){
+    const uint8_t passwordHash[SHA1_HASH_LENGTH] = {1, 2, 3};
+    const uint8_t salt[16] = {4, 5, 6};
+    constexpr uint32_t iterations = 20000;
+    constexpr uint32_t slice = 8;
+
+    Pbkdf2Sha1 kdf;
+    kdf.begin(passwordHash, sizeof(passwordHash), salt, sizeof(salt), iterations);
+    double worstSliceNanos = 0;
+    std::size_t slices = 0;
+    auto totalNanos = benchmarkNanos(1, [&](std::size_t){
+        auto done = false;
+        while (!done){
+            auto sliceNanos = benchmarkNanos(1, [&](std::size_t){ done = kdf.step(slice); });
+            worstSliceNanos = sliceNanos > worstSliceNanos ? sliceNanos : worstSliceNanos;
+            slices++;
+        }
+    });
+    uint8_t key[SHA1_HASH_LENGTH];
+    kdf.finish(key);
+
+    printf("pbkdf2: %u iterations in %.1f ms, %zu slices of %u, worst slice %.1f us\n",
+           iterations, totalNanos / 1e6, slices, slice, worstSliceNanos / 1000);
+    TEST_ASSERT_EQUAL(iterations / slice, slices);
+}
+
+// Три хоста опрашивают пять записей каждые 5 секунд в течение часа
+void benchmark_otp_cache_polling(void){
+    auto secrets = makeSecrets(5);
+    std::vector<HmacSha1Key> keys(secrets.size());
+    for (std::size_t i = 0; i < secrets.size(); i++){
+        hmacSha1Prepare(secrets[i].data(), secrets[i].size(), keys[i]);
+    }
+
+    OtpCache cache;
+    char code[OTP_CODE_LENGTH + 1];
+    uint8_t counter[OTP_COUNTER_LENGTH];
+    std::size_t computed = 0;
+
+    for (long utc = 1716740958L; utc < 1716740958L + 3600; utc += 5){
+        for (auto host = 0; host < 3; host++){
+            const auto now = utc + host;
+            for (std::size_t entry = 0; entry < keys.size(); entry++){
+                if (cache.find(entry, totpStep(now), code)){
+                    continue;
+                }
+                totpCounter(now, counter);
+                hotpCode(keys[entry], counter, code);
+                cache.store(entry, totpStep(now), code);
+                computed++;
+            }
+        }
+    }
+
+    auto total = cache.hits() + cache.misses();
+    printf("otp cache: %lu hits, %lu misses, hit rate %.1f%%\n", cache.hits(), cache.misses(), 100.0 * cache.hits() / total);
+    TEST_ASSERT_EQUAL(cache.misses(), computed);
+    TEST_ASSERT_GREATER_THAN(total * 9 / 10, cache.hits());
+}
@@ -0,0 +1,193 @@
+#include <unity.h>
+#include <Otp.h>
+#include <cstring>
+#include <string>
+
+static std::string toHex(const uint8_t * data, std::size_t length){
+    static const char * hex = "0123456789abcdef";
+    std::string result;
+    for (std::size_t i = 0; i < length; i++){
+        result += hex[data[i] >> 4];
+        result += hex[data[i] & 0x0F];
+    }
+    return result;
+}
+
+static std::string sha1Hex(const std::string & message){
+    Sha1Context sha;
+    uint8_t hash[SHA1_HASH_LENGTH];
+    sha.init();
+    sha.update(reinterpret_cast<const uint8_t *>(message.data()), message.size());
+    sha.finish(hash);
+    return toHex(hash, sizeof(hash));
+}
+
+void test_otp_sha1_vectors(void){
+    TEST_ASSERT_EQUAL_STRING("da39a3ee5e6b4b0d3255bfef95601890afd80709", sha1Hex("").c_str());
+    TEST_ASSERT_EQUAL_STRING("a9993e364706816aba3e25717850c26c9cd0d89d", sha1Hex("abc").c_str());
+    TEST_ASSERT_EQUAL_STRING("84983e441c3bd26ebaae4aa1f95129e5e54670f1",
+                             sha1Hex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq").c_str());
+    TEST_ASSERT_EQUAL_STRING("34aa973cd4c4daa4f61eeb2bdbad27316534016f", sha1Hex(std::string(1000000, 'a')).c_str());
+}
+
+void test_otp_hmac_sha1_vectors(void){
+    uint8_t hash[SHA1_HASH_LENGTH];
+    const std::string message = "what do ya want for nothing?";
+    hmacSha1(reinterpret_cast<const uint8_t *>("Jefe"), 4,
+             reinterpret_cast<const uint8_t *>(message.data()), message.size(), hash);
+    TEST_ASSERT_EQUAL_STRING("effcdf6ae5eb2fa2d27416d5f184df9c259a7c79", toHex(hash, sizeof(hash)).c_str());
+
+    uint8_t longKey[80];
+    memset(longKey, 0xAA, sizeof(longKey));
+    const std::string longMessage = "Test Using Larger Than Block-Size Key - Hash Key First";
+    hmacSha1(longKey, sizeof(longKey), reinterpret_cast<const uint8_t *>(longMessage.data()), longMessage.size(), hash);
+    TEST_ASSERT_EQUAL_STRING("aa4ae5e15272d00e95705637ce8a3b55ed402112", toHex(hash, sizeof(hash)).c_str());
+}
+
+// RFC 6238, приложение B, SHA1. Библиотека TOTP выдает последние 6 цифр
+void test_otp_totp_rfc6238(void){
+    const auto key = reinterpret_cast<const uint8_t *>("12345678901234567890");
+    const struct { long utc; const char * code; } vectors[] = {
+        { 59, "287082" },
+        { 1111111109, "081804" },
+        { 1111111111, "050471" },
+        { 1234567890, "005924" },
+        { 2000000000, "279037" },
+    };
+
+    char code[OTP_CODE_MAX_LENGTH + 1];
+    for (const auto & vector : vectors){
+        totpCode(key, 20, vector.utc, code);
+        TEST_ASSERT_EQUAL_STRING(vector.code, code);
+    }
+
+    // Коды записей с 7 и 8 цифрами: в RFC 6238 приведены 8, 7 цифр - их окончание
+    const struct { long utc; const char * code; } eightDigits[] = {
+        { 59, "94287082" },
+        { 1111111109, "07081804" },
+        { 1234567890, "89005924" },
+        { 2000000000, "69279037" },
+    };
+    OtpCache cache;
+    for (const auto & vector : eightDigits){
+        totpCode(key, 20, vector.utc, code, 8);
+        TEST_ASSERT_EQUAL_STRING(vector.code, code);
+        totpCode(key, 20, vector.utc, code, 7);
+        TEST_ASSERT_EQUAL_STRING(vector.code + 1, code);
+
+        // Кеш возвращает код той же длины, что сохранили
+        cache.store(0, totpStep(vector.utc), code);
+        char cached[OTP_CODE_MAX_LENGTH + 1];
+        TEST_ASSERT_TRUE(cache.find(0, totpStep(vector.utc), cached));
+        TEST_ASSERT_EQUAL_STRING(vector.code + 1, cached);
+    }
+}
+
+// Подготовленный ключ дает тот же HMAC, что и расчет с нуля, в том числе для ключа длиннее блока
+void test_otp_prepared_key(void){
+    uint8_t key[100];
+    for (std::size_t i = 0; i < sizeof(key); i++){
+        key[i] = (uint8_t)(i * 7 + 3);
+    }
+    const uint8_t counter[OTP_COUNTER_LENGTH] = {0, 0, 0, 0, 0x03, 0x6A, 0xE1, 0x3C};
+
+    for (std::size_t length : {1, 10, 20, 64, 65, 100}){
+        uint8_t expected[SHA1_HASH_LENGTH], actual[SHA1_HASH_LENGTH];
+        hmacSha1(key, length, counter, sizeof(counter), expected);
+
+        HmacSha1Key prepared;
+        hmacSha1Prepare(key, length, prepared);
+        hmacSha1(prepared, counter, sizeof(counter), actual);
+        TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, actual, SHA1_HASH_LENGTH);
+    }
+
+    HmacSha1Key prepared;
+    hmacSha1Prepare(reinterpret_cast<const uint8_t *>("12345678901234567890"), 20, prepared);
+    uint8_t rfcCounter[OTP_COUNTER_LENGTH];
+    char code[OTP_CODE_LENGTH + 1];
+    totpCounter(1111111109, rfcCounter);
+    hotpCode(prepared, rfcCounter, code);
+    TEST_ASSERT_EQUAL_STRING("081804", code);
+    totpCounter(2000000000, rfcCounter);
+    hotpCode(prepared, rfcCounter, code);
+    TEST_ASSERT_EQUAL_STRING("279037", code);
+}
+
+// RFC 6070. Вывод по кускам неравной длины дает тот же ключ, что и за один вызов
+void test_otp_pbkdf2_vectors(void){
+    const auto password = reinterpret_cast<const uint8_t *>("password");
+    const auto salt = reinterpret_cast<const uint8_t *>("salt");
+    const struct { uint32_t iterations; const char * key; } vectors[] = {
+        { 1, "0c60c80f961f0e71f3a9b524af6012062fe037a6" },
+        { 2, "ea6c014dc72d6f8ccd1ed92ace1d41f0d8de8957" },
+        { 4096, "4b007901b765489abead49d926f721d065a429c1" },
+    };
+
+    uint8_t key[SHA1_HASH_LENGTH];
+    for (const auto & vector : vectors){
+        Pbkdf2Sha1 kdf;
+        kdf.begin(password, 8, salt, 4, vector.iterations);
+        TEST_ASSERT_TRUE(kdf.step(vector.iterations));
+        kdf.finish(key);
+        TEST_ASSERT_EQUAL_STRING(vector.key, toHex(key, sizeof(key)).c_str());
+    }
+
+    Pbkdf2Sha1 sliced;
+    sliced.begin(password, 8, salt, 4, 4096);
+    // Первая итерация выполняется в begin(), остальные 4095 - кусками по 7
+    uint32_t slices = 1;
+    while (!sliced.step(7)){
+        slices++;
+        TEST_ASSERT_LESS_THAN(4096u, sliced.completed());
+    }
+    TEST_ASSERT_EQUAL(4095 / 7, slices);
+    TEST_ASSERT_EQUAL(4096u, sliced.completed());
+    sliced.finish(key);
+    TEST_ASSERT_EQUAL_STRING("4b007901b765489abead49d926f721d065a429c1", toHex(key, sizeof(key)).c_str());
+    TEST_ASSERT_EQUAL(0u, sliced.iterations());
+}
+
+void test_otp_cache(void){
+    OtpCache cache;
+    char code[OTP_CODE_LENGTH + 1];
+
+    TEST_ASSERT_FALSE(cache.find(1, 100, code));
+    cache.store(1, 100, "123456");
+    TEST_ASSERT_TRUE(cache.find(1, 100, code));
+    TEST_ASSERT_EQUAL_STRING("123456", code);
+
+    // Новый шаг и запись из той же ячейки вытесняют старый код
+    TEST_ASSERT_FALSE(cache.find(1, 101, code));
+    cache.store(1 + OTP_CACHE_SLOTS, 100, "654321");
+    TEST_ASSERT_FALSE(cache.find(1, 100, code));
+    TEST_ASSERT_TRUE(cache.find(1 + OTP_CACHE_SLOTS, 100, code));
+    TEST_ASSERT_EQUAL_STRING("654321", code);
+
+    cache.clear();
+    TEST_ASSERT_FALSE(cache.find(1 + OTP_CACHE_SLOTS, 100, code));
+    TEST_ASSERT_EQUAL(2, cache.hits());
+    TEST_ASSERT_EQUAL(4, cache.misses());
+}
+
+// Фоновое заполнение следующего шага не вытесняет текущий и не портит статистику
+void test_otp_cache_next_step(void){
+    OtpCache cache;
+    char code[OTP_CODE_LENGTH + 1];
+
+    cache.store(3, 100, "111111");
+    TEST_ASSERT_FALSE(cache.contains(3, 101));
+    cache.store(3, 101, "222222");
+    TEST_ASSERT_TRUE(cache.contains(3, 100));
+    TEST_ASSERT_TRUE(cache.contains(3, 101));
+    TEST_ASSERT_EQUAL(0, cache.hits() + cache.misses());
+
+    TEST_ASSERT_TRUE(cache.find(3, 100, code));
+    TEST_ASSERT_EQUAL_STRING("111111", code);
+    TEST_ASSERT_TRUE(cache.find(3, 101, code));
+    TEST_ASSERT_EQUAL_STRING("222222", code);
+
+    // Через шаг ячейка переиспользуется
+    cache.store(3, 102, "333333");
+    TEST_ASSERT_FALSE(cache.contains(3, 100));
+    TEST_ASSERT_TRUE(cache.contains(3, 101));
+}
@@ -0,0 +1,155 @@
+#include <unity.h>
+#include <Packet.h>
+#include <cstring>
+#include <deque>
+#include <string>
+#include "benchmark.h"
+
+static constexpr auto BENCHMARK_ITERATIONS = 200000;
+
+static const char * const BENCHMARK_LINE = "WARLIN<PART>STORE_ENTRY<PART>Google<PART>JBSWY3DPEHPK3PXP<PART>6";
+
+// Прежняя реализация из Warlin.cpp, оставлена для сравнения
+static std::deque<std::string> legacySplit(const std::string& s)
+{
+    std::deque<std::string> output;
+
+    std::string::size_type prev_pos = 0, pos = 0;
+
+    while((pos = s.find("<PART>", pos)) != std::string::npos)
+    {
+        std::string substring( s.substr(prev_pos, pos-prev_pos) );
+
+        output.push_back(substring);
+
+        pos += strlen("<PART>");
+
+        prev_pos = pos;
+    }
+
+    output.push_back(s.substr(prev_pos, pos-prev_pos));
+
+    return output;
+}
+
+void benchmark_packet_split(void){
+    std::size_t sink = 0;
+
+    auto legacyAllocations = benchmarkAllocations;
+    auto legacyNanos = benchmarkNanos(BENCHMARK_ITERATIONS, [&](std::size_t){
+        std::string line(BENCHMARK_LINE); // как копирование из String в process()
+        auto parts = legacySplit(line);
+        sink += parts.size();
+    });
+    legacyAllocations = benchmarkAllocations - legacyAllocations;
+
+    Packet packet;
+    auto packetAllocations = benchmarkAllocations;
+    auto packetNanos = benchmarkNanos(BENCHMARK_ITERATIONS, [&](std::size_t){
+        splitPacket(BENCHMARK_LINE, "<PART>", packet);
+        sink += packet.size();
+    });
+    packetAllocations = benchmarkAllocations - packetAllocations;
+
+    printf("split: legacy %.1f ns/op, %.2f allocations/op; packet %.1f ns/op, %.2f allocations/op (%zu)\n",
+           legacyNanos, (double)legacyAllocations / BENCHMARK_ITERATIONS,
+           packetNanos, (double)packetAllocations / BENCHMARK_ITERATIONS, sink);
+
+    TEST_ASSERT_EQUAL(0, packetAllocations);
+    TEST_ASSERT_GREATER_THAN(0, legacyAllocations);
+}
+
+static std::size_t sinkBytes = 0;
+static std::size_t sinkWrites = 0;
+static char sinkScratch[PACKET_TX_BUFFER_SIZE];
+
+// Как и Serial.write, копирует данные в буфер передачи; на USB CDC каждая запись еще и отдельная транзакция
+static void countingSink(const char * data, std::size_t length){
+    memcpy(sinkScratch, data, length < sizeof(sinkScratch) ? length : sizeof(sinkScratch));
+    sinkBytes += length;
+    sinkWrites++;
+}
+
+static void countingWrite(const char * text){
+    countingSink(text, strlen(text));
+}
+
+// Прежний Warlin_::writeLine(initializer_list): отдельная запись на каждую часть
+static void legacyWriteLine(const std::initializer_list<std::string>& args){
+    countingWrite("WARLIN");
+    countingWrite("<PART>");
+    auto iterator = args.begin();
+    countingWrite((*iterator++).c_str());
+    while(iterator != args.end()) {
+        countingWrite("<PART>");
+        countingWrite((*iterator++).c_str());
+    }
+    countingWrite("\n");
+}
+
+void benchmark_packet_writer(void){
+    sinkBytes = sinkWrites = 0;
+    auto legacyNanos = benchmarkNanos(BENCHMARK_ITERATIONS, [](std::size_t i){
+        legacyWriteLine({ std::string("LATENCY"), std::to_string(i), std::to_string(i * 3), std::to_string(1234567) });
+    });
+    auto legacyBytes = sinkBytes, legacyWrites = sinkWrites;
+
+    sinkBytes = sinkWrites = 0;
+    PacketWriter writer("WARLIN", "<PART>", countingSink);
+    auto allocations = benchmarkAllocations;
+    auto writerNanos = benchmarkNanos(BENCHMARK_ITERATIONS, [&](std::size_t i){
+        writer.begin().append("LATENCY").append(i).append(i * 3).append(1234567);
+        writer.finish();
+    });
+    allocations = benchmarkAllocations - allocations;
+
+    printf("response: legacy %.1f ns/op, %.1f writes/op, %.1f bytes/op; writer %.1f ns/op, %.1f writes/op, %.1f bytes/op\n",
+           legacyNanos, (double)legacyWrites / BENCHMARK_ITERATIONS, (double)legacyBytes / BENCHMARK_ITERATIONS,
+           writerNanos, (double)sinkWrites / BENCHMARK_ITERATIONS, (double)sinkBytes / BENCHMARK_ITERATIONS);
+
+    TEST_ASSERT_EQUAL(legacyBytes, sinkBytes);
+    TEST_ASSERT_EQUAL(BENCHMARK_ITERATIONS, sinkWrites);
+    TEST_ASSERT_EQUAL(0, allocations);
+}
+
+void benchmark_packet_binary_framing(void){
+    sinkBytes = sinkWrites = 0;
+    PacketWriter writer("WARLIN", "<PART>", countingSink);
+    writer.begin().append("GENERATE").append(0).append(1716740958L);
+    writer.finish();
+    auto textBytes = sinkBytes;
+
+    sinkBytes = 0;
+    writer.beginBinary(6).append(0).append(1716740958L);
+    writer.finish();
+    auto binaryBytes = sinkBytes;
+
+    // Аргументы двоичного кадра: без начала, кода, однобайтовой длины и CRC
+    const std::string payload(sinkScratch + 3, binaryBytes - 5);
+
+    Packet packet;
+    long sink = 0;
+    auto textNanos = benchmarkNanos(BENCHMARK_ITERATIONS, [&](std::size_t){
+        long index, utc;
+        splitPacket("WARLIN<PART>GENERATE<PART>0<PART>1716740958", "<PART>", packet);
+        packet.popFront();
+        packet.popFront();
+        packet.integer(0, index);
+        packet.integer(1, utc);
+        sink += index + utc;
+    });
+
+    auto binaryNanos = benchmarkNanos(BENCHMARK_ITERATIONS, [&](std::size_t){
+        long index, utc;
+        decodeBinaryPacket(payload, packet);
+        packet.integer(0, index);
+        packet.integer(1, utc);
+        sink += index + utc;
+    });
+
+    printf("GENERATE request: text %zu bytes, %.1f ns to parse; binary %zu bytes, %.1f ns to decode (%ld)\n",
+           textBytes, textNanos, binaryBytes, binaryNanos, sink);
+
+    TEST_ASSERT_EQUAL(2 * BENCHMARK_ITERATIONS * (0 + 1716740958L), sink);
+    TEST_ASSERT_LESS_THAN(textBytes / 3, binaryBytes);
+}
@@ -1,5 +1,6 @@
 #include <unity.h>
 #include <Packet.h>
+#include <string>
 
 void test_packet_read(void){
     uint8_t data[5] = {1, 2, 3, 4, 5};
@@ -8,3 +9,351 @@ void test_packet_read(void){
 
     TEST_ASSERT_TRUE(true);
 }
+
+void test_packet_split(void){
+    Packet packet;
+    TEST_ASSERT_TRUE(splitPacket("WARLIN<PART>GENERATE<PART>0<PART>1716740958", "<PART>", packet));
+    TEST_ASSERT_EQUAL(4, packet.size());
+    TEST_ASSERT_TRUE(packet[0] == "WARLIN");
+    TEST_ASSERT_TRUE(packet[1] == "GENERATE");
+
+    packet.popFront();
+    packet.popFront();
+    long index, utc;
+    TEST_ASSERT_TRUE(packet.integer(0, index));
+    TEST_ASSERT_TRUE(packet.integer(1, utc));
+    TEST_ASSERT_EQUAL(0, index);
+    TEST_ASSERT_EQUAL(1716740958L, utc);
+    TEST_ASSERT_FALSE(packet.integer(2, utc));
+}
+
+void test_packet_split_empty_parts(void){
+    Packet packet;
+    TEST_ASSERT_TRUE(splitPacket("", "<PART>", packet));
+    TEST_ASSERT_EQUAL(1, packet.size());
+    TEST_ASSERT_TRUE(packet[0].empty());
+
+    TEST_ASSERT_TRUE(splitPacket("WARLIN<PART>", "<PART>", packet));
+    TEST_ASSERT_EQUAL(2, packet.size());
+    TEST_ASSERT_TRUE(packet[1].empty());
+}
+
+void test_packet_split_overflow(void){
+    Packet packet;
+    std::string line = "WARLIN";
+    for (std::size_t i = 0; i < PACKET_MAX_PARTS; i++){
+        line += "<PART>x";
+    }
+    TEST_ASSERT_FALSE(splitPacket(line, "<PART>", packet));
+}
+
+void test_packet_parse_integer(void){
+    long value;
+    TEST_ASSERT_TRUE(parseInteger("-42", value));
+    TEST_ASSERT_EQUAL(-42, value);
+    TEST_ASSERT_FALSE(parseInteger("", value));
+    TEST_ASSERT_FALSE(parseInteger("-", value));
+    TEST_ASSERT_FALSE(parseInteger("12a", value));
+    TEST_ASSERT_FALSE(parseInteger("99999999999999999999999", value));
+}
+
+void test_packet_ring_buffer(void){
+    RingBuffer<4> ring;
+    for (uint8_t i = 0; i < 4; i++){
+        TEST_ASSERT_TRUE(ring.push(i));
+    }
+    TEST_ASSERT_FALSE(ring.push(4));
+    uint8_t value;
+    TEST_ASSERT_TRUE(ring.pop(value));
+    TEST_ASSERT_EQUAL(0, value);
+    TEST_ASSERT_TRUE(ring.push(4));
+    TEST_ASSERT_EQUAL(1, ring.peek(0));
+    TEST_ASSERT_EQUAL(4, ring.peek(3));
+    ring.skip(10);
+    TEST_ASSERT_TRUE(ring.empty());
+}
+
+static PACKET_FEED_RESULT feedAll(PacketAssembler & assembler, std::string_view bytes){
+    auto result = PACKET_FEED_RESULT::PENDING;
+    for (auto c : bytes){
+        result = assembler.feed((uint8_t)c);
+        if (result != PACKET_FEED_RESULT::PENDING){
+            break;
+        }
+    }
+    return result;
+}
+
+void test_packet_assembler_split_frame(void){
+    PacketAssembler assembler("WARLIN");
+    TEST_ASSERT_TRUE(feedAll(assembler, "WAR") == PACKET_FEED_RESULT::PENDING);
+    TEST_ASSERT_TRUE(assembler.inFrame());
+    TEST_ASSERT_TRUE(feedAll(assembler, "LIN<PART>DISC") == PACKET_FEED_RESULT::PENDING);
+    TEST_ASSERT_TRUE(feedAll(assembler, "OVER\n") == PACKET_FEED_RESULT::FRAME);
+    TEST_ASSERT_TRUE(assembler.frame() == "WARLIN<PART>DISCOVER");
+    TEST_ASSERT_FALSE(assembler.inFrame());
+}
+
+void test_packet_assembler_garbage(void){
+    PacketAssembler assembler("WARLIN");
+    TEST_ASSERT_TRUE(feedAll(assembler, "hello WARL\n") == PACKET_FEED_RESULT::GARBAGE);
+    TEST_ASSERT_TRUE(feedAll(assembler, "\n") == PACKET_FEED_RESULT::PENDING);
+    TEST_ASSERT_TRUE(feedAll(assembler, "xxWWARLIN<PART>SYNC\n") == PACKET_FEED_RESULT::FRAME);
+    TEST_ASSERT_TRUE(assembler.frame() == "WARLIN<PART>SYNC");
+}
+
+void test_packet_assembler_overflow_resync(void){
+    PacketAssembler assembler("WARLIN");
+    std::string oversized = "WARLIN<PART>";
+    oversized.append(PACKET_MAX_LENGTH, 'A');
+    TEST_ASSERT_TRUE(feedAll(assembler, oversized) == PACKET_FEED_RESULT::TOO_LONG);
+    TEST_ASSERT_FALSE(assembler.inFrame());
+
+    // Хвост длинного кадра, даже с магией внутри, отбрасывается молча до конца строки
+    TEST_ASSERT_TRUE(feedAll(assembler, "AAAAWARLIN<PART>AAAA\n") == PACKET_FEED_RESULT::PENDING);
+    TEST_ASSERT_TRUE(feedAll(assembler, "WARLIN<PART>DISCOVER\n") == PACKET_FEED_RESULT::FRAME);
+    TEST_ASSERT_TRUE(assembler.frame() == "WARLIN<PART>DISCOVER");
+
+    // Длинный кадр с хвостом длиннее буфера - по-прежнему одна ошибка
+    oversized.append(3 * PACKET_MAX_LENGTH, 'A');
+    TEST_ASSERT_TRUE(feedAll(assembler, oversized) == PACKET_FEED_RESULT::TOO_LONG);
+    TEST_ASSERT_TRUE(feedAll(assembler, oversized.substr(PACKET_MAX_LENGTH + 1) + "\nWARLIN<PART>DISCOVER\n") == PACKET_FEED_RESULT::FRAME);
+}
+
+/*
+ * Самый длинный STORE_ENTRIES: идентификатор запроса и столько записей, сколько частей вмещает пакет,
+ * каждая с названием в 20 и секретом в 50 символов (TOTP_KEY_NAME_MAX_LENGTH, TOTP_KEY_SECRET_MAX_LENGTH)
+ */
+void test_packet_assembler_store_entries_max(void){
+    std::string request = "WARLIN#4294967295<PART>STORE_ENTRIES";
+    const auto entries = (PACKET_MAX_PARTS - 2) / 3;
+    for (std::size_t i = 0; i < entries; i++){
+        request += "<PART>" + std::string(19, 'N') + std::to_string(i) + "<PART>" + std::string(50, 'A') + "<PART>10";
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(PACKET_MAX_LENGTH, request.size());
+
+    PacketAssembler assembler("WARLIN");
+    TEST_ASSERT_TRUE(feedAll(assembler, request + "\n") == PACKET_FEED_RESULT::FRAME);
+    TEST_ASSERT_EQUAL(request.size(), assembler.frame().size());
+
+    Packet packet;
+    TEST_ASSERT_TRUE(splitPacket(assembler.frame(), "<PART>", packet));
+    TEST_ASSERT_EQUAL(PACKET_MAX_PARTS, packet.size());
+    TEST_ASSERT_TRUE(packet[PACKET_MAX_PARTS - 3] == std::string(19, 'N') + std::to_string(entries - 1));
+}
+
+static std::string writerOutput;
+static std::size_t writerCalls = 0;
+
+static void captureSink(const char * data, std::size_t length){
+    writerOutput.append(data, length);
+    writerCalls++;
+}
+
+Z_ENUM_NS(
+    TEST_PACKET_RESPONSE,
+    ACK,
+    OTP
+)
+
+void test_packet_writer_single_write(void){
+    writerOutput.clear();
+    writerCalls = 0;
+    PacketWriter writer("WARLIN", "<PART>", captureSink);
+    writer.begin().append(TEST_PACKET_RESPONSE::OTP).append("123456").append(-42).append(7ul);
+    writer.finish();
+    TEST_ASSERT_EQUAL(1, writerCalls);
+    TEST_ASSERT_EQUAL_STRING("WARLIN<PART>OTP<PART>123456<PART>-42<PART>7\n", writerOutput.c_str());
+}
+
+void test_packet_writer_long_response(void){
+    writerOutput.clear();
+    writerCalls = 0;
+    PacketWriter writer("WARLIN", "<PART>", captureSink);
+    writer.begin().append(TEST_PACKET_RESPONSE::ACK);
+    std::string expected = "WARLIN<PART>ACK";
+    for (auto i = 0; i < 100; i++){
+        writer.append(i);
+        expected += "<PART>" + std::to_string(i);
+    }
+    writer.finish();
+    expected += "\n";
+    TEST_ASSERT_GREATER_THAN(1, writerCalls);
+    TEST_ASSERT_EQUAL_STRING(expected.c_str(), writerOutput.c_str());
+}
+
+void test_packet_crc16(void){
+    TEST_ASSERT_EQUAL(0x29B1, packetCrc16(reinterpret_cast<const uint8_t *>("123456789"), 9));
+}
+
+void test_packet_varint(void){
+    uint8_t bytes[10];
+    TEST_ASSERT_EQUAL(1, encodeVarint(127, bytes));
+    TEST_ASSERT_EQUAL(2, encodeVarint(300, bytes));
+    std::string_view input(reinterpret_cast<const char *>(bytes), 2);
+    uint64_t value;
+    TEST_ASSERT_TRUE(decodeVarint(input, value));
+    TEST_ASSERT_EQUAL(300, value);
+    TEST_ASSERT_TRUE(input.empty());
+
+    std::string_view truncated("\x80", 1);
+    TEST_ASSERT_FALSE(decodeVarint(truncated, value));
+}
+
+void test_packet_binary_roundtrip(void){
+    writerOutput.clear();
+    writerCalls = 0;
+    PacketWriter writer("WARLIN", "<PART>", captureSink);
+    writer.beginBinary(6).append(0).append(1716740958L).append("Google").append(-5);
+    TEST_ASSERT_TRUE(writer.finish());
+    TEST_ASSERT_EQUAL(1, writerCalls);
+    TEST_ASSERT_EQUAL(PACKET_BINARY_START, (uint8_t)writerOutput[0]);
+
+    PacketAssembler assembler("WARLIN");
+    TEST_ASSERT_TRUE(feedAll(assembler, writerOutput) == PACKET_FEED_RESULT::PENDING);
+
+    assembler.reset();
+    assembler.setBinaryEnabled(true);
+    TEST_ASSERT_TRUE(feedAll(assembler, writerOutput) == PACKET_FEED_RESULT::BINARY_FRAME);
+    TEST_ASSERT_EQUAL(6, assembler.opcode());
+
+    Packet packet;
+    TEST_ASSERT_TRUE(decodeBinaryPacket(assembler.frame(), packet));
+    TEST_ASSERT_EQUAL(4, packet.size());
+    long value;
+    TEST_ASSERT_TRUE(packet.integer(0, value));
+    TEST_ASSERT_EQUAL(0, value);
+    TEST_ASSERT_TRUE(packet.integer(1, value));
+    TEST_ASSERT_EQUAL(1716740958L, value);
+    TEST_ASSERT_TRUE(packet[2] == "Google");
+    TEST_ASSERT_TRUE(packet.integer(3, value));
+    TEST_ASSERT_EQUAL(-5, value);
+}
+
+void test_packet_binary_corrupt_resync(void){
+    writerOutput.clear();
+    PacketWriter writer("WARLIN", "<PART>", captureSink);
+    writer.beginBinary(1).append("x");
+    writer.finish();
+    auto corrupted = writerOutput;
+    corrupted[3] ^= 0x01;
+
+    PacketAssembler assembler("WARLIN");
+    assembler.setBinaryEnabled(true);
+    TEST_ASSERT_TRUE(feedAll(assembler, corrupted) == PACKET_FEED_RESULT::CORRUPT);
+    TEST_ASSERT_TRUE(feedAll(assembler, "WARLIN<PART>SYNC\n") == PACKET_FEED_RESULT::FRAME);
+    TEST_ASSERT_TRUE(feedAll(assembler, writerOutput) == PACKET_FEED_RESULT::BINARY_FRAME);
+}
+
+// Много аргументов уходят продолжениями, но один аргумент больше буфера ответа отправить нельзя
+void test_packet_binary_too_long(void){
+    writerOutput.clear();
+    writerCalls = 0;
+    PacketWriter writer("WARLIN", "<PART>", captureSink);
+    writer.beginBinary(3).append("name").append(std::string(PACKET_TX_BUFFER_SIZE, 'x'));
+    TEST_ASSERT_FALSE(writer.finish());
+    // Ушло только продолжение с первым аргументом, цепочку завершает ошибка от вызывающего
+    TEST_ASSERT_EQUAL(1, writerCalls);
+    TEST_ASSERT_EQUAL(3 | PACKET_BINARY_CONTINUED, (uint8_t)writerOutput[1]);
+}
+
+/*
+ * Ответы на пакетные запросы при 300 записях (TOTP_KEYS_COUNT_LIMIT): названия наибольшей длины, как GET_ENTRIES,
+ * и коды, как GENERATE_ALL. Хост собирает цепочку кадров с PACKET_BINARY_CONTINUED и получает все части по порядку
+ */
+void test_packet_binary_continuation(void){
+    const auto entries = 300;
+    for (auto codes : {false, true}){
+        writerOutput.clear();
+        writerCalls = 0;
+        PacketWriter writer("WARLIN", "<PART>", captureSink);
+        writer.beginBinary(9, {true, 7});
+        for (auto i = 0; i < entries; i++){
+            auto part = std::to_string(100000 + i);
+            writer.append(codes ? part : std::string(14, 'N') + part);
+        }
+        TEST_ASSERT_TRUE(writer.finish());
+        TEST_ASSERT_GREATER_THAN(1, writerCalls);
+
+        PacketAssembler assembler("WARLIN");
+        assembler.setBinaryEnabled(true);
+        std::size_t received = 0;
+        auto last = false;
+        std::string_view bytes = writerOutput;
+        while (!bytes.empty()){
+            TEST_ASSERT_FALSE(last);
+            auto result = PACKET_FEED_RESULT::PENDING;
+            while (result == PACKET_FEED_RESULT::PENDING && !bytes.empty()){
+                result = assembler.feed((uint8_t)bytes.front());
+                bytes.remove_prefix(1);
+            }
+            TEST_ASSERT_TRUE(result == PACKET_FEED_RESULT::BINARY_FRAME);
+            TEST_ASSERT_EQUAL(7, assembler.requestId().value);
+            TEST_ASSERT_EQUAL(9, assembler.opcode() & ~PACKET_BINARY_CONTINUED);
+            last = (assembler.opcode() & PACKET_BINARY_CONTINUED) == 0;
+
+            Packet packet;
+            TEST_ASSERT_TRUE(decodeBinaryPacket(assembler.frame(), packet));
+            for (std::size_t i = 0; i < packet.size(); i++, received++){
+                auto expected = std::to_string(100000 + received);
+                TEST_ASSERT_TRUE(packet[i] == (codes ? expected : std::string(14, 'N') + expected));
+            }
+        }
+        TEST_ASSERT_TRUE(last);
+        TEST_ASSERT_EQUAL(entries, received);
+    }
+}
+
+void test_packet_request_id_text(void){
+    PacketRequestId requestId;
+    TEST_ASSERT_TRUE(parsePacketHead("WARLIN", "WARLIN", requestId));
+    TEST_ASSERT_FALSE(requestId.present);
+    TEST_ASSERT_TRUE(parsePacketHead("WARLIN#4294967295", "WARLIN", requestId));
+    TEST_ASSERT_TRUE(requestId.present);
+    TEST_ASSERT_EQUAL_UINT32(4294967295u, requestId.value);
+    TEST_ASSERT_FALSE(parsePacketHead("WARLIN#4294967296", "WARLIN", requestId));
+    TEST_ASSERT_FALSE(parsePacketHead("WARLIN#", "WARLIN", requestId));
+    TEST_ASSERT_FALSE(parsePacketHead("WARLIN#-1", "WARLIN", requestId));
+    TEST_ASSERT_FALSE(parsePacketHead("WARLINX", "WARLIN", requestId));
+
+    writerOutput.clear();
+    PacketWriter writer("WARLIN", "<PART>", captureSink);
+    writer.begin({true, 42}).append("OTP").append("123456");
+    writer.finish();
+    TEST_ASSERT_EQUAL_STRING("WARLIN#42<PART>OTP<PART>123456\n", writerOutput.c_str());
+}
+
+// Окно запросов: несколько кадров подряд в одной порции байт, ответы сопоставляются по идентификатору
+void test_packet_request_id_pipelined_binary(void){
+    writerOutput.clear();
+    PacketWriter writer("WARLIN", "<PART>", captureSink);
+    for (uint32_t id = 1; id <= 3; id++){
+        writer.beginBinary(6, {true, id * 1000}).append((int)id);
+        TEST_ASSERT_TRUE(writer.finish());
+    }
+    writer.beginBinary(6).append(0);
+    TEST_ASSERT_TRUE(writer.finish());
+
+    PacketAssembler assembler("WARLIN");
+    assembler.setBinaryEnabled(true);
+    Packet packet;
+    uint32_t frames = 0;
+    for (auto c : writerOutput){
+        if (assembler.feed((uint8_t)c) != PACKET_FEED_RESULT::BINARY_FRAME){
+            continue;
+        }
+        frames++;
+        TEST_ASSERT_EQUAL(6, assembler.opcode());
+        TEST_ASSERT_TRUE(decodeBinaryPacket(assembler.frame(), packet));
+        long value;
+        TEST_ASSERT_TRUE(packet.integer(0, value));
+        if (frames <= 3){
+            TEST_ASSERT_TRUE(assembler.requestId().present);
+            TEST_ASSERT_EQUAL_UINT32(frames * 1000, assembler.requestId().value);
+            TEST_ASSERT_EQUAL(frames, value);
+        } else {
+            TEST_ASSERT_FALSE(assembler.requestId().present);
+        }
+    }
+    TEST_ASSERT_EQUAL(4, frames);
+}
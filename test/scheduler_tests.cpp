@@ -0,0 +1,40 @@
+#include <unity.h>
+#include <Scheduler.h>
+
+static int pendingEvents = 0;
+static int handledEvents = 0;
+static int taskWork = 0;
+static int idleCalls = 0;
+
+static void resetCounters(int events, int work){
+    pendingEvents = events;
+    handledEvents = 0;
+    taskWork = work;
+    idleCalls = 0;
+}
+
+static Scheduler_ makeScheduler(){
+    Scheduler_ scheduler;
+    scheduler.onEvent([]{ return pendingEvents > 0; }, []{ pendingEvents--; handledEvents++; });
+    scheduler.addTask([]{ return taskWork > 0 && --taskWork > 0; });
+    scheduler.setIdleHook([]{ idleCalls++; });
+    return scheduler;
+}
+
+void test_scheduler_drains_events_back_to_back(void){
+    auto scheduler = makeScheduler();
+    resetCounters(5, 0);
+    scheduler.run();
+    TEST_ASSERT_EQUAL(5, handledEvents);
+    TEST_ASSERT_EQUAL(1, idleCalls);
+}
+
+void test_scheduler_idles_only_without_work(void){
+    auto scheduler = makeScheduler();
+    resetCounters(0, 3);
+    scheduler.run();
+    scheduler.run();
+    TEST_ASSERT_EQUAL(0, idleCalls);
+    scheduler.run();
+    TEST_ASSERT_EQUAL(1, idleCalls);
+}
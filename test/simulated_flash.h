@@ -0,0 +1,77 @@
+// Флеш-память в ОЗУ для хостовых тестов хранилища
+#ifndef KEECHAIN_SIMULATED_FLASH_H_GUARD
+#define KEECHAIN_SIMULATED_FLASH_H_GUARD
+#pragma once
+
+#include <VaultStorage.h>
+#include <vector>
+
+/*
+ * Повторяет ограничения флеш-памяти SAMD: стирание строками, запись словами и только из 1 в 0
+ * Считает стертые строки (всего и по каждой строке), вызовы записи и записанные байты. failAfter позволяет оборвать запись, как при сбое питания
+ */
+class SimulatedFlash : public FlashDevice
+{
+    public:
+        SimulatedFlash(std::size_t rows, std::size_t rowBytes = 256)
+            : memory(rows * rowBytes, FLASH_ERASED_BYTE), rowBytes(rowBytes), rowErases(rows, 0)
+        {
+        }
+
+        const uint8_t * image() const override { return memory.data(); }
+        std::size_t size() const override { return memory.size(); }
+        std::size_t rowSize() const override { return rowBytes; }
+
+        bool erase(std::size_t offset, std::size_t length) override
+        {
+            if (offset % rowBytes != 0 || offset + length > memory.size())
+            {
+                return false;
+            }
+            for (auto row = offset; row < offset + length; row += rowBytes)
+            {
+                std::fill(memory.begin() + row, memory.begin() + row + rowBytes, FLASH_ERASED_BYTE);
+                rowErases[row / rowBytes]++;
+                erases++;
+            }
+            return true;
+        }
+
+        bool program(std::size_t offset, const void * data, std::size_t length) override
+        {
+            if (offset % FLASH_WORD_SIZE != 0 || length % FLASH_WORD_SIZE != 0 || offset + length > memory.size())
+            {
+                return false;
+            }
+            programs++;
+            auto bytes = static_cast<const uint8_t *>(data);
+            for (std::size_t i = 0; i < length; i++)
+            {
+                if (failAfter == 0)
+                {
+                    return false;
+                }
+                failAfter--;
+                memory[offset + i] &= bytes[i];
+                programmed++;
+            }
+            return true;
+        }
+
+        void resetCounters()
+        {
+            erases = 0;
+            programs = 0;
+            programmed = 0;
+        }
+
+        std::vector<uint8_t> memory;
+        std::size_t rowBytes;
+        std::vector<std::size_t> rowErases;
+        std::size_t erases = 0;
+        std::size_t programs = 0;
+        std::size_t programmed = 0;
+        std::size_t failAfter = SIZE_MAX;
+};
+
+#endif // Guard
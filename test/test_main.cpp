@@ -0,0 +1,177 @@
+#include <unity.h>
+#include <cstdlib>
+#include <new>
+#include "benchmark.h"
+
+std::size_t benchmarkAllocations = 0;
+std::size_t benchmarkAllocatedBytes = 0;
+
+void* operator new(std::size_t size)
+{
+    benchmarkAllocations++;
+    benchmarkAllocatedBytes += size;
+    if (auto pointer = std::malloc(size ? size : 1))
+    {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+
+void test_packet_read(void);
+void test_packet_split(void);
+void test_packet_split_empty_parts(void);
+void test_packet_split_overflow(void);
+void test_packet_parse_integer(void);
+void test_packet_ring_buffer(void);
+void test_packet_assembler_split_frame(void);
+void test_packet_assembler_garbage(void);
+void test_packet_assembler_overflow_resync(void);
+void test_packet_assembler_store_entries_max(void);
+void test_packet_writer_single_write(void);
+void test_packet_writer_long_response(void);
+void test_packet_crc16(void);
+void test_packet_varint(void);
+void test_packet_binary_roundtrip(void);
+void test_packet_binary_corrupt_resync(void);
+void test_packet_binary_too_long(void);
+void test_packet_binary_continuation(void);
+void test_packet_request_id_text(void);
+void test_packet_request_id_pipelined_binary(void);
+void benchmark_packet_split(void);
+void benchmark_packet_writer(void);
+void benchmark_packet_binary_framing(void);
+void test_scheduler_drains_events_back_to_back(void);
+void test_scheduler_idles_only_without_work(void);
+void test_enum_reflection_count(void);
+void test_enum_reflection_constexpr_names(void);
+void benchmark_enum_reflection_lookup(void);
+void test_otp_sha1_vectors(void);
+void test_otp_hmac_sha1_vectors(void);
+void test_otp_totp_rfc6238(void);
+void test_otp_prepared_key(void);
+void benchmark_otp_generate_all(void);
+void benchmark_otp_prepared_key(void);
+void test_otp_cache(void);
+void test_otp_cache_next_step(void);
+void benchmark_otp_cache_polling(void);
+void test_otp_pbkdf2_vectors(void);
+void benchmark_otp_pbkdf2_slices(void);
+void test_vault_journal_replay(void);
+void test_vault_journal_wear_per_operation(void);
+void test_vault_journal_compaction(void);
+void test_vault_journal_torn_writes(void);
+void test_vault_journal_wear_leveling(void);
+void test_vault_journal_mapped_image(void);
+void test_vault_entry_table(void);
+void test_vault_entry_table_reload_wipes_keys(void);
+void test_vault_entry_name_index(void);
+void test_vault_entry_sealed_records(void);
+void test_vault_kdf_record(void);
+void test_vault_entry_batch_record(void);
+void test_vault_entry_transaction_record(void);
+void test_vault_snapshot_size_after_full_remove(void);
+void test_vault_key_idle_timeout_bounds(void);
+void test_vault_entries_readable_before_rekey(void);
+void benchmark_vault_entry_footprint(void);
+void benchmark_vault_large(void);
+void benchmark_vault_unlock(void);
+void benchmark_vault_batch_provisioning(void);
+void benchmark_vault_transaction_commit(void);
+void test_cipher_chacha20_vectors(void);
+void test_cipher_poly1305_vector(void);
+void test_cipher_aead_vector(void);
+void test_cipher_sealed_secret(void);
+void benchmark_cipher_throughput(void);
+void test_base32_rfc4648_vectors(void);
+void test_base32_decode_lenient(void);
+void test_base32_fuzz(void);
+void benchmark_base32_decode(void);
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_packet_read);
+    RUN_TEST(test_packet_split);
+    RUN_TEST(test_packet_split_empty_parts);
+    RUN_TEST(test_packet_split_overflow);
+    RUN_TEST(test_packet_parse_integer);
+    RUN_TEST(test_packet_ring_buffer);
+    RUN_TEST(test_packet_assembler_split_frame);
+    RUN_TEST(test_packet_assembler_garbage);
+    RUN_TEST(test_packet_assembler_overflow_resync);
+    RUN_TEST(test_packet_assembler_store_entries_max);
+    RUN_TEST(test_packet_writer_single_write);
+    RUN_TEST(test_packet_writer_long_response);
+    RUN_TEST(test_packet_crc16);
+    RUN_TEST(test_packet_varint);
+    RUN_TEST(test_packet_binary_roundtrip);
+    RUN_TEST(test_packet_binary_corrupt_resync);
+    RUN_TEST(test_packet_binary_too_long);
+    RUN_TEST(test_packet_binary_continuation);
+    RUN_TEST(test_packet_request_id_text);
+    RUN_TEST(test_packet_request_id_pipelined_binary);
+    RUN_TEST(benchmark_packet_split);
+    RUN_TEST(benchmark_packet_writer);
+    RUN_TEST(benchmark_packet_binary_framing);
+    RUN_TEST(test_scheduler_drains_events_back_to_back);
+    RUN_TEST(test_scheduler_idles_only_without_work);
+    RUN_TEST(test_enum_reflection_count);
+    RUN_TEST(test_enum_reflection_constexpr_names);
+    RUN_TEST(benchmark_enum_reflection_lookup);
+    RUN_TEST(test_otp_sha1_vectors);
+    RUN_TEST(test_otp_hmac_sha1_vectors);
+    RUN_TEST(test_otp_totp_rfc6238);
+    RUN_TEST(test_otp_prepared_key);
+    RUN_TEST(benchmark_otp_generate_all);
+    RUN_TEST(benchmark_otp_prepared_key);
+    RUN_TEST(test_otp_cache);
+    RUN_TEST(test_otp_cache_next_step);
+    RUN_TEST(benchmark_otp_cache_polling);
+    RUN_TEST(test_otp_pbkdf2_vectors);
+    RUN_TEST(benchmark_otp_pbkdf2_slices);
+    RUN_TEST(test_vault_journal_replay);
+    RUN_TEST(test_vault_journal_wear_per_operation);
+    RUN_TEST(test_vault_journal_compaction);
+    RUN_TEST(test_vault_journal_torn_writes);
+    RUN_TEST(test_vault_journal_wear_leveling);
+    RUN_TEST(test_vault_journal_mapped_image);
+    RUN_TEST(test_vault_entry_table);
+    RUN_TEST(test_vault_entry_table_reload_wipes_keys);
+    RUN_TEST(test_vault_entry_name_index);
+    RUN_TEST(test_vault_entry_sealed_records);
+    RUN_TEST(test_vault_kdf_record);
+    RUN_TEST(test_vault_entry_batch_record);
+    RUN_TEST(test_vault_entry_transaction_record);
+    RUN_TEST(test_vault_snapshot_size_after_full_remove);
+    RUN_TEST(test_vault_key_idle_timeout_bounds);
+    RUN_TEST(test_vault_entries_readable_before_rekey);
+    RUN_TEST(benchmark_vault_entry_footprint);
+    RUN_TEST(benchmark_vault_large);
+    RUN_TEST(benchmark_vault_unlock);
+    RUN_TEST(benchmark_vault_batch_provisioning);
+    RUN_TEST(benchmark_vault_transaction_commit);
+    RUN_TEST(test_cipher_chacha20_vectors);
+    RUN_TEST(test_cipher_poly1305_vector);
+    RUN_TEST(test_cipher_aead_vector);
+    RUN_TEST(test_cipher_sealed_secret);
+    RUN_TEST(benchmark_cipher_throughput);
+    RUN_TEST(test_base32_rfc4648_vectors);
+    RUN_TEST(test_base32_decode_lenient);
+    RUN_TEST(test_base32_fuzz);
+    RUN_TEST(benchmark_base32_decode);
+    return UNITY_END();
+}
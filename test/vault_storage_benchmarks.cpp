@@ -0,0 +1,354 @@
+#include <unity.h>
+#include <VaultStorage.h>
+#include <Cipher.h>
+#include <Otp.h>
+#include <Packet.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "benchmark.h"
+#include "simulated_flash.h"
+
+static constexpr std::size_t BENCHMARK_ENTRIES = 5;
+
+// Полное хранилище: 300 записей в журнале из трех банков по 32 КБ, как на устройстве
+static constexpr std::size_t BENCHMARK_LARGE_ENTRIES = 300;
+static constexpr std::size_t BENCHMARK_LARGE_ROWS = 384;
+static constexpr std::size_t BENCHMARK_LARGE_BANKS = 3;
+static constexpr auto BENCHMARK_ITERATIONS = 2000;
+
+// Прежняя раскладка из Salavat.h: запись владеет строкой и вектором, расшифрованные секреты - отдельным вектором
+struct LegacyVaultEntry
+{
+    std::string Name;
+    std::vector<uint8_t> Secret;
+    int Digits;
+};
+
+// Имена длиннее короткой строки std::string, как "GitHub: work account"
+static std::string benchmarkName(std::size_t index){
+    return "Account number " + std::to_string(index);
+}
+
+void benchmark_vault_entry_footprint(void){
+    const std::size_t secretLength = 24;
+    std::vector<std::string> names;
+    for (std::size_t i = 0; i < BENCHMARK_ENTRIES; i++){
+        names.push_back(benchmarkName(i));
+    }
+
+    auto allocations = benchmarkAllocations;
+    auto bytes = benchmarkAllocatedBytes;
+    {
+        std::vector<LegacyVaultEntry> entries;
+        std::vector<std::vector<uint8_t>> unencryptedSecrets;
+        for (const auto & name : names){
+            LegacyVaultEntry entry;
+            entry.Name = name;
+            entry.Secret.assign(secretLength, 0x5A);
+            entry.Digits = 6;
+            entries.push_back(entry);
+            unencryptedSecrets.emplace_back(secretLength - 4, 0xA5);
+        }
+        allocations = benchmarkAllocations - allocations;
+        bytes = benchmarkAllocatedBytes - bytes;
+    }
+
+    SimulatedFlash flash(16);
+    VaultJournal journal(flash);
+    journal.open();
+    journal.compact([&names, secretLength](auto && emit){
+        for (const auto & name : names){
+            VaultRecordEntry entry;
+            std::string secret(secretLength, '\x5A');
+            entry.name = name;
+            entry.secret = secret;
+            entry.digits = 6;
+            uint8_t payload[VAULT_RECORD_ENTRY_MAX];
+            emit(VAULT_RECORD_ADD, std::string_view(reinterpret_cast<const char *>(payload), encodeVaultEntry(entry, payload)));
+        }
+    });
+
+    VaultEntryTable<BENCHMARK_ENTRIES> table(flash);
+    auto tableAllocations = benchmarkAllocations;
+    TEST_ASSERT_TRUE(replayVaultEntries(journal, table));
+    tableAllocations = benchmarkAllocations - tableAllocations;
+    TEST_ASSERT_EQUAL(0, tableAllocations);
+    TEST_ASSERT_EQUAL(BENCHMARK_ENTRIES, table.size());
+
+    // Смещение данных записи и место в индексе имен, длины имени и секрета, количество цифр. Плюс бит надгробия
+    const auto indexBytes = 2 * sizeof(uint16_t) + 3 * sizeof(uint8_t);
+    printf("vault entries: table %zu bytes static, per entry %zu index + %zu key, 0 heap blocks;"
+           " legacy layout %zu heap blocks, %zu bytes peak heap for %zu entries (without allocator overhead)\n",
+           sizeof(table), indexBytes, sizeof(HmacSha1Key), allocations, bytes, BENCHMARK_ENTRIES);
+}
+
+static std::size_t benchmarkResponseBytes = 0;
+
+static void benchmarkSink(const char *, std::size_t length){
+    benchmarkResponseBytes += length;
+}
+
+// Запуск, GET_ENTRIES и GENERATE при 300 записях с самыми длинными именами и секретами
+void benchmark_vault_large(void){
+    SimulatedFlash flash(BENCHMARK_LARGE_ROWS);
+    VaultJournal journal(flash, BENCHMARK_LARGE_BANKS);
+    journal.open();
+    auto result = journal.compact([](auto && emit){
+        for (std::size_t i = 0; i < BENCHMARK_LARGE_ENTRIES; i++){
+            auto name = "Account " + std::to_string(i) + std::string(20, '.');
+            std::string secret(31 + SEALED_SECRET_OVERHEAD, (char)i);
+            VaultRecordEntry entry;
+            entry.name = std::string_view(name).substr(0, 20);
+            entry.secret = secret;
+            entry.digits = 6;
+            uint8_t payload[VAULT_RECORD_ENTRY_MAX];
+            if (!emit(VAULT_RECORD_SEALED, std::string_view(reinterpret_cast<const char *>(payload), encodeVaultEntry(entry, payload)))){
+                return;
+            }
+        }
+    });
+    TEST_ASSERT_TRUE(result == VAULT_JOURNAL_RESULT::SUCCESS);
+
+    static VaultEntryTable<BENCHMARK_LARGE_ENTRIES> table(flash);
+    auto valid = true;
+    const auto allocations = benchmarkAllocations;
+    auto initializeNanos = benchmarkNanos(BENCHMARK_ITERATIONS, [&](std::size_t){
+        VaultJournal reopened(flash, BENCHMARK_LARGE_BANKS);
+        valid = valid && reopened.open() == VAULT_JOURNAL_RESULT::SUCCESS && replayVaultEntries(reopened, table);
+    });
+    TEST_ASSERT_TRUE(valid);
+    TEST_ASSERT_EQUAL(0, benchmarkAllocations - allocations);
+    TEST_ASSERT_EQUAL(BENCHMARK_LARGE_ENTRIES, table.size());
+
+    PacketWriter writer("WARLIN", "<PART>", benchmarkSink);
+    auto entriesNanos = benchmarkNanos(BENCHMARK_ITERATIONS, [&](std::size_t){
+        writer.begin().append("ENTRIES");
+        for (std::size_t entryId = 0; entryId < table.size(); entryId++){
+            writer.append(table[entryId].name);
+        }
+        writer.finish();
+    });
+
+    for (std::size_t entryId = 0; entryId < table.size(); entryId++){
+        const auto secret = table[entryId].secret;
+        hmacSha1Prepare(reinterpret_cast<const uint8_t *>(secret.data()), secret.size(), table.key(entryId));
+    }
+    uint8_t counter[OTP_COUNTER_LENGTH];
+    char code[OTP_CODE_LENGTH + 1];
+    std::size_t sink = 0;
+    auto generateNanos = benchmarkNanos(BENCHMARK_ITERATIONS * 50, [&](std::size_t i){
+        totpCounter(1700000000L + (long)i * 30, counter);
+        hotpCode(table.key(BENCHMARK_LARGE_ENTRIES - 1 - i % 16), counter, code);
+        sink += code[0];
+    });
+
+    printf("vault %zu entries: journal %zu bytes, initialize %.1f us, GET_ENTRIES %.1f us (%zu bytes), GENERATE %.0f ns (%zu)\n",
+           BENCHMARK_LARGE_ENTRIES, journal.used(), initializeNanos / 1000, entriesNanos / 1000,
+           benchmarkResponseBytes / BENCHMARK_ITERATIONS, generateNanos, sink);
+}
+
+// Проверка пароля по одной записи, как unlock в Salavat: тег запечатанного секрета
+static bool benchmarkVerify(const VaultRecordEntry & entry, const uint8_t sealKey[CHACHA20_KEY_LENGTH]){
+    uint8_t plain[UINT8_MAX];
+    std::size_t length = 0;
+    auto valid = openSecret(sealKey, entry.secret, entry.name, plain, length);
+    secureZero(plain, length);
+    return valid;
+}
+
+// Подготовка ключа записи, как prepareKey в Salavat: открытие секрета и пэды HMAC
+static void benchmarkPrepare(VaultEntryTable<BENCHMARK_LARGE_ENTRIES> & table, std::size_t id, const uint8_t sealKey[CHACHA20_KEY_LENGTH]){
+    const auto entry = table[id];
+    uint8_t plain[UINT8_MAX];
+    std::size_t length = 0;
+    if (openSecret(sealKey, entry.secret, entry.name, plain, length)){
+        hmacSha1Prepare(plain, length, table.key(id));
+        table.markPrepared(id);
+    }
+    secureZero(plain, length);
+}
+
+// Разблокировка: раньше ключи всех записей готовились сразу, теперь проверяется только пароль
+void benchmark_vault_unlock(void){
+    static const std::size_t counts[] = {5, 50, 300};
+    uint8_t sealKey[CHACHA20_KEY_LENGTH];
+    for (std::size_t i = 0; i < sizeof(sealKey); i++){
+        sealKey[i] = (uint8_t)(i * 7);
+    }
+
+    printf("vault unlock:");
+    for (auto entriesCount : counts){
+        SimulatedFlash flash(BENCHMARK_LARGE_ROWS);
+        VaultJournal journal(flash, BENCHMARK_LARGE_BANKS);
+        journal.open();
+        journal.compact([entriesCount, &sealKey](auto && emit){
+            for (std::size_t i = 0; i < entriesCount; i++){
+                auto name = "Account " + std::to_string(i);
+                uint8_t secret[31];
+                uint8_t sealed[sizeof(secret) + SEALED_SECRET_OVERHEAD];
+                uint8_t nonce[CHACHA20_NONCE_LENGTH] = {(uint8_t)i, (uint8_t)(i >> 8)};
+                std::fill(secret, secret + sizeof(secret), (uint8_t)i);
+                VaultRecordEntry entry;
+                entry.name = name;
+                entry.secret = std::string_view(reinterpret_cast<const char *>(sealed), sealSecret(sealKey, nonce, name, secret, sizeof(secret), sealed));
+                entry.digits = 6;
+                uint8_t payload[VAULT_RECORD_ENTRY_MAX];
+                emit(VAULT_RECORD_SEALED, std::string_view(reinterpret_cast<const char *>(payload), encodeVaultEntry(entry, payload)));
+            }
+        });
+        auto tableOwner = std::make_unique<VaultEntryTable<BENCHMARK_LARGE_ENTRIES>>(flash);
+        auto & table = *tableOwner;
+        TEST_ASSERT_TRUE(replayVaultEntries(journal, table));
+
+        std::size_t sink = 0;
+        auto eagerNanos = benchmarkNanos(BENCHMARK_ITERATIONS / 20, [&](std::size_t){
+            sink += benchmarkVerify(table[0], sealKey);
+            for (std::size_t id = 0; id < table.size(); id++){
+                benchmarkPrepare(table, id, sealKey);
+            }
+            table.wipeKeys();
+        });
+        auto lazyNanos = benchmarkNanos(BENCHMARK_ITERATIONS, [&](std::size_t){
+            sink += benchmarkVerify(table[0], sealKey);
+        });
+
+        // Первый код записи после разблокировки платит за подготовку ее ключа
+        uint8_t counter[OTP_COUNTER_LENGTH] = {};
+        char code[OTP_CODE_LENGTH + 1];
+        auto firstCodeNanos = benchmarkNanos(BENCHMARK_ITERATIONS, [&](std::size_t i){
+            const auto id = i % table.size();
+            if (!table.prepared(id)){
+                benchmarkPrepare(table, id, sealKey);
+            }
+            hotpCode(table.key(id), counter, code);
+            table.wipeKeys();
+            sink += code[0];
+        });
+        TEST_ASSERT_FALSE(table.anyPrepared());
+
+        printf(" %zu entries eager %.1f us, lazy %.2f us (first code %.1f us);",
+               entriesCount, eagerNanos / 1000, lazyNanos / 1000, firstCodeNanos / 1000);
+        TEST_ASSERT_GREATER_THAN(0, sink + 1);
+    }
+    printf("\n");
+}
+
+// Записей в одном пакете BATCH: столько помещается в запрос STORE_ENTRIES
+static constexpr std::size_t BENCHMARK_BATCH_ENTRIES = 6;
+
+/*
+ * Заполнение хранилища на 300 записей по одной записи журнала на счет и пакетами BATCH
+ * Считаются записи журнала, вызовы записи во флеш и записанные байты
+ */
+void benchmark_vault_batch_provisioning(void){
+    std::vector<std::string> payloads;
+    for (std::size_t i = 0; i < BENCHMARK_LARGE_ENTRIES; i++){
+        const auto name = "Account " + std::to_string(i);
+        const std::string secret(20 + SEALED_SECRET_OVERHEAD, (char)i);
+        VaultRecordEntry entry;
+        entry.name = name;
+        entry.secret = secret;
+        entry.digits = 6;
+        uint8_t payload[VAULT_RECORD_ENTRY_MAX];
+        payloads.emplace_back(reinterpret_cast<const char *>(payload), encodeVaultEntry(entry, payload));
+    }
+
+    auto provision = [&payloads](std::size_t perRecord, SimulatedFlash & flash, std::size_t & records, std::size_t & used){
+        VaultJournal journal(flash, BENCHMARK_LARGE_BANKS);
+        journal.open();
+        journal.format();
+        flash.resetCounters();
+        records = 0;
+        for (std::size_t first = 0; first < payloads.size(); first += perRecord){
+            std::string batch;
+            for (auto i = first; i < first + perRecord && i < payloads.size(); i++){
+                batch += payloads[i];
+                batch.append((FLASH_WORD_SIZE - payloads[i].size() % FLASH_WORD_SIZE) % FLASH_WORD_SIZE, '\0');
+            }
+            const auto type = perRecord == 1 ? VAULT_RECORD_SEALED : VAULT_RECORD_BATCH;
+            TEST_ASSERT_TRUE(journal.append(type, perRecord == 1 ? payloads[first] : batch) == VAULT_JOURNAL_RESULT::SUCCESS);
+            records++;
+        }
+
+        VaultEntryTable<BENCHMARK_LARGE_ENTRIES> check(flash);
+        TEST_ASSERT_TRUE(replayVaultEntries(journal, check));
+        TEST_ASSERT_EQUAL(BENCHMARK_LARGE_ENTRIES, check.live());
+        used = journal.used();
+    };
+
+    SimulatedFlash single(BENCHMARK_LARGE_ROWS);
+    SimulatedFlash batched(BENCHMARK_LARGE_ROWS);
+    std::size_t singleRecords, singleUsed, batchRecords, batchUsed;
+    provision(1, single, singleRecords, singleUsed);
+    provision(BENCHMARK_BATCH_ENTRIES, batched, batchRecords, batchUsed);
+
+    TEST_ASSERT_EQUAL(0, batched.erases);
+    TEST_ASSERT_LESS_THAN(single.programs, batched.programs);
+    printf("vault provisioning %zu entries: one per record %zu records, %zu flash writes, %zu bytes; "
+           "batches of %zu %zu records, %zu flash writes, %zu bytes\n",
+           BENCHMARK_LARGE_ENTRIES, singleRecords, single.programs, singleUsed,
+           BENCHMARK_BATCH_ENTRIES, batchRecords, batched.programs, batchUsed);
+}
+
+/*
+ * Смешанная правка полного хранилища: три удаления и два добавления по записи журнала на каждое
+ * и одной записью TRANSACTION. Считаются вызовы записи во флеш и записанные байты
+ */
+void benchmark_vault_transaction_commit(void){
+    // Данные SEALED или запись в данных BATCH, с выравниванием до слова
+    auto entryPayload = [](const std::string & name, bool batched){
+        const std::string secret(20 + SEALED_SECRET_OVERHEAD, '\x5A');
+        VaultRecordEntry entry;
+        entry.name = name;
+        entry.secret = secret;
+        entry.digits = 6;
+        uint8_t payload[VAULT_RECORD_BATCH_ENTRY_MAX];
+        const auto length = batched ? encodeVaultBatchEntry(entry, payload) : encodeVaultEntry(entry, payload);
+        return std::string(reinterpret_cast<const char *>(payload), length);
+    };
+    const uint16_t removed[] = {10, 150, 299};
+    const std::vector<std::string> added = {"Discord", "Proton"};
+
+    auto prepare = [&](SimulatedFlash & flash, VaultJournal & journal){
+        journal.open();
+        journal.format();
+        journal.compact([&](auto && emit){
+            for (std::size_t i = 0; i < BENCHMARK_LARGE_ENTRIES; i++){
+                if (!emit(VAULT_RECORD_SEALED, entryPayload("Account " + std::to_string(i), false))){
+                    return;
+                }
+            }
+        });
+        flash.resetCounters();
+    };
+
+    SimulatedFlash separate(BENCHMARK_LARGE_ROWS);
+    VaultJournal separateJournal(separate, BENCHMARK_LARGE_BANKS);
+    prepare(separate, separateJournal);
+    for (auto id : removed){
+        uint8_t payload[2];
+        TEST_ASSERT_TRUE(separateJournal.append(VAULT_RECORD_TOMBSTONE, std::string_view(reinterpret_cast<const char *>(payload), encodeVaultRemove(id, payload))) == VAULT_JOURNAL_RESULT::SUCCESS);
+    }
+    for (const auto & name : added){
+        TEST_ASSERT_TRUE(separateJournal.append(VAULT_RECORD_SEALED, entryPayload(name, false)) == VAULT_JOURNAL_RESULT::SUCCESS);
+    }
+
+    SimulatedFlash single(BENCHMARK_LARGE_ROWS);
+    VaultJournal singleJournal(single, BENCHMARK_LARGE_BANKS);
+    prepare(single, singleJournal);
+    uint8_t header[vaultTransactionHeaderSize(3)];
+    const auto transaction = std::string(reinterpret_cast<const char *>(header), encodeVaultTransactionHeader(removed, 3, header))
+                           + entryPayload(added[0], true) + entryPayload(added[1], true);
+    TEST_ASSERT_TRUE(singleJournal.append(VAULT_RECORD_TRANSACTION, transaction) == VAULT_JOURNAL_RESULT::SUCCESS);
+
+    static VaultEntryTable<BENCHMARK_LARGE_ENTRIES + 2> separateTable(separate);
+    static VaultEntryTable<BENCHMARK_LARGE_ENTRIES + 2> singleTable(single);
+    TEST_ASSERT_TRUE(replayVaultEntries(separateJournal, separateTable));
+    TEST_ASSERT_TRUE(replayVaultEntries(singleJournal, singleTable));
+    TEST_ASSERT_EQUAL(separateTable.live(), singleTable.live());
+    TEST_ASSERT_LESS_THAN(separate.programs, single.programs);
+
+    printf("vault mixed edit (3 removes, 2 adds): separate records %zu flash writes, %zu bytes; one transaction %zu flash writes, %zu bytes\n",
+           separate.programs, separate.programmed, single.programs, single.programmed);
+}
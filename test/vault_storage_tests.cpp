@@ -0,0 +1,714 @@
+#include <unity.h>
+#include <VaultStorage.h>
+#include <Cipher.h>
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "benchmark.h"
+#include "mapped_file_flash.h"
+#include "simulated_flash.h"
+
+// 16 строк по 256 байт, как на устройстве
+static constexpr std::size_t TEST_FLASH_ROWS = 16;
+
+// Старая схема: EEPROM.commit() FlashStorage_SAMD стирает и переписывает все 1024 байта эмуляции
+static constexpr std::size_t LEGACY_EEPROM_SIZE = 1024;
+
+static std::string entryPayload(const std::string & name, std::size_t secretLength){
+    VaultRecordEntry entry;
+    std::string secret(secretLength, '\x5A');
+    entry.name = name;
+    entry.secret = secret;
+    entry.digits = 6;
+    uint8_t buffer[VAULT_RECORD_ENTRY_MAX];
+    auto length = encodeVaultEntry(entry, buffer);
+    return std::string(reinterpret_cast<const char *>(buffer), length);
+}
+
+static std::string removePayload(std::size_t index){
+    uint8_t buffer[2];
+    auto length = encodeVaultRemove(index, buffer);
+    return std::string(reinterpret_cast<const char *>(buffer), length);
+}
+
+// Живые записи после проигрывания журнала, пусто при некорректной записи
+static std::vector<std::string> replayNames(const VaultJournal & journal){
+    std::vector<std::string> names;
+    std::vector<bool> alive;
+    auto valid = true;
+    journal.replay([&names, &alive, &valid](uint8_t type, std::string_view payload){
+        VaultRecordEntry entry;
+        std::size_t id;
+        if (type == VAULT_RECORD_ADD && decodeVaultEntry(payload, entry)){
+            names.emplace_back(entry.name);
+            alive.push_back(true);
+        } else if (type == VAULT_RECORD_TOMBSTONE && decodeVaultRemove(payload, id) && id < names.size() && alive[id]){
+            alive[id] = false;
+        } else {
+            valid = false;
+        }
+        return valid;
+    });
+    std::vector<std::string> live;
+    for (std::size_t id = 0; valid && id < names.size(); id++){
+        if (alive[id]){
+            live.push_back(names[id]);
+        }
+    }
+    return live;
+}
+
+static VAULT_JOURNAL_RESULT compactNames(VaultJournal & journal, const std::vector<std::string> & names){
+    return journal.compact([&names](auto && emit){
+        for (const auto & name : names){
+            if (!emit(VAULT_RECORD_ADD, entryPayload(name, 14))){
+                return;
+            }
+        }
+    });
+}
+
+void test_vault_journal_replay(void){
+    SimulatedFlash flash(TEST_FLASH_ROWS);
+    VaultJournal journal(flash);
+    TEST_ASSERT_TRUE(journal.open() == VAULT_JOURNAL_RESULT::EMPTY);
+
+    TEST_ASSERT_TRUE(journal.append(VAULT_RECORD_ADD, entryPayload("Google", 14)) == VAULT_JOURNAL_RESULT::SUCCESS);
+    TEST_ASSERT_TRUE(journal.append(VAULT_RECORD_ADD, entryPayload("GitHub", 14)) == VAULT_JOURNAL_RESULT::SUCCESS);
+    TEST_ASSERT_TRUE(journal.append(VAULT_RECORD_ADD, entryPayload("Yandex", 14)) == VAULT_JOURNAL_RESULT::SUCCESS);
+    TEST_ASSERT_TRUE(journal.append(VAULT_RECORD_TOMBSTONE, removePayload(1)) == VAULT_JOURNAL_RESULT::SUCCESS);
+
+    VaultJournal reopened(flash);
+    TEST_ASSERT_TRUE(reopened.open() == VAULT_JOURNAL_RESULT::SUCCESS);
+    auto names = replayNames(reopened);
+    TEST_ASSERT_EQUAL(2, names.size());
+    TEST_ASSERT_EQUAL_STRING("Google", names[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("Yandex", names[1].c_str());
+    TEST_ASSERT_EQUAL(journal.used(), reopened.used());
+}
+
+// Изменение стоит одной записи без стирания, стирание - только при уплотнении
+void test_vault_journal_wear_per_operation(void){
+    SimulatedFlash flash(TEST_FLASH_ROWS);
+    VaultJournal journal(flash);
+    journal.open();
+    journal.format();
+
+    const auto payload = entryPayload("Google", 14);
+    flash.resetCounters();
+    TEST_ASSERT_TRUE(journal.append(VAULT_RECORD_ADD, payload) == VAULT_JOURNAL_RESULT::SUCCESS);
+    TEST_ASSERT_EQUAL(0, flash.erases);
+    TEST_ASSERT_EQUAL(VaultJournal::recordSize(payload.size()), flash.programmed);
+    auto addBytes = flash.programmed;
+
+    flash.resetCounters();
+    TEST_ASSERT_TRUE(journal.append(VAULT_RECORD_TOMBSTONE, removePayload(0)) == VAULT_JOURNAL_RESULT::SUCCESS);
+    TEST_ASSERT_EQUAL(0, flash.erases);
+    TEST_ASSERT_EQUAL(8, flash.programmed);
+    auto removeBytes = flash.programmed;
+
+    // Добавления и удаления по кругу, пока журнал не уплотнится несколько раз
+    std::vector<std::string> names;
+    std::size_t operations = 0, compactions = 0;
+    flash.resetCounters();
+    for (auto round = 0; round < 200; round++){
+        auto result = journal.append(VAULT_RECORD_ADD, payload);
+        names.push_back("Google");
+        if (result == VAULT_JOURNAL_RESULT::FULL){
+            TEST_ASSERT_TRUE(compactNames(journal, names) == VAULT_JOURNAL_RESULT::SUCCESS);
+            compactions++;
+        }
+        operations++;
+        result = journal.append(VAULT_RECORD_TOMBSTONE, removePayload(0));
+        names.erase(names.begin());
+        if (result == VAULT_JOURNAL_RESULT::FULL){
+            TEST_ASSERT_TRUE(compactNames(journal, names) == VAULT_JOURNAL_RESULT::SUCCESS);
+            compactions++;
+        }
+        operations++;
+    }
+    TEST_ASSERT_GREATER_THAN(0, compactions);
+    TEST_ASSERT_EQUAL(compactions * TEST_FLASH_ROWS / 2, flash.erases);
+
+    printf("journal: add %zu bytes, remove %zu bytes, 0 erases; %zu ops: %.2f row erases/op, %.1f bytes/op"
+           " (EEPROM.commit: %zu rows, %zu bytes per op)\n",
+           addBytes, removeBytes, operations, (double)flash.erases / operations, (double)flash.programmed / operations,
+           LEGACY_EEPROM_SIZE / flash.rowBytes, LEGACY_EEPROM_SIZE);
+}
+
+void test_vault_journal_compaction(void){
+    SimulatedFlash flash(TEST_FLASH_ROWS);
+    VaultJournal journal(flash);
+    journal.open();
+
+    std::vector<std::string> names = {"Google", "GitHub"};
+    TEST_ASSERT_TRUE(compactNames(journal, names) == VAULT_JOURNAL_RESULT::SUCCESS);
+    const auto generation = journal.generation();
+
+    // Заполнить банк до отказа
+    VAULT_JOURNAL_RESULT result;
+    while ((result = journal.append(VAULT_RECORD_ADD, entryPayload("Filler", 14))) == VAULT_JOURNAL_RESULT::SUCCESS){
+        names.push_back("Filler");
+    }
+    TEST_ASSERT_TRUE(result == VAULT_JOURNAL_RESULT::FULL);
+
+    names.resize(3);
+    TEST_ASSERT_TRUE(compactNames(journal, names) == VAULT_JOURNAL_RESULT::SUCCESS);
+    TEST_ASSERT_EQUAL(generation + 1, journal.generation());
+
+    VaultJournal reopened(flash);
+    TEST_ASSERT_TRUE(reopened.open() == VAULT_JOURNAL_RESULT::SUCCESS);
+    TEST_ASSERT_EQUAL(3, replayNames(reopened).size());
+    TEST_ASSERT_TRUE(reopened.append(VAULT_RECORD_ADD, entryPayload("After", 14)) == VAULT_JOURNAL_RESULT::SUCCESS);
+}
+
+// Сбой питания посреди записи или уплотнения не теряет уже записанное состояние
+void test_vault_journal_torn_writes(void){
+    SimulatedFlash flash(TEST_FLASH_ROWS);
+    VaultJournal journal(flash);
+    journal.open();
+    journal.append(VAULT_RECORD_ADD, entryPayload("Google", 14));
+
+    flash.failAfter = 10;
+    TEST_ASSERT_TRUE(journal.append(VAULT_RECORD_ADD, entryPayload("Torn", 14)) == VAULT_JOURNAL_RESULT::FLASH_ERROR);
+    flash.failAfter = SIZE_MAX;
+
+    VaultJournal reopened(flash);
+    TEST_ASSERT_TRUE(reopened.open() == VAULT_JOURNAL_RESULT::SUCCESS);
+    TEST_ASSERT_EQUAL(1, replayNames(reopened).size());
+
+    // Дописывать после оборванной записи нельзя, нужно уплотнение
+    TEST_ASSERT_TRUE(reopened.append(VAULT_RECORD_ADD, entryPayload("Next", 14)) == VAULT_JOURNAL_RESULT::FULL);
+
+    flash.failAfter = 40;
+    TEST_ASSERT_TRUE(compactNames(reopened, {"Google", "Next"}) == VAULT_JOURNAL_RESULT::FLASH_ERROR);
+    flash.failAfter = SIZE_MAX;
+
+    VaultJournal afterCrash(flash);
+    TEST_ASSERT_TRUE(afterCrash.open() == VAULT_JOURNAL_RESULT::SUCCESS);
+    auto names = replayNames(afterCrash);
+    TEST_ASSERT_EQUAL(1, names.size());
+    TEST_ASSERT_EQUAL_STRING("Google", names[0].c_str());
+
+    TEST_ASSERT_TRUE(compactNames(afterCrash, {"Google", "Next"}) == VAULT_JOURNAL_RESULT::SUCCESS);
+    VaultJournal recovered(flash);
+    recovered.open();
+    TEST_ASSERT_EQUAL(2, replayNames(recovered).size());
+}
+
+// Уплотнения идут по кругу через весь пул, разброс стираний между строками не больше одного
+void test_vault_journal_wear_leveling(void){
+    SimulatedFlash flash(32);
+    VaultJournal journal(flash, 4);
+    journal.open();
+    journal.format();
+
+    std::vector<std::string> names = {"Google", "GitHub", "Yandex"};
+    const auto payload = entryPayload("Filler", 14);
+    for (auto round = 0; round < 1000; round++){
+        auto result = journal.append(VAULT_RECORD_ADD, payload);
+        if (result == VAULT_JOURNAL_RESULT::FULL){
+            TEST_ASSERT_TRUE(compactNames(journal, names) == VAULT_JOURNAL_RESULT::SUCCESS);
+
+            // Запуск находит самый новый банк по одним заголовкам
+            VaultJournal reopened(flash, 4);
+            TEST_ASSERT_TRUE(reopened.open() == VAULT_JOURNAL_RESULT::SUCCESS);
+            TEST_ASSERT_EQUAL(journal.generation(), reopened.generation());
+            TEST_ASSERT_EQUAL(names.size(), replayNames(reopened).size());
+        }
+    }
+
+    const auto rowsPerBank = journal.bankSize() / flash.rowBytes;
+    std::size_t least = SIZE_MAX, most = 0;
+    for (std::size_t row = 0; row < flash.rowErases.size(); row++){
+        least = std::min(least, flash.rowErases[row]);
+        most = std::max(most, flash.rowErases[row]);
+        TEST_ASSERT_EQUAL(journal.bankErases(row / rowsPerBank), flash.rowErases[row]);
+    }
+    TEST_ASSERT_LESS_OR_EQUAL(1, most - least);
+
+    VaultJournal reopened(flash, 4);
+    reopened.open();
+    printf("wear: %u compactions over %zu banks, row erases min %zu max %zu; banks",
+           journal.generation() - 1, journal.bankCount(), least, most);
+    for (std::size_t bank = 0; bank < reopened.bankCount(); bank++){
+        printf(" %u", reopened.bankErases(bank));
+        TEST_ASSERT_EQUAL(journal.bankErases(bank), reopened.bankErases(bank));
+    }
+    printf(" (EEPROM emulation: all %d commits on the same 4 rows)\n", 1000);
+}
+
+// Образ журнала из файла через mmap: записи - представления в отображенную память, без выделений
+void test_vault_journal_mapped_image(void){
+    SimulatedFlash flash(TEST_FLASH_ROWS);
+    VaultJournal journal(flash);
+    journal.open();
+    compactNames(journal, {"Google", "GitHub", "Yandex", "Mail"});
+    journal.append(VAULT_RECORD_TOMBSTONE, removePayload(2));
+    journal.append(VAULT_RECORD_ADD, entryPayload("Steam", 20));
+
+    auto file = std::tmpfile();
+    TEST_ASSERT_NOT_NULL(file);
+    TEST_ASSERT_EQUAL(flash.memory.size(), std::fwrite(flash.memory.data(), 1, flash.memory.size(), file));
+    std::fflush(file);
+
+    MappedFileFlash mapped(fileno(file), flash.memory.size());
+    TEST_ASSERT_TRUE(mapped.mapped());
+
+    VaultEntryTable<8> entries(mapped);
+    VaultJournal image(mapped);
+    const auto allocations = benchmarkAllocations;
+    TEST_ASSERT_TRUE(image.open() == VAULT_JOURNAL_RESULT::SUCCESS);
+    TEST_ASSERT_TRUE(replayVaultEntries(image, entries));
+    TEST_ASSERT_EQUAL(0, benchmarkAllocations - allocations);
+
+    TEST_ASSERT_EQUAL(4, entries.live());
+    TEST_ASSERT_FALSE(entries.alive(2));
+    TEST_ASSERT_TRUE(entries[3].name == "Mail");
+    TEST_ASSERT_TRUE(entries[4].name == "Steam");
+    TEST_ASSERT_EQUAL(20, entries[4].secret.size());
+    const auto begin = reinterpret_cast<const char *>(mapped.image());
+    for (std::size_t i = 0; i < entries.size(); i++){
+        const auto entry = entries[i];
+        TEST_ASSERT_TRUE(entry.name.data() >= begin && entry.name.data() + entry.name.size() <= begin + mapped.size());
+        TEST_ASSERT_TRUE(entry.secret.data() >= begin && entry.secret.data() + entry.secret.size() <= begin + mapped.size());
+    }
+
+    // Образ только для чтения: изменение не портит файл
+    TEST_ASSERT_TRUE(image.append(VAULT_RECORD_TOMBSTONE, removePayload(0)) == VAULT_JOURNAL_RESULT::FLASH_ERROR);
+    VaultEntryTable<3> small(mapped);
+    TEST_ASSERT_FALSE(replayVaultEntries(image, small));
+
+    std::fclose(file);
+}
+
+// Снимок таблицы, как в Salavat: живые записи и пустые записи на месте надгробий
+static VAULT_JOURNAL_RESULT compactTable(VaultJournal & journal, const VaultEntryTable<8> & entries){
+    return journal.compact([&entries](auto && emit){
+        uint8_t payload[VAULT_RECORD_ENTRY_MAX];
+        for (std::size_t id = 0; id < entries.size(); id++){
+            auto length = entries.alive(id) ? encodeVaultEntry(entries[id], payload) : 0;
+            auto type = !entries.alive(id) ? VAULT_RECORD_HOLE : entries[id].sealed ? VAULT_RECORD_SEALED : VAULT_RECORD_ADD;
+            if (!emit(type, std::string_view(reinterpret_cast<const char *>(payload), length))){
+                return;
+            }
+        }
+    });
+}
+
+// Удаление - надгробие за O(1): идентификаторы и ключи остальных записей не меняются, в том числе после уплотнения
+void test_vault_entry_table(void){
+    SimulatedFlash flash(TEST_FLASH_ROWS);
+    VaultJournal journal(flash);
+    journal.open();
+    compactNames(journal, {"Google", "GitHub", "Yandex"});
+
+    VaultEntryTable<8> entries(flash);
+    TEST_ASSERT_TRUE(replayVaultEntries(journal, entries));
+    TEST_ASSERT_FALSE(entries.anyPrepared());
+    for (std::size_t id = 0; id < entries.size(); id++){
+        entries.key(id).inner[0] = (uint32_t)(100 + id);
+        entries.markPrepared(id);
+    }
+
+    // Ключ удаленной записи затирается сразу, после отката он готовится заново
+    entries.erase(1);
+    TEST_ASSERT_FALSE(entries.prepared(1));
+    TEST_ASSERT_EQUAL(0, entries.key(1).inner[0]);
+    TEST_ASSERT_EQUAL(3, entries.size());
+    TEST_ASSERT_EQUAL(2, entries.live());
+    TEST_ASSERT_FALSE(entries.alive(1));
+    TEST_ASSERT_TRUE(entries[2].name == "Yandex");
+    TEST_ASSERT_EQUAL(102, entries.key(2).inner[0]);
+
+    entries.restore(1);
+    TEST_ASSERT_TRUE(entries.alive(1));
+    TEST_ASSERT_TRUE(entries[1].name == "GitHub");
+
+    // Надгробие в журнале, после уплотнения и после перезапуска идентификаторы те же, ключи - нет
+    entries.erase(1);
+    TEST_ASSERT_TRUE(journal.append(VAULT_RECORD_TOMBSTONE, removePayload(1)) == VAULT_JOURNAL_RESULT::SUCCESS);
+    TEST_ASSERT_TRUE(compactTable(journal, entries) == VAULT_JOURNAL_RESULT::SUCCESS);
+    TEST_ASSERT_TRUE(replayVaultEntries(journal, entries));
+    TEST_ASSERT_EQUAL(3, entries.size());
+    TEST_ASSERT_FALSE(entries.alive(1));
+    TEST_ASSERT_TRUE(entries[2].name == "Yandex");
+    TEST_ASSERT_FALSE(entries.anyPrepared());
+    TEST_ASSERT_EQUAL(0, entries.key(2).inner[0]);
+    entries.key(2).inner[0] = 102;
+    entries.markPrepared(2);
+
+    VaultJournal reopened(flash);
+    reopened.open();
+    VaultEntryTable<8> restarted(flash);
+    TEST_ASSERT_TRUE(replayVaultEntries(reopened, restarted));
+    TEST_ASSERT_EQUAL(3, restarted.size());
+    TEST_ASSERT_FALSE(restarted.alive(1));
+    TEST_ASSERT_TRUE(restarted[2].name == "Yandex");
+
+    // purge() убирает надгробия: записи сдвигаются вместе с ключами
+    entries.purge();
+    TEST_ASSERT_EQUAL(2, entries.size());
+    TEST_ASSERT_TRUE(entries[1].name == "Yandex");
+    TEST_ASSERT_EQUAL(102, entries.key(1).inner[0]);
+    TEST_ASSERT_TRUE(entries.prepared(1));
+    TEST_ASSERT_EQUAL(0, entries.key(2).inner[0]);
+    TEST_ASSERT_FALSE(entries.prepared(2));
+    TEST_ASSERT_EQUAL(1, entries.find("Yandex"));
+    TEST_ASSERT_TRUE(compactTable(journal, entries) == VAULT_JOURNAL_RESULT::SUCCESS);
+    TEST_ASSERT_TRUE(replayVaultEntries(journal, entries));
+    TEST_ASSERT_EQUAL(2, entries.size());
+
+    // Данные вне образа флеш-памяти в таблицу не попадают
+    const auto outside = entryPayload("Heap", 14);
+    TEST_ASSERT_FALSE(entries.push_back(outside));
+
+    entries.wipeKeys();
+    TEST_ASSERT_EQUAL(0, entries.key(1).inner[0]);
+    TEST_ASSERT_FALSE(entries.anyPrepared());
+}
+
+// Перезагрузка таблицы забывает ключи: идентификатор мог достаться другой записи
+void test_vault_entry_table_reload_wipes_keys(void){
+    SimulatedFlash flash(TEST_FLASH_ROWS);
+    VaultJournal journal(flash);
+    journal.open();
+    compactNames(journal, {"Google", "GitHub", "Yandex"});
+
+    VaultEntryTable<8> entries(flash);
+    TEST_ASSERT_TRUE(replayVaultEntries(journal, entries));
+    for (std::size_t id = 0; id < entries.size(); id++){
+        entries.key(id).inner[0] = (uint32_t)(100 + id);
+        entries.key(id).outer[4] = (uint32_t)(200 + id);
+        entries.markPrepared(id);
+    }
+
+    // Новый снимок без Google: идентификатор 0 теперь у Yandex
+    compactNames(journal, {"Yandex", "GitHub"});
+    TEST_ASSERT_TRUE(replayVaultEntries(journal, entries));
+    TEST_ASSERT_EQUAL(2, entries.size());
+    TEST_ASSERT_TRUE(entries[0].name == "Yandex");
+    TEST_ASSERT_FALSE(entries.anyPrepared());
+    for (std::size_t id = 0; id < entries.capacity(); id++){
+        TEST_ASSERT_FALSE(entries.prepared(id));
+        TEST_ASSERT_EQUAL(0, entries.key(id).inner[0]);
+        TEST_ASSERT_EQUAL(0, entries.key(id).outer[4]);
+    }
+}
+
+// Формат секрета задается типом записи: ADD первой версии и SEALED живут в одном журнале и переживают уплотнение
+void test_vault_entry_sealed_records(void){
+    SimulatedFlash flash(TEST_FLASH_ROWS);
+    VaultJournal journal(flash);
+    journal.open();
+    compactNames(journal, {"Google", "GitHub"});
+    TEST_ASSERT_TRUE(journal.append(VAULT_RECORD_SEALED, entryPayload("Yandex", 14 + 28)) == VAULT_JOURNAL_RESULT::SUCCESS);
+
+    VaultEntryTable<8> entries(flash);
+    TEST_ASSERT_TRUE(replayVaultEntries(journal, entries));
+    TEST_ASSERT_EQUAL(3, entries.live());
+    TEST_ASSERT_FALSE(entries[0].sealed);
+    TEST_ASSERT_TRUE(entries[2].sealed);
+    TEST_ASSERT_EQUAL(42, entries[2].secret.size());
+
+    entries.erase(1);
+    TEST_ASSERT_TRUE(compactTable(journal, entries) == VAULT_JOURNAL_RESULT::SUCCESS);
+    TEST_ASSERT_TRUE(replayVaultEntries(journal, entries));
+    TEST_ASSERT_FALSE(entries[0].sealed);
+    TEST_ASSERT_TRUE(entries[2].sealed);
+
+    entries.purge();
+    TEST_ASSERT_TRUE(entries[1].name == "Yandex");
+    TEST_ASSERT_TRUE(entries[1].sealed);
+}
+
+// Записи пакета BATCH появляются все сразу, с идентификаторами подряд, или не появляется ни одна
+void test_vault_entry_batch_record(void){
+    SimulatedFlash flash(TEST_FLASH_ROWS);
+    VaultJournal journal(flash);
+    journal.open();
+    compactNames(journal, {"Google"});
+
+    std::string batch;
+    for (const auto & name : {"GitHub", "Yandex", "X"}){
+        VaultRecordEntry entry;
+        const std::string secret(20 + 28, '\x5A');
+        entry.name = name;
+        entry.secret = secret;
+        entry.digits = 8;
+        uint8_t buffer[VAULT_RECORD_BATCH_ENTRY_MAX];
+        const auto length = encodeVaultBatchEntry(entry, buffer);
+        TEST_ASSERT_EQUAL(0, length % FLASH_WORD_SIZE);
+        batch.append(reinterpret_cast<const char *>(buffer), length);
+    }
+    TEST_ASSERT_TRUE(journal.append(VAULT_RECORD_BATCH, batch) == VAULT_JOURNAL_RESULT::SUCCESS);
+
+    VaultEntryTable<8> entries(flash);
+    TEST_ASSERT_TRUE(replayVaultEntries(journal, entries));
+    TEST_ASSERT_EQUAL(4, entries.live());
+    TEST_ASSERT_TRUE(entries[1].name == "GitHub");
+    TEST_ASSERT_TRUE(entries[3].name == "X");
+    TEST_ASSERT_TRUE(entries[3].sealed);
+    TEST_ASSERT_EQUAL(8, entries[3].digits);
+    TEST_ASSERT_EQUAL(20 + 28, entries[2].secret.size());
+
+    // Снимок раскладывает пакет на отдельные записи SEALED с теми же идентификаторами
+    TEST_ASSERT_TRUE(compactTable(journal, entries) == VAULT_JOURNAL_RESULT::SUCCESS);
+    TEST_ASSERT_TRUE(replayVaultEntries(journal, entries));
+    TEST_ASSERT_EQUAL(4, entries.live());
+    TEST_ASSERT_TRUE(entries[2].name == "Yandex");
+
+    // Оборванный пакет отбрасывается целиком
+    flash.failAfter = batch.size() / 2;
+    TEST_ASSERT_TRUE(journal.append(VAULT_RECORD_BATCH, batch) == VAULT_JOURNAL_RESULT::FLASH_ERROR);
+    flash.failAfter = SIZE_MAX;
+    VaultJournal reopened(flash);
+    TEST_ASSERT_TRUE(reopened.open() == VAULT_JOURNAL_RESULT::SUCCESS);
+    TEST_ASSERT_TRUE(replayVaultEntries(reopened, entries));
+    TEST_ASSERT_EQUAL(4, entries.size());
+
+    // Запись, выходящая за конец пакета, делает пакет некорректным
+    std::string_view truncated(batch.data(), batch.size() - FLASH_WORD_SIZE);
+    std::string_view entry;
+    while (nextVaultBatchEntry(truncated, entry)){
+    }
+    TEST_ASSERT_FALSE(truncated.empty());
+}
+
+// Данные BATCH из записей с именами names
+static std::string batchPayload(const std::vector<std::string> & names){
+    std::string batch;
+    for (const auto & name : names){
+        VaultRecordEntry entry;
+        const std::string secret(20 + 28, '\x5A');
+        entry.name = name;
+        entry.secret = secret;
+        entry.digits = 6;
+        uint8_t buffer[VAULT_RECORD_BATCH_ENTRY_MAX];
+        batch.append(reinterpret_cast<const char *>(buffer), encodeVaultBatchEntry(entry, buffer));
+    }
+    return batch;
+}
+
+// Транзакция: удаления и добавления одной записью, оборванная запись оставляет прежнее состояние
+void test_vault_entry_transaction_record(void){
+    SimulatedFlash flash(TEST_FLASH_ROWS);
+    VaultJournal journal(flash);
+    journal.open();
+    compactNames(journal, {"Google", "GitHub", "Yandex", "Steam"});
+
+    const uint16_t removed[] = {3, 1, 0};
+    uint8_t header[vaultTransactionHeaderSize(3)];
+    TEST_ASSERT_EQUAL(8, encodeVaultTransactionHeader(removed, 3, header));
+    const auto transaction = std::string(reinterpret_cast<const char *>(header), sizeof(header)) + batchPayload({"Discord", "Proton"});
+
+    std::string_view removedIds, batch;
+    TEST_ASSERT_TRUE(decodeVaultTransaction(transaction, removedIds, batch));
+    TEST_ASSERT_EQUAL(6, removedIds.size());
+    TEST_ASSERT_EQUAL(transaction.size() - sizeof(header), batch.size());
+
+    flash.failAfter = transaction.size() / 2;
+    TEST_ASSERT_TRUE(journal.append(VAULT_RECORD_TRANSACTION, transaction) == VAULT_JOURNAL_RESULT::FLASH_ERROR);
+    flash.failAfter = SIZE_MAX;
+    VaultJournal reopened(flash);
+    TEST_ASSERT_TRUE(reopened.open() == VAULT_JOURNAL_RESULT::SUCCESS);
+    VaultEntryTable<8> entries(flash);
+    TEST_ASSERT_TRUE(replayVaultEntries(reopened, entries));
+    TEST_ASSERT_EQUAL(4, entries.live());
+
+    TEST_ASSERT_TRUE(compactTable(reopened, entries) == VAULT_JOURNAL_RESULT::SUCCESS);
+    TEST_ASSERT_TRUE(reopened.append(VAULT_RECORD_TRANSACTION, transaction) == VAULT_JOURNAL_RESULT::SUCCESS);
+    TEST_ASSERT_TRUE(replayVaultEntries(reopened, entries));
+    TEST_ASSERT_EQUAL(3, entries.live());
+    TEST_ASSERT_EQUAL(6, entries.size());
+    TEST_ASSERT_TRUE(entries.alive(2));
+    TEST_ASSERT_TRUE(entries[4].name == "Discord");
+    TEST_ASSERT_TRUE(entries[5].name == "Proton");
+
+    // Удаление уже удаленной записи делает журнал некорректным
+    TEST_ASSERT_TRUE(reopened.append(VAULT_RECORD_TRANSACTION, transaction) == VAULT_JOURNAL_RESULT::SUCCESS);
+    TEST_ASSERT_FALSE(replayVaultEntries(reopened, entries));
+}
+
+// Удаление в заполненном банке: надгробие не помещается, журнал уплотняется, снимок считается по таблице заново
+void test_vault_snapshot_size_after_full_remove(void){
+    SimulatedFlash flash(TEST_FLASH_ROWS);
+    VaultJournal journal(flash);
+    journal.open();
+    compactNames(journal, {});
+
+    // Последняя запись занимает банк до конца
+    for (const auto & name : {"A", "B", "C", "D", "E", "F", "G"}){
+        TEST_ASSERT_TRUE(journal.append(VAULT_RECORD_ADD, entryPayload(name, UINT8_MAX)) == VAULT_JOURNAL_RESULT::SUCCESS);
+    }
+    const auto rest = journal.bankSize() - journal.used() - VaultJournal::recordSize(0) - 3 - 1;
+    TEST_ASSERT_TRUE(journal.append(VAULT_RECORD_ADD, entryPayload("H", rest)) == VAULT_JOURNAL_RESULT::SUCCESS);
+    TEST_ASSERT_EQUAL(journal.bankSize(), journal.used());
+
+    VaultEntryTable<8> entries(flash);
+    TEST_ASSERT_TRUE(replayVaultEntries(journal, entries));
+    TEST_ASSERT_EQUAL(journal.used(), vaultSnapshotSize(entries));
+
+    // Как Salavat::removeEntry(): отметка в таблице, надгробие, при FULL - снимок и повторное чтение
+    entries.erase(0);
+    TEST_ASSERT_TRUE(journal.append(VAULT_RECORD_TOMBSTONE, removePayload(0)) == VAULT_JOURNAL_RESULT::FULL);
+    TEST_ASSERT_TRUE(compactTable(journal, entries) == VAULT_JOURNAL_RESULT::SUCCESS);
+    TEST_ASSERT_TRUE(replayVaultEntries(journal, entries));
+    TEST_ASSERT_EQUAL(journal.used(), vaultSnapshotSize(entries));
+    TEST_ASSERT_FALSE(vaultIdleCompactionDue(journal, vaultSnapshotSize(entries), journal.bankSize()));
+
+    // Следующее удаление оставляет мусор: малый запас свободного места требует уплотнения, большой - нет
+    entries.erase(1);
+    TEST_ASSERT_TRUE(journal.append(VAULT_RECORD_TOMBSTONE, removePayload(1)) == VAULT_JOURNAL_RESULT::SUCCESS);
+    const auto snapshot = vaultSnapshotSize(entries);
+    const auto garbage = VaultJournal::recordSize(2) + VaultJournal::recordSize(3 + 1 + UINT8_MAX) - VaultJournal::recordSize(0);
+    TEST_ASSERT_EQUAL(journal.used() - garbage, snapshot);
+    TEST_ASSERT_TRUE(vaultIdleCompactionDue(journal, snapshot, journal.bankSize()));
+    TEST_ASSERT_FALSE(vaultIdleCompactionDue(journal, snapshot, 0));
+}
+
+// Срок хранения ключей: граница принимается, все, что за ней, включая сроки с переполнением в миллисекундах, - нет
+void test_vault_key_idle_timeout_bounds(void){
+    unsigned long timeoutMillis = 0;
+    TEST_ASSERT_TRUE(vaultKeyIdleTimeoutMillis(1, timeoutMillis));
+    TEST_ASSERT_EQUAL(1000, timeoutMillis);
+    TEST_ASSERT_TRUE(vaultKeyIdleTimeoutMillis(VAULT_KEY_IDLE_TIMEOUT_MAX_SECONDS, timeoutMillis));
+    TEST_ASSERT_EQUAL(VAULT_KEY_IDLE_TIMEOUT_MAX_SECONDS * 1000UL, timeoutMillis);
+
+    for (long seconds : {0L, -1L, VAULT_KEY_IDLE_TIMEOUT_MAX_SECONDS + 1, 4294968L, (long)INT32_MAX}){
+        timeoutMillis = 7;
+        TEST_ASSERT_FALSE(vaultKeyIdleTimeoutMillis(seconds, timeoutMillis));
+        TEST_ASSERT_EQUAL(7, timeoutMillis);
+    }
+}
+
+// Перед сменой ключа печати проверяются все записи: одна испорченная запрещает перепечатывание
+void test_vault_entries_readable_before_rekey(void){
+    SimulatedFlash flash(TEST_FLASH_ROWS);
+    VaultJournal journal(flash);
+    journal.open();
+    journal.format();
+
+    uint8_t key[CHACHA20_KEY_LENGTH];
+    for (std::size_t i = 0; i < sizeof(key); i++){
+        key[i] = (uint8_t)(i * 5 + 3);
+    }
+    const uint8_t secret[10] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    for (const auto & name : {"Google", "GitHub", "Yandex"}){
+        uint8_t nonce[CHACHA20_NONCE_LENGTH] = {(uint8_t)name[1]};
+        uint8_t sealed[sizeof(secret) + SEALED_SECRET_OVERHEAD];
+        sealSecret(key, nonce, name, secret, sizeof(secret), sealed);
+        // Запись GitHub испорчена в теге
+        if (std::string_view(name) == "GitHub"){
+            sealed[sizeof(sealed) - 1] ^= 0x01;
+        }
+        VaultRecordEntry entry;
+        entry.name = name;
+        entry.secret = std::string_view(reinterpret_cast<const char *>(sealed), sizeof(sealed));
+        entry.digits = 6;
+        uint8_t payload[VAULT_RECORD_ENTRY_MAX];
+        const auto length = encodeVaultEntry(entry, payload);
+        TEST_ASSERT_TRUE(journal.append(VAULT_RECORD_SEALED, std::string_view(reinterpret_cast<const char *>(payload), length)) == VAULT_JOURNAL_RESULT::SUCCESS);
+    }
+
+    VaultEntryTable<8> entries(flash);
+    TEST_ASSERT_TRUE(replayVaultEntries(journal, entries));
+    std::size_t opened = 0;
+    auto open = [&](const VaultRecordEntry & entry){
+        uint8_t plain[sizeof(secret)];
+        std::size_t length;
+        const auto valid = openSecret(key, entry.secret, entry.name, plain, length);
+        opened++;
+        return valid;
+    };
+
+    // Первая запись открывается, как при проверке пароля, но вторая - нет
+    TEST_ASSERT_TRUE(open(entries[0]));
+    TEST_ASSERT_FALSE(vaultEntriesReadable(entries, open));
+
+    // Удаленная испорченная запись в снимок не попадает и перепечатыванию не мешает
+    entries.erase(1);
+    opened = 0;
+    TEST_ASSERT_TRUE(vaultEntriesReadable(entries, open));
+    TEST_ASSERT_EQUAL(2, opened);
+}
+
+// Запись KDF - первая в снимке: идентификатора не занимает, параметры читаются обратно без потерь
+void test_vault_kdf_record(void){
+    VaultKdfParams params;
+    params.iterations = 20000;
+    for (std::size_t i = 0; i < VAULT_KDF_SALT_LENGTH; i++){
+        params.salt[i] = (uint8_t)(0xC0 + i);
+    }
+    uint8_t payload[VAULT_RECORD_KDF_SIZE];
+    const std::string_view record(reinterpret_cast<const char *>(payload), encodeVaultKdf(params, payload));
+
+    VaultKdfParams decoded;
+    TEST_ASSERT_TRUE(decodeVaultKdf(record, decoded));
+    TEST_ASSERT_EQUAL(20000, decoded.iterations);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(params.salt, decoded.salt, VAULT_KDF_SALT_LENGTH);
+    TEST_ASSERT_FALSE(decodeVaultKdf(record.substr(1), decoded));
+    payload[0] = 0x02;
+    TEST_ASSERT_FALSE(decodeVaultKdf(record, decoded));
+    payload[0] = VAULT_KDF_PBKDF2_SHA1;
+
+    SimulatedFlash flash(TEST_FLASH_ROWS);
+    VaultJournal journal(flash);
+    journal.open();
+    const auto yandex = entryPayload("Yandex", 14 + 28);
+    TEST_ASSERT_TRUE(journal.compact([&](auto && emit){
+        emit(VAULT_RECORD_KDF, record);
+        emit(VAULT_RECORD_SEALED, yandex);
+    }) == VAULT_JOURNAL_RESULT::SUCCESS);
+
+    VaultEntryTable<8> entries(flash);
+    TEST_ASSERT_TRUE(replayVaultEntries(journal, entries));
+    TEST_ASSERT_EQUAL(1, entries.size());
+    TEST_ASSERT_TRUE(entries[0].name == "Yandex");
+}
+
+// Индекс имен: поиск и префикс за O(log n), после удаления и отката позиции остаются верными
+void test_vault_entry_name_index(void){
+    SimulatedFlash flash(TEST_FLASH_ROWS);
+    VaultJournal journal(flash);
+    journal.open();
+    compactNames(journal, {"Yandex", "GitHub", "Google", "Gitea", "Amazon", "Google"});
+
+    VaultEntryTable<8> entries(flash);
+    TEST_ASSERT_TRUE(replayVaultEntries(journal, entries));
+    for (std::size_t rank = 1; rank < entries.size(); rank++){
+        TEST_ASSERT_TRUE(entries[entries.byName(rank - 1)].name <= entries[entries.byName(rank)].name);
+    }
+
+    TEST_ASSERT_EQUAL(0, entries.find("Yandex"));
+    TEST_ASSERT_EQUAL(4, entries.find("Amazon"));
+    TEST_ASSERT_EQUAL(2, entries.find("Google"));
+    TEST_ASSERT_EQUAL(entries.size(), entries.find("Git"));
+    TEST_ASSERT_EQUAL(entries.size(), entries.find("Zoho"));
+
+    // "Git": GitHub, Gitea - побайтовый порядок, заглавные раньше строчных
+    auto rank = entries.lowerBound("Git");
+    TEST_ASSERT_EQUAL(1, entries.byName(rank));
+    TEST_ASSERT_EQUAL(3, entries.byName(rank + 1));
+    TEST_ASSERT_TRUE(entries[entries.byName(rank + 2)].name == "Google");
+
+    // Надгробие остается в индексе, но поиском не находится
+    entries.erase(1);
+    entries.erase(2);
+    TEST_ASSERT_EQUAL(entries.size(), entries.find("GitHub"));
+    TEST_ASSERT_EQUAL(3, entries.find("Gitea"));
+    TEST_ASSERT_EQUAL(4, entries.find("Amazon"));
+    TEST_ASSERT_EQUAL(5, entries.find("Google"));
+
+    entries.restore(1);
+    entries.restore(2);
+    TEST_ASSERT_EQUAL(1, entries.find("GitHub"));
+    TEST_ASSERT_EQUAL(2, entries.find("Google"));
+
+    // Дописанная запись встает в индекс без пересборки
+    TEST_ASSERT_TRUE(journal.append(VAULT_RECORD_ADD, entryPayload("Bitbucket", 14)) == VAULT_JOURNAL_RESULT::SUCCESS);
+    TEST_ASSERT_TRUE(entries.push_back(journal.lastPayload()));
+    TEST_ASSERT_EQUAL(6, entries.find("Bitbucket"));
+    TEST_ASSERT_EQUAL(6, entries.byName(1));
+}